@@ -0,0 +1,396 @@
+//
+// Whole-clip analysis features, for scoring renders against a target
+//
+//  tilt:     slope of the average spectrum, in dB per octave,
+//            least-squares fit from 100Hz to 10kHz
+//  loudness: ungated BS.1770 loudness (K-weighted mean square)
+//  even:     2nd+4th+6th harmonic power relative to the fundamental
+//  odd:      3rd+5th+7th harmonic power relative to the fundamental
+//
+// The harmonics need the fundamental, which comes from the pitch
+// detector. Effects don't change the pitch, so the tools find it
+// once on the input with features_f0() and pass it in.
+//
+// The spectrum is the average of 50% overlapping Hann-windowed
+// FEATURE_FFT point frames. Nothing allocates, the caller owns the
+// work area so several can run at once.
+//
+#define FEATURE_FFT 4096
+#define FEATURE_BINS (FEATURE_FFT/2+1)
+#define FEATURE_HARMONICS 7
+#define FEATURE_F0_ESTIMATES 4096
+
+struct features {
+	float tilt, loudness, even, odd;
+};
+
+struct feature_work {
+	float re[FEATURE_FFT], im[FEATURE_FFT];
+	float power[FEATURE_BINS];
+	struct biquad shelf, highpass;
+	struct pitch_detector pitch;
+	float f0[FEATURE_F0_ESTIMATES];
+};
+
+static float feature_window[FEATURE_FFT];
+
+static inline void features_init(void)
+{
+	fft_init();
+	for (int i = 0; i < FEATURE_FFT; i++)
+		feature_window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / FEATURE_FFT);
+}
+
+// The two K-weighting stages from BS.1770, for 48kHz
+static inline void features_k_weighting(struct feature_work *w)
+{
+	memset(&w->shelf, 0, sizeof(w->shelf));
+	memset(&w->highpass, 0, sizeof(w->highpass));
+	w->shelf.coeff = (struct biquad_coeff) {
+		1.53512485958697f, -2.69169618940638f, 1.19839281085285f,
+		-1.69065929318241f, 0.73248077421585f,
+	};
+	w->highpass.coeff = (struct biquad_coeff) {
+		1.0f, -2.0f, 1.0f,
+		-1.99004745483398f, 0.99007225036621f,
+	};
+}
+
+// K-weighted sum of squares, carrying the filter state along so
+// that a long file can go through it a block at a time
+static inline double features_k_sum(const float *x, int n, struct feature_work *w)
+{
+	double sum = 0;
+
+	for (int i = 0; i < n; i++) {
+		float k = biquad_step(&w->highpass, biquad_step(&w->shelf, x[i]));
+		sum += k * k;
+	}
+	return sum;
+}
+
+static inline float features_lufs(double sum, long n)
+{
+	return -0.691f + 10 * log10f(sum / n + 1e-12f);
+}
+
+static inline float features_loudness(const float *x, int n, struct feature_work *w)
+{
+	features_k_weighting(w);
+	return features_lufs(features_k_sum(x, n, w), n);
+}
+
+static inline void features_spectrum(const float *x, int n, struct feature_work *w)
+{
+	int frames = 0;
+
+	memset(w->power, 0, sizeof(w->power));
+	for (int pos = 0; pos + FEATURE_FFT <= n; pos += FEATURE_FFT/2) {
+		for (int i = 0; i < FEATURE_FFT; i++) {
+			w->re[i] = x[pos + i] * feature_window[i];
+			w->im[i] = 0;
+		}
+		fft(w->re, w->im, FEATURE_FFT);
+		for (int k = 0; k < FEATURE_BINS; k++)
+			w->power[k] += w->re[k]*w->re[k] + w->im[k]*w->im[k];
+		frames++;
+	}
+	for (int k = 0; frames && k < FEATURE_BINS; k++)
+		w->power[k] /= frames;
+}
+
+static inline float features_tilt(const struct feature_work *w)
+{
+	const float bin_hz = SAMPLES_PER_SEC / FEATURE_FFT;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	int n = 0;
+
+	for (int k = 100 / bin_hz + 1; k * bin_hz <= 10000; k++) {
+		double x = log2(k * bin_hz), y = 10 * log10(w->power[k] + 1e-20);
+
+		sx += x; sy += y;
+		sxx += x*x; sxy += x*y;
+		n++;
+	}
+	return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+// Strongest bin within two bins of harmonic 'h'
+static inline float features_harmonic(const struct feature_work *w, float f0, int h)
+{
+	int center = lrintf(h * f0 * FEATURE_FFT / SAMPLES_PER_SEC);
+	float max = 0;
+
+	for (int k = center - 2; k <= center + 2; k++) {
+		if (k > 0 && k < FEATURE_BINS && w->power[k] > max)
+			max = w->power[k];
+	}
+	return max;
+}
+
+// 'f0' of zero leaves the harmonic ratios at zero
+static inline void features_measure(const float *x, int n, float f0,
+	struct features *f, struct feature_work *w)
+{
+	features_spectrum(x, n, w);
+	f->tilt = features_tilt(w);
+	f->loudness = features_loudness(x, n, w);
+	f->even = f->odd = 0;
+
+	if (f0 <= 0)
+		return;
+
+	float p[FEATURE_HARMONICS+1], even = 0, odd = 0;
+	for (int h = 1; h <= FEATURE_HARMONICS; h++)
+		p[h] = features_harmonic(w, f0, h);
+	for (int h = 2; h <= FEATURE_HARMONICS; h++) {
+		if (h & 1)
+			odd += p[h];
+		else
+			even += p[h];
+	}
+	f->even = 10 * log10f((even + 1e-20f) / (p[1] + 1e-20f));
+	f->odd = 10 * log10f((odd + 1e-20f) / (p[1] + 1e-20f));
+}
+
+// Median of the confident pitch estimates, or zero if there are
+// too few of them to call it pitched material
+static inline float features_f0(const float *x, int n, struct feature_work *w)
+{
+	struct pitch_detector *pd = &w->pitch;
+	float *est = w->f0;
+	int nr = 0;
+
+	pitch_detector_init(pd, 0.15f);
+	for (int i = 0; i < n; i++) {
+		if (pitch_detector_step(pd, x[i]) && pd->confidence > 0.8f && nr < FEATURE_F0_ESTIMATES)
+			est[nr++] = pd->freq;
+	}
+	if (nr < 10)
+		return 0;
+
+	// Insertion sort, it's a one-off
+	for (int i = 1; i < nr; i++) {
+		float v = est[i];
+		int j = i;
+		for (; j > 0 && est[j-1] > v; j--)
+			est[j] = est[j-1];
+		est[j] = v;
+	}
+	return est[nr / 2];
+}
+
+//
+// Per-frame descriptors
+//
+// FRAME_SIZE samples every FRAME_HOP, Hann-windowed:
+//
+//  rms, crest:   level, and peak over rms in dB
+//  zcr:          zero crossings per sample
+//  centroid:     power-weighted mean frequency, Hz
+//  rolloff:      frequency below which 85% of the power is, Hz
+//  flatness:     geometric over arithmetic mean of the power
+//  flux:         sum of the increases of log2 power since the
+//                previous frame, over the bins
+//  mfcc0..12:    DCT of the log of a 26 band mel filterbank
+//
+// Frames are real, so they go through the FFT two at a time (one
+// as the real part and one as the imaginary part) and get split
+// afterwards. The per-bin work, the mel filters and the DCT are
+// all vec4 loops: the filters are stored as short runs of weights
+// over the bins where they're non-zero.
+//
+#define FRAME_SIZE 1024
+#define FRAME_HOP (FRAME_SIZE/2)
+#define FRAME_BINS (FRAME_SIZE/2+1)
+#define FRAME_BINS_VEC ((FRAME_BINS + VEC_WIDTH-1) & ~(VEC_WIDTH-1))
+#define MEL_BANDS 26
+#define MEL_BANDS_VEC 28
+#define MEL_LOW 20.0
+#define MEL_HIGH 16000.0
+#define MEL_MAX_WIDTH 128
+#define MFCC_COEFFS 13
+
+enum {
+	FRAME_RMS, FRAME_CREST, FRAME_ZCR, FRAME_CENTROID, FRAME_ROLLOFF,
+	FRAME_FLATNESS, FRAME_FLUX, FRAME_MFCC,
+	FRAME_FEATURES = FRAME_MFCC + MFCC_COEFFS
+};
+
+static inline const char *frame_feature_name(int i)
+{
+	static const char *names[FRAME_FEATURES] = {
+		"rms", "crest", "zcr", "centroid", "rolloff", "flatness", "flux",
+		"mfcc0", "mfcc1", "mfcc2", "mfcc3", "mfcc4", "mfcc5", "mfcc6",
+		"mfcc7", "mfcc8", "mfcc9", "mfcc10", "mfcc11", "mfcc12",
+	};
+	return names[i];
+}
+
+struct frame_work {
+	float re[FRAME_SIZE], im[FRAME_SIZE];
+	float power[FRAME_BINS_VEC], log_power[FRAME_BINS_VEC];
+	float prev_log[FRAME_BINS_VEC];
+	float mel[MEL_BANDS_VEC];
+	int frames;
+};
+
+static struct {
+	float window[FRAME_SIZE];
+	float freq[FRAME_BINS_VEC];
+	int start[MEL_BANDS], width[MEL_BANDS];
+	float weight[MEL_BANDS][MEL_MAX_WIDTH];
+	float dct[MFCC_COEFFS][MEL_BANDS_VEC];
+} frame_tables;
+
+static inline double hz_to_mel(double f) { return 2595 * log10(1 + f / 700); }
+static inline double mel_to_hz(double m) { return 700 * (pow(10, m / 2595) - 1); }
+
+static inline void frame_features_init(void)
+{
+	const double bin_hz = SAMPLES_PER_SEC / FRAME_SIZE;
+	double edge[MEL_BANDS + 2];
+
+	fft_init();
+	for (int i = 0; i < FRAME_SIZE; i++)
+		frame_tables.window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / FRAME_SIZE);
+	for (int k = 0; k < FRAME_BINS; k++)
+		frame_tables.freq[k] = k * bin_hz;
+
+	// Triangles between mel-spaced edges, rounded out to whole
+	// vectors of bins
+	for (int b = 0; b < MEL_BANDS + 2; b++)
+		edge[b] = mel_to_hz(hz_to_mel(MEL_LOW) +
+			(hz_to_mel(MEL_HIGH) - hz_to_mel(MEL_LOW)) * b / (MEL_BANDS + 1));
+	for (int b = 0; b < MEL_BANDS; b++) {
+		int lo = (int)(edge[b] / bin_hz) & ~(VEC_WIDTH-1);
+		int hi = (int)(edge[b+2] / bin_hz) + 1;
+		int width = (hi - lo + VEC_WIDTH-1) & ~(VEC_WIDTH-1);
+
+		if (width > MEL_MAX_WIDTH)
+			width = MEL_MAX_WIDTH;
+		frame_tables.start[b] = lo;
+		frame_tables.width[b] = width;
+		for (int i = 0; i < width; i++) {
+			double f = (lo + i) * bin_hz, w = 0;
+			if (f > edge[b] && f < edge[b+1])
+				w = (f - edge[b]) / (edge[b+1] - edge[b]);
+			else if (f >= edge[b+1] && f < edge[b+2])
+				w = (edge[b+2] - f) / (edge[b+2] - edge[b+1]);
+			frame_tables.weight[b][i] = w;
+		}
+	}
+
+	for (int c = 0; c < MFCC_COEFFS; c++) {
+		for (int b = 0; b < MEL_BANDS; b++)
+			frame_tables.dct[c][b] = cos(M_PI * c * (b + 0.5) / MEL_BANDS) *
+				sqrt((c ? 2.0 : 1.0) / MEL_BANDS);
+	}
+}
+
+static inline void frame_time_features(const float *x, float *f)
+{
+	float sum = 0, peak = 0;
+	int crossings = 0;
+
+	for (int i = 0; i < FRAME_SIZE; i++) {
+		float a = fabsf(x[i]);
+		sum += x[i] * x[i];
+		if (a > peak)
+			peak = a;
+		if (i && (x[i] < 0) != (x[i-1] < 0))
+			crossings++;
+	}
+	f[FRAME_RMS] = sqrtf(sum / FRAME_SIZE);
+	f[FRAME_CREST] = 20 * log10f((peak + 1e-9f) / (f[FRAME_RMS] + 1e-9f));
+	f[FRAME_ZCR] = (float) crossings / FRAME_SIZE;
+}
+
+// The power spectrum is in w->power, FRAME_BINS of it
+static inline void frame_spectral_features(struct frame_work *w, float *f)
+{
+	// About -90dB: below that, bins are noise and their flux is
+	// meaningless
+	const float eps = 1e-9f;
+	vec4 total = vec4_set1(0), moment = vec4_set1(0);
+	vec4 logsum = vec4_set1(0), flux = vec4_set1(0);
+
+	for (int k = FRAME_BINS; k < FRAME_BINS_VEC; k++)
+		w->power[k] = 0;
+
+	for (int k = 0; k < FRAME_BINS_VEC; k += VEC_WIDTH) {
+		vec4 p = vec4_load(w->power + k);
+		vec4 l = vec4_log2(p + eps);
+
+		total += p;
+		moment += p * vec4_load(frame_tables.freq + k);
+		logsum += l;
+		flux += vec4_max(l - vec4_load(w->prev_log + k), vec4_set1(0));
+		vec4_store(w->log_power + k, l);
+	}
+	memcpy(w->prev_log, w->log_power, sizeof(w->prev_log));
+
+	float sum = vec4_sum(total);
+	f[FRAME_CENTROID] = vec4_sum(moment) / (sum + eps);
+	f[FRAME_FLUX] = w->frames ? vec4_sum(flux) : 0;
+
+	// The padding bins are log2(eps), leave them out of the mean
+	float mean_log = (vec4_sum(logsum) - (FRAME_BINS_VEC - FRAME_BINS) * log2f(eps)) / FRAME_BINS;
+	f[FRAME_FLATNESS] = exp2f(mean_log) / (sum / FRAME_BINS + eps);
+
+	float acc = 0;
+	int k = 0;
+	while (k < FRAME_BINS-1 && (acc += w->power[k]) < 0.85f * sum)
+		k++;
+	f[FRAME_ROLLOFF] = frame_tables.freq[k];
+
+	for (int b = 0; b < MEL_BANDS; b++) {
+		float e = vec_dot(frame_tables.weight[b], w->power + frame_tables.start[b], frame_tables.width[b]);
+		w->mel[b] = e + eps;
+	}
+	for (int b = MEL_BANDS; b < MEL_BANDS_VEC; b++)
+		w->mel[b] = 1;
+	for (int b = 0; b < MEL_BANDS_VEC; b += VEC_WIDTH)
+		vec4_store(w->mel + b, vec4_log2(vec4_load(w->mel + b)) * 0.69314718f);
+	for (int c = 0; c < MFCC_COEFFS; c++)
+		f[FRAME_MFCC + c] = vec_dot(frame_tables.dct[c], w->mel, MEL_BANDS_VEC);
+	w->frames++;
+}
+
+// Two frames with one FFT. 'b' can be NULL for a lone last frame.
+static inline void frame_features(const float *a, const float *b, float *fa, float *fb, struct frame_work *w)
+{
+	for (int i = 0; i < FRAME_SIZE; i += VEC_WIDTH) {
+		vec4 win = vec4_load(frame_tables.window + i);
+		vec4_store(w->re + i, vec4_load(a + i) * win);
+		vec4_store(w->im + i, b ? vec4_load(b + i) * win : vec4_set1(0));
+	}
+	fft(w->re, w->im, FRAME_SIZE);
+
+	// Split: A(k) = (Z(k) + conj Z(N-k)) / 2, B(k) = (Z(k) - conj Z(N-k)) / 2i,
+	// and we only need the powers. Bin k and N-k are both
+	// read before either is written, so this is done in place.
+	float *pa = w->power, *pb = w->log_power;
+	for (int k = 0; k < FRAME_BINS; k++) {
+		int m = (FRAME_SIZE - k) & (FRAME_SIZE-1);
+		float zr = w->re[k], zi = w->im[k], cr = w->re[m], ci = w->im[m];
+		float ar = zr + cr, ai = zi - ci;
+		float br = zi + ci, bi = cr - zr;
+
+		pa[k] = 0.25f * (ar*ar + ai*ai);
+		pb[k] = 0.25f * (br*br + bi*bi);
+	}
+
+	frame_time_features(a, fa);
+	if (b) {
+		// frame_spectral_features() wants the power in w->power
+		// and overwrites log_power, so keep b's in 're'
+		memcpy(w->re, pb, FRAME_BINS * sizeof(float));
+	}
+	frame_spectral_features(w, fa);
+	if (b) {
+		memcpy(w->power, w->re, FRAME_BINS * sizeof(float));
+		frame_time_features(b, fb);
+		frame_spectral_features(w, fb);
+	}
+}
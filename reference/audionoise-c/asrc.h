@@ -0,0 +1,175 @@
+//
+// Asynchronous sample rate converter for independent clocks
+//
+// The producer writes samples at its own rate, the consumer reads
+// at its own, and the two drift apart by some tens of ppm. We keep
+// the FIFO between them at a target fill level by adjusting the
+// resampling ratio with a PI controller on the (low-passed) fill.
+//
+// The resampler itself is a windowed-sinc polyphase filter with
+// ASRC_PHASES phases of ASRC_TAPS taps each. We interpolate between
+// the two nearest phases, and both dot products are done with
+// vec.h. The FIFO is mirrored (every sample is stored twice) so
+// that the filter window is always contiguous in memory.
+//
+// Control loop: with ratio = 1 + Kp*e + Ki*sum(e), the fill error
+// behaves like a second order system with natural frequency
+// sqrt(Ki) (per sample) and damping Kp/(2*sqrt(Ki)). We start
+// out with a wide loop to lock quickly, then narrow it so block
+// sized jumps in the fill level don't turn into audible wobble.
+//
+#define ASRC_TAPS 32
+#define ASRC_PHASES 128
+#define ASRC_FIFO 4096
+#define ASRC_FIFO_MASK (ASRC_FIFO-1)
+
+#define ASRC_ACQUIRE_HZ 0.5
+#define ASRC_TRACK_HZ 0.01
+#define ASRC_ACQUIRE_SAMPLES (2*SAMPLES_PER_SEC)
+
+static float asrc_coeff[ASRC_PHASES+1][ASRC_TAPS];
+
+struct asrc {
+	float fifo[2*ASRC_FIFO];
+	uint write_idx, read_idx;
+	double read_frac, ratio;
+
+	// Control loop
+	float target, level, fill;
+	int running;
+	double kp, ki, integral;
+	uint samples_out;
+
+	// Stats
+	uint underruns, overruns;
+	float min_fill, max_fill;
+};
+
+// Blackman-windowed sinc, cutoff a bit below Nyquist.
+// Each phase is normalized to unity DC gain.
+static void asrc_design(void)
+{
+	const float cutoff = 0.9f;
+
+	for (int p = 0; p <= ASRC_PHASES; p++) {
+		float sum = 0;
+		for (int k = 0; k < ASRC_TAPS; k++) {
+			float t = (float)p / ASRC_PHASES + ASRC_TAPS/2 - 1 - k;
+			float x = M_PI * cutoff * t;
+			float w = (t + ASRC_TAPS/2) / ASRC_TAPS;
+			float h = fabsf(x) < 1e-6f ? 1 : sinf(x) / x;
+
+			w = 0.42f - 0.5f * cosf(2*M_PI*w) + 0.08f * cosf(4*M_PI*w);
+			asrc_coeff[p][k] = h * w;
+			sum += h * w;
+		}
+		for (int k = 0; k < ASRC_TAPS; k++)
+			asrc_coeff[p][k] /= sum;
+	}
+}
+
+static void asrc_set_bandwidth(struct asrc *a, double hz)
+{
+	double wn = 2 * M_PI * hz / SAMPLES_PER_SEC;
+
+	a->ki = wn * wn;
+	a->kp = 2 * 0.7 * wn;
+}
+
+// 'target' is the FIFO fill (in samples) we try to keep. It
+// has to cover the producer and consumer block sizes plus
+// half the filter length.
+static void asrc_init(struct asrc *a, float target)
+{
+	memset(a, 0, sizeof(*a));
+	if (!asrc_coeff[0][ASRC_TAPS/2 - 1])
+		asrc_design();
+
+	a->ratio = 1;
+	a->target = target;
+	a->level = a->fill = target;
+	a->min_fill = ASRC_FIFO;
+	asrc_set_bandwidth(a, ASRC_ACQUIRE_HZ);
+
+	// Start out with half the filter window of silence
+	a->write_idx = ASRC_TAPS/2;
+}
+
+static inline float asrc_level(struct asrc *a)
+{
+	return (float)(a->write_idx - a->read_idx) - (float)a->read_frac;
+}
+
+static void asrc_write(struct asrc *a, const float *in, int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (a->write_idx - a->read_idx >= ASRC_FIFO - ASRC_TAPS) {
+			a->overruns++;
+			return;
+		}
+		uint idx = a->write_idx++ & ASRC_FIFO_MASK;
+		a->fifo[idx] = a->fifo[idx + ASRC_FIFO] = in[i];
+	}
+}
+
+static inline float asrc_sample(struct asrc *a)
+{
+	const float *x = a->fifo + ((a->read_idx - ASRC_TAPS/2 + 1) & ASRC_FIFO_MASK);
+	float phase = a->read_frac * ASRC_PHASES;
+	int p = (int) phase;
+	float frac = phase - p;
+
+	float y0 = vec_dot(asrc_coeff[p], x, ASRC_TAPS);
+	float y1 = vec_dot(asrc_coeff[p+1], x, ASRC_TAPS);
+	return y0 + (y1 - y0) * frac;
+}
+
+static void asrc_read(struct asrc *a, float *out, int n)
+{
+	// Don't start until the producer has filled us up
+	if (!a->running) {
+		if (asrc_level(a) < a->target) {
+			memset(out, 0, n * sizeof(float));
+			return;
+		}
+		a->running = 1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		// We need half a filter window of lookahead
+		if ((int)(a->write_idx - a->read_idx) <= ASRC_TAPS/2) {
+			a->underruns++;
+			out[i] = 0;
+			continue;
+		}
+		out[i] = asrc_sample(a);
+
+		double pos = a->read_frac + a->ratio;
+		int adv = (int) pos;
+		a->read_idx += adv;
+		a->read_frac = pos - adv;
+
+		// Two poles of ~40ms smoothing on the fill level. The
+		// raw level is a sawtooth from the block sizes, and
+		// we don't want that to frequency modulate the output.
+		a->level += (asrc_level(a) - a->level) * (1.0f/2048);
+		a->fill += (a->level - a->fill) * (1.0f/2048);
+	}
+
+	float level = asrc_level(a);
+	if (level < a->min_fill)
+		a->min_fill = level;
+	if (level > a->max_fill)
+		a->max_fill = level;
+
+	// Once per block is plenty for a loop this slow. The
+	// integral holds the ratio correction itself, so changing
+	// the gains doesn't bump the ratio.
+	double err = a->fill - a->target;
+	a->integral += a->ki * err * n;
+	a->ratio = 1 + a->kp * err + a->integral;
+
+	a->samples_out += n;
+	if (a->samples_out >= ASRC_ACQUIRE_SAMPLES && a->samples_out - n < ASRC_ACQUIRE_SAMPLES)
+		asrc_set_bandwidth(a, ASRC_TRACK_HZ);
+}
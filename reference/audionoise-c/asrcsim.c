@@ -0,0 +1,105 @@
+//
+// Clock drift simulator for the asynchronous resampler
+//
+// Runs a producer and a consumer on two independent clocks that
+// differ by 'ppm', both working in blocks like a real audio
+// interface would, and reports how well the converter tracks the
+// drift and what it costs.
+//
+//	asrcsim [ppm [seconds [in_block [out_block]]]]
+//
+// Over the second half of the run (after the loop has locked)
+// we report the error of the average ratio against the real
+// clock ratio, which is how well the drift is tracked, and the
+// RMS wobble of the ratio around it, which is what you'd hear.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "vec.h"
+#include "asrc.h"
+
+#define MAX_BLOCK 1024
+
+static struct asrc asrc;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	double ppm = argc > 1 ? atof(argv[1]) : 50;
+	double seconds = argc > 2 ? atof(argv[2]) : 600;
+	int in_block = argc > 3 ? atoi(argv[3]) : 64;
+	int out_block = argc > 4 ? atoi(argv[4]) : 48;
+	double in_rate = SAMPLES_PER_SEC * (1 + ppm * 1e-6);
+	double true_ratio = in_rate / SAMPLES_PER_SEC;
+	float in[MAX_BLOCK], out[MAX_BLOCK];
+	double in_time = 0, out_time = 0, dsp_ns = 0;
+	double sum = 0, sum2 = 0, max_err = 0;
+	uint in_blocks = 0, out_blocks = 0, measured = 0;
+	struct lfo_state tone = { LFO_FREQ(1000) };
+
+	if (in_block < 1 || in_block > MAX_BLOCK || out_block < 1 || out_block > MAX_BLOCK)
+		return 1;
+
+	asrc_init(&asrc, in_block + out_block + ASRC_TAPS);
+
+	fprintf(stderr, "asrcsim:");
+	fprintf(stderr, " drift=%g ppm", ppm);
+	fprintf(stderr, " time=%g s", seconds);
+	fprintf(stderr, " blocks=%d/%d\n", in_block, out_block);
+
+	while (out_time < seconds) {
+		// Whichever side's interrupt comes first
+		if (in_time <= out_time) {
+			for (int i = 0; i < in_block; i++)
+				in[i] = 0.5f * lfo_step(&tone, lfo_sinewave);
+			asrc_write(&asrc, in, in_block);
+			in_time = ++in_blocks * in_block / in_rate;
+			continue;
+		}
+
+		double start = now_ns();
+		asrc_read(&asrc, out, out_block);
+		dsp_ns += now_ns() - start;
+		out_time = ++out_blocks * out_block / SAMPLES_PER_SEC;
+
+		if (out_time > seconds / 2) {
+			double err = (asrc.ratio - true_ratio) * 1e6;
+			sum += err;
+			sum2 += err * err;
+			if (fabs(err) > max_err)
+				max_err = fabs(err);
+			measured++;
+		}
+	}
+
+	fprintf(stderr, "asrcsim: ratio=%.9f true=%.9f\n", asrc.ratio, true_ratio);
+	if (measured) {
+		double mean = sum / measured;
+		fprintf(stderr, "asrcsim: tracking error=%.4f ppm wobble rms=%.4f ppm max=%.4f ppm\n",
+			mean, sqrt(sum2 / measured - mean * mean), max_err);
+	}
+	fprintf(stderr, "asrcsim: fill target=%.0f min=%.1f max=%.1f underruns=%u overruns=%u\n",
+		asrc.target, asrc.min_fill, asrc.max_fill, asrc.underruns, asrc.overruns);
+	fprintf(stderr, "asrcsim: cost=%.1f ns/sample (%.3f%% of a core at %g Hz)\n",
+		dsp_ns / (out_blocks * (double)out_block),
+		100 * dsp_ns / (seconds * 1e9), SAMPLES_PER_SEC);
+	return 0;
+}
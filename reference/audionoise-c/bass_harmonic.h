@@ -13,7 +13,7 @@
 //   Path C: Odd harmonics (hard clip, LPF 300-450 Hz)
 //
 
-struct {
+static struct {
 	// Path A - Fundamental
 	struct biquad fund_hpf;
 	float fund_level;
@@ -29,9 +29,19 @@ struct {
 
 	// Output
 	float output_trim;
+
+	// Optional pitch tracking of the even/odd filters
+	struct harmonic_tracker track;
 } bass_harmonic;
 
-void bass_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+EFFECT_MEMORY(bass_harmonic, sizeof(bass_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_MEMORY(bass_harmonic_track, sizeof(bass_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_STATE(bass_harmonic, REGION(bass_harmonic));
+EFFECT_STATE(bass_harmonic_track, REGION(bass_harmonic));
+
+// A pot change only sets the levels, which leaves a tracker
+// alone
+static void bass_harmonic_update(float pot1, float pot2, float pot3, float pot4)
 {
 	// pot1: Fundamental level (linear 0-1)
 	// pot2: Even harmonics level (log curve)
@@ -44,6 +54,15 @@ void bass_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	bass_harmonic.odd_level = pot3 * pot3;
 	bass_harmonic.output_trim = 0.5f + pot4 * 0.5f;  // 0.5 to 1.0
 
+	fprintf(stderr, "bass_harmonic:");
+	fprintf(stderr, " fund=%.2f", bass_harmonic.fund_level);
+	fprintf(stderr, " even=%.2f", bass_harmonic.even_level);
+	fprintf(stderr, " odd=%.2f", bass_harmonic.odd_level);
+	fprintf(stderr, " trim=%.2f\n", bass_harmonic.output_trim);
+}
+
+static void bass_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+{
 	// Path A: 1st-order HPF at 70 Hz (center of 60-80 range)
 	// Using Q=0.707 for Butterworth-like response
 	biquad_hpf(&bass_harmonic.fund_hpf, 70.0f, 0.707f);
@@ -60,17 +79,17 @@ void bass_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	biquad_lpf(&bass_harmonic.odd_lpf[0], 375.0f, 0.54f);
 	biquad_lpf(&bass_harmonic.odd_lpf[1], 375.0f, 1.31f);
 
-	fprintf(stderr, "bass_harmonic:");
-	fprintf(stderr, " fund=%.2f", bass_harmonic.fund_level);
-	fprintf(stderr, " even=%.2f", bass_harmonic.even_level);
-	fprintf(stderr, " odd=%.2f", bass_harmonic.odd_level);
-	fprintf(stderr, " trim=%.2f\n", bass_harmonic.output_trim);
+	bass_harmonic.track.enabled = 0;
+	bass_harmonic_update(pot1, pot2, pot3, pot4);
 }
 
-float bass_harmonic_step(float in)
+static float bass_harmonic_step(float in)
 {
 	float path_a, path_b, path_c;
 
+	if (bass_harmonic.track.enabled)
+		harmonic_track_step(&bass_harmonic.track, in);
+
 	// Path A: Fundamental - HPF only, no nonlinearity
 	path_a = biquad_step(&bass_harmonic.fund_hpf, in);
 	path_a *= bass_harmonic.fund_level;
@@ -96,3 +115,21 @@ float bass_harmonic_step(float in)
 
 	return limit_value(out);
 }
+
+// Tracking mode: the even/odd filter corners follow the played
+// fundamental, keeping their ratio to the nominal 100 Hz
+static void bass_harmonic_track_init(float pot1, float pot2, float pot3, float pot4)
+{
+	struct harmonic_tracker *t = &bass_harmonic.track;
+
+	bass_harmonic_init(pot1, pot2, pot3, pot4);
+
+	harmonic_track_init(t, 100.0f, 30.0f, 400.0f);
+	harmonic_track_filter(t, &bass_harmonic.even_lpf[0], 215.0f, 0.707f);
+	harmonic_track_filter(t, &bass_harmonic.even_lpf[1], 215.0f, 0.707f);
+	harmonic_track_filter(t, &bass_harmonic.odd_lpf[0], 375.0f, 0.54f);
+	harmonic_track_filter(t, &bass_harmonic.odd_lpf[1], 375.0f, 1.31f);
+
+	fprintf(stderr, "bass_harmonic: tracking 30-400 Hz\n");
+}
+#define bass_harmonic_track_step bass_harmonic_step
@@ -0,0 +1,530 @@
+//
+// End-to-end benchmark of 'convert' over a generated corpus
+//
+//	bench [-c convert] [-d dir] [-t seconds] [-k channels] [-r runs]
+//	      [-e effect] [-b baseline] [-s save] [-T percent] [scenario...]
+//
+// The per-effect timings ('convert -n', rtcheck) only see the DSP.
+// This runs the real 'convert' binary as a child process, the way
+// it's used, so the reading, the sample conversion, the FLAC coding,
+// the chaining and the process startup are all in the numbers:
+//
+//	pipe:		input and output both through pipes
+//	file:		input from a file, output to /dev/null
+//	generator:	'-g', no input at all
+//	flac-in:	FLAC input, decoded on the way in
+//	flac-out:	FLAC output (-f)
+//	sidechain:	the vocoder, with a second input (-x)
+//	chain:		three effects in a chain (a '-w' swap at 0)
+//	multichannel:	one convert per channel, all at once
+//	batch:		32 short files, one after the other
+//
+// convert is mono, so a multichannel job is a process per channel,
+// which is also how a multitrack session gets rendered.
+//
+// The corpus goes in 'dir' (default bench-corpus) and is only made
+// once: 'channels' files of 'seconds' each (default 4 x 600), 10
+// second sections of the gen.h signals in a different order and
+// with a different seed for each channel, plus a FLAC copy of the
+// first and the 32 batch files. It's exactly the same every time,
+// so it can also be deleted at any point.
+//
+// Each scenario reports the wall time, the CPU time and peak RSS of
+// the convert processes (summed over the ones running at once), and
+// the throughput as a realtime factor. With -r the fastest of that
+// many runs counts. -s saves the results, -b compares against saved
+// ones, and a realtime factor more than 'percent' (default 10) below
+// the baseline fails the run.
+//
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "gen.h"
+#include "flac.h"
+
+#define SECTION 10		// seconds per corpus section
+#define BATCH 32
+#define MAX_CHANNELS 16
+#define MAX_ARGS 16
+#define MAX_RESULTS 32
+
+struct result {
+	char name[32];
+	double audio;		// seconds of audio processed
+	double wall, cpu;	// seconds
+	long rss;		// kB
+};
+
+static const char *convert = "./convert", *dir = "bench-corpus", *effect = "phaser";
+static float seconds = 600;
+static int channels = 4;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void corpus_path(char *path, size_t size, const char *what, int i, const char *ext)
+{
+	snprintf(path, size, "%s/%s%d-%g.%s", dir, what, i, seconds, ext);
+}
+
+// One file of 'length' samples, sections of the generators from
+// 'first' on. It's written under a temporary name and renamed, so a
+// file that's there is always complete.
+static int make_corpus(const char *path, uint length, int first, int flac)
+{
+	struct stat st;
+	char tmp[1024];
+	float in[FLAC_BLOCK];
+	s32 buf[FLAC_BLOCK];
+
+	if (!stat(path, &st))
+		return 0;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *file = fopen(tmp, "w");
+	if (!file) {
+		perror(tmp);
+		return -1;
+	}
+	FILE *out = flac ? flac_output(file, sysconf(_SC_NPROCESSORS_ONLN)) : file;
+	if (!out)
+		return -1;
+	fprintf(stderr, "bench: making %s\n", path);
+
+	uint section = SECTION * SAMPLES_PER_SEC;
+	for (uint done = 0, j = 0; done < length; done += section, j++) {
+		const struct generator *g = generators + (first + j) % ARRAY_SIZE(generators);
+		uint n = length - done < section ? length - done : section;
+
+		gen_init(n);
+		gen.seed = 1 + first * 7919 + j;
+		for (uint i = 0; i < n; i += FLAC_BLOCK) {
+			int m = n - i < FLAC_BLOCK ? n - i : FLAC_BLOCK;
+
+			gen_block(g, in, m);
+			for (int k = 0; k < m; k++)
+				buf[k] = (int)(in[k] * 0x80000000);
+			if (fwrite(buf, 4, m, out) != m)
+				return -1;
+		}
+	}
+	if (fclose(out) || (flac && fclose(file)) || rename(tmp, path)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int make_all(void)
+{
+	uint length = seconds * SAMPLES_PER_SEC;
+	char path[1024];
+
+	mkdir(dir, 0777);
+	for (int i = 0; i < channels; i++) {
+		corpus_path(path, sizeof(path), "ch", i, "raw");
+		if (make_corpus(path, length, i, 0))
+			return -1;
+	}
+	corpus_path(path, sizeof(path), "ch", 0, "flac");
+	if (make_corpus(path, length, 0, 1))
+		return -1;
+	for (int i = 0; i < BATCH; i++) {
+		corpus_path(path, sizeof(path), "batch", i, "raw");
+		if (make_corpus(path, length / BATCH, i, 0))
+			return -1;
+	}
+
+	// The chain is a swap to three effects right at the start: the
+	// one being timed and the first two of these that can share a
+	// chain with it (see effects_clash())
+	static const struct {
+		const char *name, *pots;
+	} others[] = {
+		{ "echo", "0.3 0.4 0.3 0.5" }, { "reverb", "0.5 0.5 0.3 0.5" },
+		{ "phaser", "0.5 0.5 0.5 0.5" }, { "magnitude", "0.5 0.5 0.5 0.5" },
+	};
+	struct effect *chain[3] = { find_effect(effect) };
+	int nr = 1;
+
+	snprintf(path, sizeof(path), "%s/chain.txt", dir);
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "0 %s 0.5 0.5 0.5 0.5", effect);
+	for (int i = 0; i < ARRAY_SIZE(others) && nr < 3; i++) {
+		int clash = 0;
+
+		chain[nr] = find_effect(others[i].name);
+		for (int e = 0; e < nr; e++)
+			clash |= !chain[e] || effects_clash(chain[e], chain[nr]);
+		if (clash)
+			continue;
+		fprintf(f, " %s %s", others[i].name, others[i].pots);
+		nr++;
+	}
+	fprintf(f, "\n");
+	return fclose(f);
+}
+
+// A child with stdin from 'in' (a file name, or a pipe fd if 'in_fd'
+// isn't -1) and stdout to 'out_fd'. Messages go to /dev/null.
+static pid_t spawn(char **argv, const char *in, int in_fd, int out_fd)
+{
+	pid_t pid = fork();
+
+	if (pid)
+		return pid;
+	int null = open("/dev/null", O_RDWR);
+	if (in_fd < 0)
+		in_fd = in ? open(in, O_RDONLY) : null;
+	if (in_fd < 0 || null < 0)
+		_exit(127);
+	dup2(in_fd, 0);
+	dup2(out_fd < 0 ? null : out_fd, 1);
+	dup2(null, 2);
+	execv(argv[0], argv);
+	_exit(127);
+}
+
+// The harness ends of the pipes: copy a file in, or throw it all
+// away. 'fd' is the four pipe ends, and each keeps only its own.
+static pid_t feeder(const char *in, const int *fd)
+{
+	pid_t pid = fork();
+
+	if (pid)
+		return pid;
+	char buf[65536];
+	ssize_t n;
+	int file = open(in, O_RDONLY);
+	close(fd[0]); close(fd[2]); close(fd[3]);
+	while (file >= 0 && (n = read(file, buf, sizeof(buf))) > 0) {
+		if (write(fd[1], buf, n) != n)
+			break;
+	}
+	_exit(0);
+}
+
+static pid_t drainer(const int *fd)
+{
+	pid_t pid = fork();
+
+	if (pid)
+		return pid;
+	char buf[65536];
+	close(fd[0]); close(fd[1]); close(fd[3]);
+	while (read(fd[2], buf, sizeof(buf)) > 0)
+		;
+	_exit(0);
+}
+
+// Waits for 'nr' converts, adding up their time and memory
+static int collect(const pid_t *pid, int nr, struct result *r)
+{
+	int failed = 0;
+
+	for (int i = 0; i < nr; i++) {
+		struct rusage ru;
+		int status;
+
+		if (wait4(pid[i], &status, 0, &ru) != pid[i])
+			return -1;
+		failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+		r->cpu += ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+			  ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+		r->rss += ru.ru_maxrss;
+	}
+	return failed ? -1 : 0;
+}
+
+// argv for one convert: the options, then the effect and its pots
+static void args(char **argv, const char *opt1, const char *opt2, const char *opt3,
+		 const char *eff)
+{
+	int n = 0;
+
+	argv[n++] = (char *) convert;
+	if (opt1)
+		argv[n++] = (char *) opt1;
+	if (opt2)
+		argv[n++] = (char *) opt2;
+	if (opt3)
+		argv[n++] = (char *) opt3;
+	argv[n++] = (char *) eff;
+	for (int i = 0; i < 4; i++)
+		argv[n++] = "0.5";
+	argv[n] = NULL;
+}
+
+static int run(const char *name, struct result *r)
+{
+	char path[1024], side[1024], chain[1024], length[32];
+	char *argv[MAX_ARGS];
+	pid_t pid[MAX_CHANNELS];
+	int nr = 1;
+
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->audio = seconds;
+	corpus_path(path, sizeof(path), "ch", 0, "raw");
+	corpus_path(side, sizeof(side), "ch", 1, "raw");
+	snprintf(chain, sizeof(chain), "%s/chain.txt", dir);
+	snprintf(length, sizeof(length), "%g", seconds);
+
+	double start = now();
+	if (!strcmp(name, "pipe")) {
+		int fd[4];
+
+		// convert only gets its own ends, through the dup2()
+		if (pipe2(fd, O_CLOEXEC) || pipe2(fd + 2, O_CLOEXEC))
+			return -1;
+		pid_t feed = feeder(path, fd);
+		pid_t drain = drainer(fd);
+		args(argv, NULL, NULL, NULL, effect);
+		pid[0] = spawn(argv, NULL, fd[0], fd[3]);
+		for (int i = 0; i < 4; i++)
+			close(fd[i]);
+		if (collect(pid, 1, r))
+			return -1;
+		waitpid(feed, NULL, 0);
+		waitpid(drain, NULL, 0);
+	} else if (!strcmp(name, "file")) {
+		args(argv, NULL, NULL, NULL, effect);
+		pid[0] = spawn(argv, path, -1, -1);
+	} else if (!strcmp(name, "generator")) {
+		args(argv, "-gpink", "-t", length, effect);
+		pid[0] = spawn(argv, NULL, -1, -1);
+	} else if (!strcmp(name, "flac-in")) {
+		corpus_path(path, sizeof(path), "ch", 0, "flac");
+		args(argv, NULL, NULL, NULL, effect);
+		pid[0] = spawn(argv, path, -1, -1);
+	} else if (!strcmp(name, "flac-out")) {
+		args(argv, "-f", NULL, NULL, effect);
+		pid[0] = spawn(argv, path, -1, -1);
+	} else if (!strcmp(name, "sidechain")) {
+		args(argv, "-x", side, NULL, "vocoder");
+		pid[0] = spawn(argv, path, -1, -1);
+	} else if (!strcmp(name, "chain")) {
+		args(argv, "-w", chain, NULL, effect);
+		pid[0] = spawn(argv, path, -1, -1);
+	} else if (!strcmp(name, "multichannel")) {
+		char ch[MAX_CHANNELS][1024];
+
+		args(argv, NULL, NULL, NULL, effect);
+		for (int i = 0; i < channels; i++) {
+			corpus_path(ch[i], sizeof(ch[i]), "ch", i, "raw");
+			pid[i] = spawn(argv, ch[i], -1, -1);
+		}
+		nr = channels;
+		r->audio = seconds * channels;
+	} else if (!strcmp(name, "batch")) {
+		args(argv, NULL, NULL, NULL, effect);
+		for (int i = 0; i < BATCH; i++) {
+			struct result one = { };
+
+			corpus_path(path, sizeof(path), "batch", i, "raw");
+			pid[0] = spawn(argv, path, -1, -1);
+			if (collect(pid, 1, &one))
+				return -1;
+			r->cpu += one.cpu;
+			r->rss = one.rss > r->rss ? one.rss : r->rss;
+		}
+		r->audio = (uint) (seconds * SAMPLES_PER_SEC / BATCH) * BATCH / SAMPLES_PER_SEC;
+		nr = 0;
+	}
+	if (strcmp(name, "pipe") && collect(pid, nr, r))
+		return -1;
+	r->wall = now() - start;
+	return 0;
+}
+
+static const char *scenarios[] = {
+	"pipe", "file", "generator", "flac-in", "flac-out",
+	"sidechain", "chain", "multichannel", "batch",
+};
+
+// "name audio wall cpu rss" lines, '#' for comments
+static int load(const char *name, struct result *r)
+{
+	char line[256];
+	int nr = 0;
+	FILE *f = fopen(name, "r");
+
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+	while (nr < MAX_RESULTS && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%31s %lf %lf %lf %ld", r[nr].name, &r[nr].audio,
+			   &r[nr].wall, &r[nr].cpu, &r[nr].rss) == 5)
+			nr++;
+	}
+	fclose(f);
+	return nr;
+}
+
+static int save(const char *name, const struct result *r, int nr)
+{
+	FILE *f = fopen(name, "w");
+
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+	fprintf(f, "# bench %s %s, %g s x %d channels\n", convert, effect, seconds, channels);
+	fprintf(f, "# name audio wall cpu rss\n");
+	for (int i = 0; i < nr; i++)
+		fprintf(f, "%s %.3f %.4f %.4f %ld\n", r[i].name, r[i].audio,
+			r[i].wall, r[i].cpu, r[i].rss);
+	return fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	const char *baseline_name = NULL, *save_name = NULL;
+	struct result result[MAX_RESULTS], baseline[MAX_RESULTS];
+	int opt, runs = 1, nr = 0, nr_baseline = 0, slower = 0;
+	float tolerance = 10;
+
+	while ((opt = getopt(argc, argv, "c:d:t:k:r:e:b:s:T:")) != -1) {
+		switch (opt) {
+		case 'c':	// the convert to run
+			convert = optarg;
+			break;
+		case 'd':	// corpus directory
+			dir = optarg;
+			break;
+		case 't':	// seconds per corpus file
+			seconds = atof(optarg);
+			break;
+		case 'k':	// channels
+			channels = atoi(optarg);
+			break;
+		case 'r':	// runs per scenario, the fastest counts
+			runs = atoi(optarg);
+			break;
+		case 'e':	// effect for everything but the sidechain
+			effect = optarg;
+			break;
+		case 'b':	// baseline to compare against
+			baseline_name = optarg;
+			break;
+		case 's':	// save the results
+			save_name = optarg;
+			break;
+		case 'T':	// allowed slowdown in percent
+			tolerance = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (seconds < SECTION || channels < 2 || channels > MAX_CHANNELS || runs < 1) {
+		fprintf(stderr, "bench: at least %d seconds and 2 .. %d channels\n",
+			SECTION, MAX_CHANNELS);
+		return 1;
+	}
+	if (access(convert, X_OK)) {
+		perror(convert);
+		return 1;
+	}
+	if (!argc) {
+		argc = ARRAY_SIZE(scenarios);
+		argv = (char **) scenarios;
+	}
+	for (int i = 0; i < argc; i++) {
+		int found = 0;
+
+		for (int j = 0; j < ARRAY_SIZE(scenarios); j++)
+			found |= !strcmp(argv[i], scenarios[j]);
+		if (!found) {
+			fprintf(stderr, "bench: no scenario '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+	if (baseline_name && (nr_baseline = load(baseline_name, baseline)) < 0)
+		return 1;
+	if (make_all())
+		return 1;
+
+
+	fprintf(stderr, "%-14s %9s %9s %9s %9s %8s", "scenario", "audio s", "wall s",
+		"cpu s", "rss MB", "x rt");
+	fprintf(stderr, baseline_name ? " %9s\n" : "\n", "vs base");
+	for (int i = 0; i < argc && nr < MAX_RESULTS; i++) {
+		struct result *r = result + nr;
+
+		for (int run_nr = 0; run_nr < runs; run_nr++) {
+			struct result one;
+
+			if (run(argv[i], &one)) {
+				fprintf(stderr, "bench: %s failed\n", argv[i]);
+				return 1;
+			}
+			if (!run_nr || one.wall < r->wall)
+				*r = one;
+		}
+		nr++;
+
+		double rt = r->audio / r->wall;
+		fprintf(stderr, "%-14s %9.1f %9.3f %9.3f %9.1f %8.1f", r->name, r->audio,
+			r->wall, r->cpu, r->rss / 1024.0, rt);
+
+		const struct result *b = NULL;
+		for (int j = 0; j < nr_baseline; j++) {
+			if (!strcmp(baseline[j].name, r->name))
+				b = baseline + j;
+		}
+		if (b) {
+			double base = b->audio / b->wall;
+			double change = 100 * (rt / base - 1);
+
+			fprintf(stderr, " %+8.1f%%%s", change,
+				change < -tolerance ? " SLOWER" : "");
+			slower += change < -tolerance;
+		} else if (baseline_name) {
+			fprintf(stderr, " %9s", "-");
+		}
+		fprintf(stderr, "\n");
+	}
+
+	if (save_name && save(save_name, result, nr))
+		return 1;
+	if (slower)
+		fprintf(stderr, "bench: %d scenarios more than %g%% slower than %s\n",
+			slower, tolerance, baseline_name);
+	return slower ? 1 : 0;
+}
@@ -124,3 +124,209 @@ static inline float biquad_step(struct biquad *bq, float x0)
 #define biquad_bpf_peak(bq,f,Q) _biquad_bpf_peak(&(bq)->coeff,f,Q)
 #define biquad_bpf(bq,f,Q) _biquad_bpf(&(bq)->coeff,f,Q)
 #define biquad_allpass_filter(bq,f,Q) _biquad_allpass_filter(&(bq)->coeff,f,Q)
+
+//
+// A bank of independent biquads stepped together, VEC_WIDTH at
+// a time (needs vec.h). The coefficients and state are stored
+// per field rather than per filter, so one vector operation does
+// the same step of four filters, and the cost only depends on
+// how many groups of four there are.
+//
+#define BIQUAD_BANK_MAX 64
+#define BIQUAD_BANK_VECS (BIQUAD_BANK_MAX/VEC_WIDTH)
+
+struct biquad_bank {
+	int vecs;
+	vec4 b0[BIQUAD_BANK_VECS], b1[BIQUAD_BANK_VECS], b2[BIQUAD_BANK_VECS];
+	vec4 a1[BIQUAD_BANK_VECS], a2[BIQUAD_BANK_VECS];
+	vec4 w1[BIQUAD_BANK_VECS], w2[BIQUAD_BANK_VECS];
+};
+
+// Unused filters in the last group are left all-zero, which
+// just outputs silence
+static inline void biquad_bank_init(struct biquad_bank *bank, int nr)
+{
+	memset(bank, 0, sizeof(*bank));
+	bank->vecs = (nr + VEC_WIDTH-1) / VEC_WIDTH;
+}
+
+static inline void biquad_bank_set(struct biquad_bank *bank, int i, const struct biquad_coeff *c)
+{
+	int v = i / VEC_WIDTH, lane = i % VEC_WIDTH;
+
+	bank->b0[v][lane] = c->b0;
+	bank->b1[v][lane] = c->b1;
+	bank->b2[v][lane] = c->b2;
+	bank->a1[v][lane] = c->a1;
+	bank->a2[v][lane] = c->a2;
+}
+
+// In place: filter 'i' takes x[i/4][i%4] and leaves its output there
+static inline void biquad_bank_step(struct biquad_bank *bank, vec4 *x)
+{
+	for (int v = 0; v < bank->vecs; v++) {
+		vec4 w1 = bank->w1[v], w2 = bank->w2[v];
+		vec4 w0 = x[v] - bank->a1[v] * w1 - bank->a2[v] * w2;
+
+		x[v] = bank->b0[v] * w0 + bank->b1[v] * w1 + bank->b2[v] * w2;
+		bank->w2[v] = w1;
+		bank->w1[v] = w0;
+	}
+}
+
+//
+// Batch coefficient design (needs vec.h): arrays of (type, f, Q,
+// gain) designed four at a time, for parameter sweeps and banks,
+// where one _biquad_xyz() call per filter is what takes the time.
+//
+// The formulas are the same as above, plus the peaking EQ and the
+// shelves (gain in dB, ignored by the others), which need A =
+// 10^(gain/40). All the types are computed for every lane and the
+// right one picked per lane, so a batch can mix types freely.
+//
+// BIQUAD_FAST uses vec4_sincos() and vec4_exp2(), which are closer
+// than fastsincos(); BIQUAD_EXACT does the trig and the powers in
+// double with libm, lane by lane, for reference or when the
+// coefficients end up somewhere that cares.
+//
+enum biquad_type {
+	BIQUAD_LPF, BIQUAD_HPF, BIQUAD_BPF, BIQUAD_BPF_PEAK,
+	BIQUAD_NOTCH, BIQUAD_ALLPASS,
+	BIQUAD_PEAK, BIQUAD_LOW_SHELF, BIQUAD_HIGH_SHELF,
+};
+
+#define BIQUAD_FAST 0
+#define BIQUAD_EXACT 1
+
+struct biquad_spec {
+	int type;
+	float f, Q, gain;
+};
+
+struct biquad_coeff4 {
+	vec4 b0, b1, b2;
+	vec4 a1, a2;
+};
+
+// Up to VEC_WIDTH filters; missing lanes get a harmless lowpass.
+// A whole group is loaded as four rows and transposed, and only
+// the types that are actually there get computed.
+static inline struct biquad_coeff4 biquad_design4(const struct biquad_spec *spec, int nr, int mode)
+{
+	vec4 v[4] = {
+		{ 0, 0, 0, 0 }, { 1000, 1000, 1000, 1000 },
+		{ 0.707, 0.707, 0.707, 0.707 }, { 0, 0, 0, 0 },
+	};
+	vec4 s, c, A, sqrtA;
+	uint types = 0;
+
+	if (nr >= VEC_WIDTH) {
+		for (int l = 0; l < VEC_WIDTH; l++)
+			memcpy(v + l, spec + l, sizeof(vec4));
+		vec4_transpose(v);
+	} else {
+		for (int l = 0; l < nr; l++) {
+			memcpy(&v[0][l], &spec[l].type, sizeof(int));
+			v[1][l] = spec[l].f;
+			v[2][l] = spec[l].Q;
+			v[3][l] = spec[l].gain;
+		}
+	}
+
+	ivec4 type = (ivec4) v[0];
+	vec4 f = v[1], Q = v[2], gain = v[3];
+	for (int l = 0; l < VEC_WIDTH; l++)
+		types |= 1 << type[l];
+	int shelf = types >> BIQUAD_PEAK;
+
+	if (mode == BIQUAD_EXACT) {
+		for (int l = 0; l < VEC_WIDTH; l++) {
+			double w = 2 * M_PI * f[l] / SAMPLES_PER_SEC;
+
+			s[l] = sin(w);
+			c[l] = cos(w);
+			sqrtA[l] = shelf ? pow(10, gain[l] / 80.0) : 1;
+		}
+	} else {
+		vec4_sincos(f * (float) (1 / SAMPLES_PER_SEC), &s, &c);
+		sqrtA = shelf ? vec4_exp2(gain * (3.32192809f / 80)) : vec4_set1(1);
+	}
+	A = sqrtA * sqrtA;
+
+	vec4 alpha = s / (2 * Q), cos2 = -2 * c;
+	vec4 b0, b1, b2, a0 = 1 + alpha, a1 = cos2, a2 = 1 - alpha;
+
+	// LPF and HPF, then each of the others that's there on top
+	vec4 lp = (1 - c) * 0.5f, hp = (1 + c) * 0.5f;
+	ivec4 is_hp = type == BIQUAD_HPF;
+	b0 = vec4_select(is_hp, hp, lp);
+	b1 = vec4_select(is_hp, -2 * hp, 2 * lp);
+	b2 = b0;
+
+#define BIQUAD_PICK(t, B0, B1, B2, A0, A1, A2) if (types & (1 << (t))) {	\
+	ivec4 m = type == (t);						\
+	b0 = vec4_select(m, B0, b0); b1 = vec4_select(m, B1, b1);		\
+	b2 = vec4_select(m, B2, b2); a0 = vec4_select(m, A0, a0);		\
+	a1 = vec4_select(m, A1, a1); a2 = vec4_select(m, A2, a2);		\
+}
+	vec4 zero = vec4_set1(0), one = vec4_set1(1);
+	BIQUAD_PICK(BIQUAD_BPF, alpha, zero, -alpha, a0, a1, a2);
+	BIQUAD_PICK(BIQUAD_BPF_PEAK, s * 0.5f, zero, s * -0.5f, a0, a1, a2);
+	BIQUAD_PICK(BIQUAD_NOTCH, one, cos2, one, a0, a1, a2);
+	BIQUAD_PICK(BIQUAD_ALLPASS, 1 - alpha, cos2, 1 + alpha, a0, a1, a2);
+	BIQUAD_PICK(BIQUAD_PEAK, 1 + alpha * A, cos2, 1 - alpha * A,
+		    1 + alpha / A, cos2, 1 - alpha / A);
+
+	// The shelves: "low" and "high" differ in the signs of the
+	// cosine terms, and in which side gets A
+	if (shelf > 1) {
+		vec4 Ap = A + 1, Am = A - 1, ab = 2 * sqrtA * alpha;
+		vec4 lc = Am * c, hc = Ap * c;
+
+		BIQUAD_PICK(BIQUAD_LOW_SHELF,
+			    A * (Ap - lc + ab), 2 * A * (Am - hc), A * (Ap - lc - ab),
+			    Ap + lc + ab, -2 * (Am + hc), Ap + lc - ab);
+		BIQUAD_PICK(BIQUAD_HIGH_SHELF,
+			    A * (Ap + lc + ab), -2 * A * (Am + hc), A * (Ap + lc - ab),
+			    Ap - lc + ab, 2 * (Am - hc), Ap - lc - ab);
+	}
+#undef BIQUAD_PICK
+
+	vec4 a0_inv = 1 / a0;
+	return (struct biquad_coeff4) {
+		b0 * a0_inv, b1 * a0_inv, b2 * a0_inv,
+		a1 * a0_inv, a2 * a0_inv,
+	};
+}
+
+static inline void biquad_design(struct biquad_coeff *res, const struct biquad_spec *spec, int nr, int mode)
+{
+	for (int i = 0; i < nr; i += VEC_WIDTH) {
+		struct biquad_coeff4 c = biquad_design4(spec + i, nr - i, mode);
+
+		for (int l = 0; l < VEC_WIDTH && i + l < nr; l++)
+			res[i + l] = (struct biquad_coeff) {
+				c.b0[l], c.b1[l], c.b2[l], c.a1[l], c.a2[l]
+			};
+	}
+}
+
+// Filters 'first' .. 'first+nr-1' of a bank, straight into its
+// vectors. 'first' has to start a group of four; the rest of the
+// last group is cleared, like biquad_bank_init() leaves it.
+static inline void biquad_bank_design(struct biquad_bank *bank, int first,
+				      const struct biquad_spec *spec, int nr, int mode)
+{
+	for (int i = 0; i < nr; i += VEC_WIDTH) {
+		struct biquad_coeff4 c = biquad_design4(spec + i, nr - i, mode);
+		ivec4 used = (ivec4) { 0, 1, 2, 3 } < nr - i;
+		vec4 zero = vec4_set1(0);
+		int v = (first + i) / VEC_WIDTH;
+
+		bank->b0[v] = vec4_select(used, c.b0, zero);
+		bank->b1[v] = vec4_select(used, c.b1, zero);
+		bank->b2[v] = vec4_select(used, c.b2, zero);
+		bank->a1[v] = vec4_select(used, c.a1, zero);
+		bank->a2[v] = vec4_select(used, c.a2, zero);
+	}
+}
@@ -0,0 +1,233 @@
+//
+// Content-addressed render cache for 'convert -c dir'
+//
+// A render is keyed by a hash of everything that decides its
+// output: the build, the effect, the exact pot values and the input
+// samples (or the generator and length), plus the sidechain. The
+// output is stored as 'dir/<key>.raw', so a hit is just a file copy
+// with no DSP at all.
+//
+// The hash is 64-bit FNV-1a, done a 32-bit sample at a time in four
+// interleaved lanes so the multiplies overlap, and folded together
+// at the end. It isn't cryptographic, but nobody is attacking their
+// own preset previews.
+//
+// Every hit touches the file, so the modification times give the
+// LRU order, and after every store the oldest files go until the
+// directory is under its size limit. Hit and miss counts live in
+// 'dir/stats', updated under flock() since several renders can
+// share a cache.
+//
+// Needs <stdint.h>, <dirent.h>, <fcntl.h>, <sys/stat.h>,
+// <sys/file.h> and <utime.h>.
+//
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+#define CACHE_ENTRIES 1024
+
+struct cache_hash {
+	uint64_t lane[4];
+};
+
+struct cache {
+	const char *dir;
+	long max_bytes;
+	char path[1024], tmp[1024+32];
+	FILE *store;
+};
+
+static void cache_hash_init(struct cache_hash *h)
+{
+	for (int i = 0; i < 4; i++)
+		h->lane[i] = FNV_OFFSET + i;
+}
+
+// Small things (names, settings) all go into the first lane
+static void cache_hash_bytes(struct cache_hash *h, const void *p, size_t n)
+{
+	const unsigned char *b = p;
+
+	for (size_t i = 0; i < n; i++)
+		h->lane[0] = (h->lane[0] ^ b[i]) * FNV_PRIME;
+}
+
+static void cache_hash_words(struct cache_hash *h, const u32 *w, size_t n)
+{
+	uint64_t l0 = h->lane[0], l1 = h->lane[1], l2 = h->lane[2], l3 = h->lane[3];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		l0 = (l0 ^ w[i+0]) * FNV_PRIME;
+		l1 = (l1 ^ w[i+1]) * FNV_PRIME;
+		l2 = (l2 ^ w[i+2]) * FNV_PRIME;
+		l3 = (l3 ^ w[i+3]) * FNV_PRIME;
+	}
+	for (; i < n; i++)
+		l0 = (l0 ^ w[i]) * FNV_PRIME;
+	h->lane[0] = l0; h->lane[1] = l1; h->lane[2] = l2; h->lane[3] = l3;
+	cache_hash_bytes(h, &n, sizeof(n));
+}
+
+static uint64_t cache_hash_final(struct cache_hash *h)
+{
+	uint64_t key = FNV_OFFSET;
+
+	for (int i = 0; i < 4; i++)
+		key = (key ^ h->lane[i]) * FNV_PRIME;
+	return key ^ (key >> 29);
+}
+
+// Returns the cached render if there is one, and makes it the most
+// recently used
+static FILE *cache_lookup(struct cache *c, uint64_t key)
+{
+	snprintf(c->path, sizeof(c->path), "%s/%016llx.raw", c->dir, (unsigned long long) key);
+	FILE *file = fopen(c->path, "r");
+	if (file)
+		utime(c->path, NULL);
+	return file;
+}
+
+// The render goes to a temporary name and is only renamed into
+// place when it's complete, so a reader never sees half of one
+static FILE *cache_begin(struct cache *c)
+{
+	snprintf(c->tmp, sizeof(c->tmp), "%s.%d.tmp", c->path, (int) getpid());
+	c->store = fopen(c->tmp, "w");
+	if (!c->store)
+		perror(c->tmp);
+	return c->store;
+}
+
+struct cache_entry {
+	double mtime;
+	long size;
+	char name[32];
+};
+
+static int by_mtime(const void *a, const void *b)
+{
+	double x = ((const struct cache_entry *)a)->mtime;
+	double y = ((const struct cache_entry *)b)->mtime;
+	return (x > y) - (x < y);
+}
+
+// Drop the least recently used renders until the total fits
+static int cache_evict(struct cache *c)
+{
+	int size = CACHE_ENTRIES, n = 0, evicted = 0;
+	struct cache_entry *entry = malloc(size * sizeof(*entry));
+	DIR *dir = opendir(c->dir);
+	struct dirent *d;
+	long total = 0;
+
+	if (!dir || !entry) {
+		if (dir)
+			closedir(dir);
+		free(entry);
+		return 0;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		char path[1024];
+		struct stat st;
+		size_t len = strlen(d->d_name);
+
+		if (len < 5 || len >= sizeof(entry[n].name) || strcmp(d->d_name + len - 4, ".raw"))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", c->dir, d->d_name);
+		if (stat(path, &st))
+			continue;
+
+		// Every file has to be counted, or the total is short
+		if (n == size) {
+			struct cache_entry *more = realloc(entry, 2 * size * sizeof(*entry));
+			if (!more) {
+				closedir(dir);
+				free(entry);
+				return 0;
+			}
+			entry = more;
+			size *= 2;
+		}
+		// Whole seconds would make a burst of renders a tie
+		entry[n].mtime = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+		entry[n].size = st.st_size;
+		strcpy(entry[n].name, d->d_name);
+		total += st.st_size;
+		n++;
+	}
+	closedir(dir);
+
+	qsort(entry, n, sizeof(entry[0]), by_mtime);
+	for (int i = 0; i < n && total > c->max_bytes; i++) {
+		char path[1024];
+
+		snprintf(path, sizeof(path), "%s/%s", c->dir, entry[i].name);
+		if (!unlink(path)) {
+			total -= entry[i].size;
+			evicted++;
+		}
+	}
+	free(entry);
+	return evicted;
+}
+
+static int cache_commit(struct cache *c)
+{
+	int err = fclose(c->store);
+
+	c->store = NULL;
+	if (err || rename(c->tmp, c->path)) {
+		unlink(c->tmp);
+		return 0;
+	}
+	return cache_evict(c);
+}
+
+static void cache_abort(struct cache *c)
+{
+	if (c->store) {
+		fclose(c->store);
+		c->store = NULL;
+		unlink(c->tmp);
+	}
+}
+
+// Counts this run in 'dir/stats' and reports the totals
+static void cache_stats(struct cache *c, int hit, long bytes, int evicted)
+{
+	char path[1024];
+	long hits = 0, misses = 0, hit_bytes = 0, evictions = 0;
+
+	snprintf(path, sizeof(path), "%s/stats", c->dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+	flock(fd, LOCK_EX);
+
+	FILE *file = fdopen(fd, "r+");
+	if (!file) {
+		close(fd);
+		return;
+	}
+	if (fscanf(file, "hits %ld misses %ld hit_bytes %ld evictions %ld",
+		   &hits, &misses, &hit_bytes, &evictions) != 4)
+		hits = misses = hit_bytes = evictions = 0;
+
+	if (hit) {
+		hits++;
+		hit_bytes += bytes;
+	} else {
+		misses++;
+	}
+	evictions += evicted;
+
+	rewind(file);
+	if (ftruncate(fd, 0) == 0)
+		fprintf(file, "hits %ld\nmisses %ld\nhit_bytes %ld\nevictions %ld\n",
+			hits, misses, hit_bytes, evictions);
+	fclose(file);
+
+	fprintf(stderr, "cache: %s, %ld hits, %ld misses (%.0f%% hit rate), %d evicted\n",
+		hit ? "hit" : "miss", hits, misses, 100.0 * hits / (hits + misses), evicted);
+}
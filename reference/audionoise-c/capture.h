@@ -0,0 +1,231 @@
+//
+// Session capture and replay for 'convert -C file' and 'convert -P file'
+//
+// A capture is everything the DSP saw, in the order it saw it: the
+// effect and its starting pots, every input block exactly as it was
+// handed over (so the block boundaries too), the sidechain, and every
+// pot change with the sample it happened at. At the end goes a hash
+// of the output. Replaying it runs exactly the same processing again,
+// and the output has to hash the same; if it doesn't, the build or
+// the effect isn't deterministic, and that's worth knowing too.
+//
+// The file starts with a few text lines, then binary records:
+//
+//	'P' sample:32 pots:4x32		pot change (float bits)
+//	'B' n:16 mode:8 subframes	input block, then sidechain
+//	'E' samples:32 hash:64		end of the session
+//
+// The samples are floats, since that's what the DSP takes. When a
+// whole block is 32-bit integer samples scaled to [-1, 1), which is
+// what any converter or raw file gives, it's stored as those and
+// coded as a FLAC subframe with flac.h's coder: that's compact, and
+// the decode is exact. Anything else (generated signals, mostly) is
+// stored as the float bits, still through the subframe coder, which
+// falls back to verbatim when it can't do better.
+//
+// Include after flac.h and cache.h.
+//
+#define CAPTURE_MAGIC "audionoise capture 1\n"
+#define CAPTURE_BUILD __DATE__ " " __TIME__
+
+struct capture {
+	FILE *file;
+	struct flac_reader r;
+	int sidechain;
+	uint samples;
+	uint64_t hash;
+	uint8_t *buf;
+	int32_t x[FLAC_BLOCK];
+	int64_t y[FLAC_BLOCK];
+};
+
+static struct capture *capture_alloc(FILE *file)
+{
+	struct capture *c = calloc(1, sizeof(*c));
+
+	if (!c)
+		return NULL;
+	// Two verbatim subframes at the worst, plus the header
+	c->buf = malloc(2 * FLAC_BLOCK * 4 + 64);
+	if (!c->buf) {
+		free(c);
+		return NULL;
+	}
+	c->file = file;
+	c->r.in = file;
+	return c;
+}
+
+static struct capture *capture_create(const char *name, const struct effect *eff,
+				      const float *pot, int sidechain)
+{
+	FILE *file = fopen(name, "w");
+
+	if (!file) {
+		perror(name);
+		return NULL;
+	}
+	struct capture *c = capture_alloc(file);
+	if (!c) {
+		fclose(file);
+		return NULL;
+	}
+	c->sidechain = sidechain;
+	fprintf(file, CAPTURE_MAGIC "build %s\neffect %s %a %a %a %a\nsidechain %d\n",
+		CAPTURE_BUILD, eff->name, pot[0], pot[1], pot[2], pot[3], sidechain);
+	return c;
+}
+
+// Integers if every sample is one, otherwise the float bits
+static int capture_samples(struct capture *c, struct flac_bits *b, const float *in, int n)
+{
+	int mode = 0;
+
+	for (int i = 0; i < n && !mode; i++) {
+		float v = in[i] * 2147483648.0f;
+		mode = !(v >= -2147483648.0f && v < 2147483648.0f && v == (float)(int32_t) v);
+	}
+	for (int i = 0; i < n; i++) {
+		if (mode)
+			memcpy(c->x + i, in + i, 4);
+		else
+			c->x[i] = (int32_t) (in[i] * 2147483648.0f);
+	}
+	flac_subframe(b, c->x, n, 32);
+	return mode;
+}
+
+static void capture_block(struct capture *c, const float *in, const float *side, int n)
+{
+	struct flac_bits b = { c->buf };
+
+	flac_put(&b, 'B', 8);
+	flac_put(&b, n, 16);
+	size_t mode = b.pos;
+	flac_put(&b, 0, 8);
+
+	int m = capture_samples(c, &b, in, n);
+	flac_align(&b);
+	if (c->sidechain) {
+		m |= capture_samples(c, &b, side, n) << 1;
+		flac_align(&b);
+	}
+	c->buf[mode] = m;
+	fwrite(c->buf, 1, b.pos, c->file);
+	c->samples += n;
+}
+
+static void capture_pots(struct capture *c, uint sample, const float *pot)
+{
+	struct flac_bits b = { c->buf };
+	uint32_t bits[4];
+
+	memcpy(bits, pot, sizeof(bits));
+	flac_put(&b, 'P', 8);
+	flac_put(&b, sample, 32);
+	for (int i = 0; i < 4; i++)
+		flac_put(&b, bits[i], 32);
+	fwrite(c->buf, 1, b.pos, c->file);
+}
+
+static int capture_finish(struct capture *c, uint64_t hash)
+{
+	struct flac_bits b = { c->buf };
+
+	flac_put(&b, 'E', 8);
+	flac_put(&b, c->samples, 32);
+	flac_put(&b, hash >> 32, 32);
+	flac_put(&b, hash, 32);
+	fwrite(c->buf, 1, b.pos, c->file);
+	return fclose(c->file);
+}
+
+// Reads the header: the effect and pots to start with
+static struct capture *replay_open(const char *name, struct effect **eff, float *pot)
+{
+	char line[256], build[64], effect[64];
+	FILE *file = fopen(name, "r");
+
+	if (!file) {
+		perror(name);
+		return NULL;
+	}
+	struct capture *c = capture_alloc(file);
+	if (!c ||
+	    !fgets(line, sizeof(line), file) || strcmp(line, CAPTURE_MAGIC) ||
+	    !fgets(line, sizeof(line), file) || sscanf(line, "build %63[^\n]", build) != 1 ||
+	    fscanf(file, "effect %63s %a %a %a %a sidechain %d",
+		   effect, pot, pot+1, pot+2, pot+3, &c->sidechain) != 6 ||
+	    getc(file) != '\n' || !(*eff = find_effect(effect))) {
+		fprintf(stderr, "%s: not a capture\n", name);
+		fclose(file);
+		free(c);
+		return NULL;
+	}
+	if (strcmp(build, CAPTURE_BUILD))
+		fprintf(stderr, "%s: captured with the %s build, replaying with %s\n",
+			name, build, CAPTURE_BUILD);
+	return c;
+}
+
+static void replay_samples(struct capture *c, float *out, int n, int mode)
+{
+	struct flac_reader *r = &c->r;
+
+	if (flac_decode_subframe(r, c->y, n, 32))
+		r->eof = 1;
+	if (r->bits & 7)
+		flac_get(r, r->bits & 7);
+	for (int i = 0; i < n; i++) {
+		int32_t v = c->y[i];
+
+		if (mode)
+			memcpy(out + i, &v, 4);
+		else
+			out[i] = v / (float)0x80000000;
+	}
+}
+
+// The next block, with the pot changes before it added to the
+// automation. Returns its length, 0 at the end, -1 if the capture
+// is damaged.
+static int replay_block(struct capture *c, float *in, float *side, struct automation *a)
+{
+	struct flac_reader *r = &c->r;
+
+	for (;;) {
+		int type = flac_get(r, 8);
+
+		if (r->eof)
+			return -1;
+		if (type == 'P') {
+			uint sample = flac_get(r, 32);
+			uint32_t bits[4];
+
+			for (int i = 0; i < 4; i++)
+				bits[i] = flac_get(r, 32);
+			if (a->nr == MAX_AUTOMATION)
+				return -1;
+			a->p[a->nr].sample = sample;
+			memcpy(a->p[a->nr++].pot, bits, sizeof(bits));
+			continue;
+		}
+		if (type == 'E') {
+			c->samples = flac_get(r, 32);
+			c->hash = (uint64_t) flac_get(r, 32) << 32;
+			c->hash |= flac_get(r, 32);
+			return r->eof ? -1 : 0;
+		}
+		if (type != 'B')
+			return -1;
+
+		int n = flac_get(r, 16);
+		int mode = flac_get(r, 8);
+		if (!n || n > FLAC_BLOCK)
+			return -1;
+		replay_samples(c, in, n, mode & 1);
+		if (c->sidechain)
+			replay_samples(c, side, n, mode & 2);
+		return r->eof ? -1 : n;
+	}
+}
@@ -1,8 +1,28 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/select.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 typedef int s32;
 typedef unsigned int u32;
@@ -14,75 +34,596 @@ typedef unsigned int uint;
 #include "util.h"
 #include "lfo.h"
 #include "effect.h"
+#include "vec.h"
 #include "biquad.h"
+#include "fft.h"
 
 // Effects
-#include "flanger.h"
-#include "echo.h"
-#include "fm.h"
-#include "phaser.h"
-#include "discont.h"
-
-struct {
-	float attack, decay, value;
-} magnitude;
-static inline void magnitude_init(float pot1, float pot2, float pot3, float pot4)
+#include "effects.h"
+
+// Test signals
+#include "gen.h"
+
+// Render cache
+#include "cache.h"
+
+// Automation and incremental re-rendering
+#include "snapshot.h"
+
+// Compressed input and output
+#include "flac.h"
+
+// Chain hot-swap
+#include "hotswap.h"
+
+// Realtime-safety checking
+#include "rtcheck.h"
+
+// Session capture and replay
+#include "capture.h"
+
+// Analysis effects queue events, we write them to the sidecar
+static void flush_events(FILE *sidecar)
+{
+	while (effect_event_tail != effect_event_head) {
+		struct effect_event *ev = effect_events + effect_event_tail++ % EFFECT_EVENTS;
+
+		if (sidecar)
+			fprintf(sidecar, "%u\t%.6f\t%g\n",
+				ev->sample, ev->sample / SAMPLES_PER_SEC, ev->value);
+	}
+}
+
+static double now(void)
 {
-	magnitude.attack = pot1;
-	magnitude.decay = pot2;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
-static inline float magnitude_step(float in)
+
+// The whole of a stream, for hashing it before rendering
+static char *read_all(FILE *file, size_t *len)
 {
-	float mult, val = magnitude.value;
+	size_t size = 1 << 20, n = 0;
+	char *buf = malloc(size);
 
-	in = fabs(in);
-	mult = (in > val) ? magnitude.attack : magnitude.decay;
-	val += mult * (in - val);
-	return magnitude.value = val;
+	while (buf) {
+		n += fread(buf + n, 1, size - n, file);
+		if (n < size)
+			break;
+		size *= 2;
+		buf = realloc(buf, size);
+	}
+	*len = n & ~3;
+	return buf;
 }
 
-#define EFF(x) { #x, x##_init, x##_step }
-struct effect {
-	const char *name;
-	void (*init)(float,float,float,float);
-	float (*step)(float);
-} effects[] = {
-	EFF(discont), EFF(phaser), EFF(flanger), EFF(echo), EFF(fm),
-	EFF(magnitude),
-};
+// Everything that decides the output. The build stamp is there so
+// that a rebuilt convert with different DSP never serves old renders.
+static uint64_t render_key(const struct effect *eff, const float *pot,
+			   const struct generator *generator, float seconds,
+			   const char *input, size_t input_len,
+			   const char *side, size_t side_len)
+{
+	static const char build[] = __DATE__ " " __TIME__;
+	struct cache_hash h;
 
-#define UPDATE(x) x += 0.001 * (target_##x - x)
+	cache_hash_init(&h);
+	cache_hash_bytes(&h, build, sizeof(build));
+	cache_hash_bytes(&h, eff->name, strlen(eff->name) + 1);
+	cache_hash_bytes(&h, pot, 4 * sizeof(float));
+	if (generator) {
+		cache_hash_bytes(&h, generator->name, strlen(generator->name) + 1);
+		cache_hash_bytes(&h, &seconds, sizeof(seconds));
+	} else {
+		cache_hash_words(&h, (const u32 *) input, input_len / 4);
+	}
+	if (side)
+		cache_hash_words(&h, (const u32 *) side, side_len / 4);
+	return cache_hash_final(&h);
+}
+
+// Automation changes the output, but not whether an old session
+// render can be resumed, so it's kept out of the base key
+static uint64_t automation_key(uint64_t key, const struct automation *a)
+{
+	struct cache_hash h;
+
+	cache_hash_init(&h);
+	cache_hash_bytes(&h, &key, sizeof(key));
+	cache_hash_bytes(&h, a->p, a->nr * sizeof(a->p[0]));
+	return cache_hash_final(&h);
+}
+
+// A hit just streams the stored render
+static int cache_serve(struct cache *c, FILE *file, FILE *out)
+{
+	char buf[16384];
+	long bytes = 0;
+	size_t n;
+
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		if (fwrite(buf, 1, n, out) != n)
+			return 1;
+		bytes += n;
+	}
+	fclose(file);
+	cache_stats(c, 1, bytes, 0);
+	return fclose(out) ? 1 : 0;
+}
+
+#define BLOCK 256
+
+// Everything rendered (or copied from the last session render) goes
+// to the output, the cache and the session
+static int emit(const s32 *buf, int n, FILE *out, FILE *store, FILE *session_out)
+{
+	if (out && fwrite(buf, 4, n, out) != n)
+		return -1;
+	if (store && fwrite(buf, 4, n, store) != n)
+		return -1;
+	if (session_out && fwrite(buf, 4, n, session_out) != n)
+		return -1;
+	return 0;
+}
+
+// Work out where the last session render stops being valid, and
+// copy its output up to there. Returns the sample to render from.
+static uint session_resume(struct session *s, uint64_t key, uint length,
+			   const struct automation *automation,
+			   FILE *out, FILE *store, FILE *session_out)
+{
+	struct session *last = calloc(1, sizeof(*last));
+	char path[1024];
+	uint resume = 0;
+
+	if (!last)
+		return 0;
+	last->dir = s->dir;
+	if (!session_load(last) && last->key == key &&
+	    last->period == s->period && last->samples == length) {
+		uint diff = automation_diff(&last->automation, automation);
+
+		// Nothing changed at all: every sample can be copied
+		resume = diff >= length ? length : diff / s->period * s->period;
+	}
+	free(last);
+	session_invalidate(s);
+
+	// The snapshot has to be usable before anything is copied
+	if (resume && resume < length) {
+		FILE *snap = snapshot_open(s, resume / s->period);
+		if (!snap)
+			resume = 0;
+		else
+			fclose(snap);
+	}
+	if (!resume)
+		return 0;
+
+	session_path(s, path, sizeof(path), "out.raw", -1);
+	FILE *old = fopen(path, "r");
+	if (!old)
+		return 0;
+
+	s32 buf[BLOCK];
+	uint copied = 0;
+	while (copied < resume) {
+		int n = resume - copied < BLOCK ? resume - copied : BLOCK;
+
+		if (fread(buf, 4, n, old) != n || emit(buf, n, out, store, session_out))
+			break;
+		copied += n;
+	}
+	fclose(old);
+
+	// A short old render can't be resumed from here, and whatever
+	// was copied has already gone out, so that has to be fatal
+	if (copied != resume) {
+		fprintf(stderr, "session: %s is damaged\n", path);
+		exit(1);
+	}
+	return resume;
+}
 
 int main(int argc, char **argv)
 {
 	float pot[4];
 	struct effect *eff = &effects[0];
-	s32 sample;
+	const struct generator *generator = NULL;
+	FILE *sidecar = NULL, *sidechain = NULL, *input = stdin, *store = NULL;
+	FILE *session_out = NULL, *output = stdout;
+	struct cache cache = { .max_bytes = 1024L << 20 };
+	struct automation *automation = calloc(1, sizeof(*automation));
+	struct session *session = NULL;
+	struct hotswap *hotswap = NULL;
+	struct capture *capture = NULL, *replay = NULL;
+	const char *capture_name = NULL;
+	struct cache_hash hash;
+	float seconds = 10, period = SNAPSHOT_SECONDS, in[BLOCK], sc[BLOCK];
+	s32 buf[BLOCK], side[BLOCK];
+	int opt, quiet = 0, flac = 0, check = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN);
 
-	if (argc < 6)
-		return 1;
+	while ((opt = getopt(argc, argv, "+s:x:g:t:nc:m:a:r:p:fj:w:RC:P:")) != -1) {
+		switch (opt) {
+		case 's':	// sidecar file for analysis events
+			sidecar = fopen(optarg, "w");
+			if (!sidecar) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'x':	// sidechain input, same raw format
+			sidechain = fopen(optarg, "r");
+			if (!sidechain) {
+				perror(optarg);
+				return 1;
+			}
+			effect_has_sidechain = 1;
+			break;
+		case 'g':	// generated input instead of stdin
+			generator = gen_find(optarg);
+			if (!generator) {
+				fprintf(stderr, "Unknown generator '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':	// generator length in seconds
+			seconds = atof(optarg);
+			break;
+		case 'n':	// no output, just report the speed
+			quiet = 1;
+			break;
+		case 'c':	// render cache directory
+			cache.dir = optarg;
+			break;
+		case 'm':	// render cache size limit in MB
+			cache.max_bytes = atol(optarg) << 20;
+			break;
+		case 'a':	// pot automation file
+			if (!automation || read_automation(optarg, automation))
+				return 1;
+			break;
+		case 'r':	// render session directory
+			session = calloc(1, sizeof(*session));
+			if (!session)
+				return 1;
+			session->dir = optarg;
+			break;
+		case 'p':	// session snapshot period in seconds
+			period = atof(optarg);
+			break;
+		case 'f':	// FLAC output
+			flac = 1;
+			break;
+		case 'j':	// FLAC encoder threads
+			jobs = atoi(optarg);
+			break;
+		case 'w':	// chain hot-swap file
+			hotswap = hotswap_alloc();
+			if (!hotswap || read_swaps(optarg, hotswap))
+				return 1;
+			break;
+		case 'R':	// check the effect steps are realtime-safe
+#ifdef RTCHECK
+			check = 1;
+			break;
+#else
+			fprintf(stderr, "convert: -R needs a build with -DRTCHECK\n");
+			return 1;
+#endif
+		case 'C':	// capture the session
+			capture_name = optarg;
+			break;
+		case 'P':	// replay a captured session
+			replay = replay_open(optarg, &eff, pot);
+			if (!replay)
+				return 1;
+			effect_has_sidechain = replay->sidechain;
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
 
-	const char *name = argv[1];
+	if ((argc < 5 && !replay) || !automation)
+		return 1;
 
-	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
-		if (!strcmp(name, effects[i].name))
-			eff = effects+i;
+	// A replay has its own effect, pots, input and automation
+	if (replay && (generator || sidechain || automation->nr)) {
+		fprintf(stderr, "convert: -P doesn't go with -g, -x or -a\n");
+		return 1;
 	}
+	if (!replay) {
+		struct effect *found = find_effect(argv[0]);
+		if (found)
+			eff = found;
 
-	for (int i = 0; i < 4; i++)
-		pot[i] = atof(argv[2+i]);
+		for (int i = 0; i < 4; i++)
+			pot[i] = atof(argv[1+i]);
+	}
 
 	fprintf(stderr, "Playing %s(%f,%f,%f,%f)\n",
 		eff->name, pot[0], pot[1], pot[2], pot[3]);
 
+	// FLAC input is recognized and decoded on the way in
+	if (!generator && !replay)
+		input = flac_input(stdin);
+	if (sidechain)
+		sidechain = flac_input(sidechain);
+	if (flac && !quiet)
+		output = flac_output(stdout, jobs);
+	if (!input || (effect_has_sidechain && !sidechain && !replay) || !output) {
+		fprintf(stderr, "convert: can't set up FLAC\n");
+		return 1;
+	}
+
+	// Timing runs and analysis events always render everything
+	if ((cache.dir || session) && (quiet || sidecar)) {
+		fprintf(stderr, "convert: -c and -r are not used with -n or -s\n");
+		cache.dir = NULL;
+		session = NULL;
+	}
+
+	// The swaps aren't in the cache key or the session, and pot
+	// automation only knows about the first effect
+	if (hotswap && (cache.dir || session)) {
+		fprintf(stderr, "convert: -c and -r are not used with -w\n");
+		cache.dir = NULL;
+		session = NULL;
+	}
+	if (hotswap && automation->nr) {
+		fprintf(stderr, "convert: -a and -w don't go together\n");
+		return 1;
+	}
+
+	// A swap's warm-up depends on timing, so it can't be replayed
+	if ((capture_name || replay) && (hotswap || cache.dir || session)) {
+		fprintf(stderr, "convert: -C and -P don't go with -w, -c or -r\n");
+		return 1;
+	}
+	if (capture_name) {
+		capture = capture_create(capture_name, eff, pot, effect_has_sidechain);
+		if (!capture)
+			return 1;
+	}
+	cache_hash_init(&hash);
+
+	uint length = seconds * SAMPLES_PER_SEC, resume = 0;
+	size_t input_len = 0, side_len = 0;
+	char *data = NULL, *side_data = NULL;
+	if (cache.dir || session) {
+		if (!generator) {
+			data = read_all(input, &input_len);
+			if (!data)
+				return 1;
+			length = input_len / 4;
+		}
+		if (sidechain) {
+			side_data = read_all(sidechain, &side_len);
+			if (!side_data)
+				return 1;
+		}
+
+		uint64_t key = render_key(eff, pot, generator, seconds,
+					  data, input_len, side_data, side_len);
+		if (cache.dir) {
+			FILE *hit = cache_lookup(&cache, automation->nr ? automation_key(key, automation) : key);
+			if (hit)
+				return cache_serve(&cache, hit, output);
+			store = cache_begin(&cache);
+		}
+		if (session) {
+			char path[1024];
+
+			session->key = key;
+			session->effect = eff;
+			session_keep(session, &gen, sizeof(gen));
+			session->period = (uint) (period * SAMPLES_PER_SEC / BLOCK + 0.5) * BLOCK;
+			if (!session->period)
+				session->period = BLOCK;
+			session_path(session, path, sizeof(path), "out.raw.tmp", -1);
+			session_out = fopen(path, "w");
+			if (!session_out) {
+				perror(path);
+				return 1;
+			}
+			resume = session_resume(session, key, length, automation,
+						quiet ? NULL : output, store, session_out);
+		}
+
+		// Render from the copies we just hashed, from the resume point
+		size_t skip = (size_t) resume * 4;
+		if (data && input_len > skip)
+			input = fmemopen(data + skip, input_len - skip, "r");
+		else if (data)
+			input = fmemopen("", 1, "r");
+		if (side_data) {
+			fclose(sidechain);
+			if (side_len > skip)
+				sidechain = fmemopen(side_data + skip, side_len - skip, "r");
+			else
+				sidechain = fmemopen("", 1, "r");
+		}
+		if (!input || (side_data && !sidechain))
+			return 1;
+	}
+
+	uint remaining = length, total = resume;
+	if (generator)
+		gen_init(remaining);
+
+	// Resuming restores the effect state as it was at that point,
+	// including any automation before it. The init still builds
+	// the tables, which aren't in the snapshot.
+	int next = 0;
 	eff->init(pot[0], pot[1], pot[2], pot[3]);
-	while (fread(&sample, 4, 1, stdin) == 1) {
-		float in = sample / (float)0x80000000;
-		UPDATE(effect_delay);
-		float out = eff->step(in);
-		sample = (int)(out * 0x80000000);
-		if (fwrite(&sample, 4, 1, stdout) != 1)
+	if (resume) {
+		if (resume < length && snapshot_restore(session, resume / session->period)) {
+			fprintf(stderr, "session: no snapshot for %.3f s\n", resume / SAMPLES_PER_SEC);
 			return 1;
+		}
+		remaining -= resume;
+		while (next < automation->nr && automation->p[next].sample < resume)
+			next++;
+	}
+
+	if (hotswap) {
+		if (hotswap_start(hotswap, eff, pot)) {
+			fprintf(stderr, "convert: can't set up hot-swap\n");
+			return 1;
+		}
+	}
+
+	if (check)
+		rtcheck_start(eff->name);
+
+	double start = now();
+	for (;;) {
+		int n;
+
+		// Before reading, since the generators keep their state too
+		if (session && total % session->period == 0 && total < length &&
+		    snapshot_save(session, total / session->period)) {
+			fprintf(stderr, "session: can't save snapshot\n");
+			return 1;
+		}
+
+		if (replay) {
+			n = replay_block(replay, in, sc, automation);
+			if (n < 0) {
+				fprintf(stderr, "convert: the capture is damaged\n");
+				return 1;
+			}
+		} else if (generator) {
+			n = remaining < BLOCK ? remaining : BLOCK;
+			gen_block(generator, in, n);
+			remaining -= n;
+		} else {
+			n = fread(buf, 4, BLOCK, input);
+			for (int i = 0; i < n; i++)
+				in[i] = buf[i] / (float)0x80000000;
+		}
+		if (n <= 0)
+			break;
+
+		if (sidechain) {
+			int got = fread(side, 4, n, sidechain);
+			memset(side + got, 0, (n - got) * 4);
+			for (int i = 0; i < n; i++)
+				sc[i] = side[i] / (float)0x80000000;
+		}
+
+		// The pot changes in this block go first, like a live host
+		// gets them
+		if (capture) {
+			for (int k = next; k < automation->nr && automation->p[k].sample < total + n; k++)
+				capture_pots(capture, automation->p[k].sample, automation->p[k].pot);
+			capture_block(capture, in, sc, n);
+		}
+
+		// On a swap, the old chain does this block too, to fade from
+		struct hotswap_chain *swap = NULL;
+		if (hotswap) {
+			hotswap_wait(hotswap, total);
+			swap = hotswap_take(hotswap, total);
+		}
+		if (swap) {
+			for (int i = 0; i < n; i++) {
+				if (effect_has_sidechain)
+					effect_sidechain = sc[i];
+				effect_sample = total + i;
+				UPDATE(effect_delay);
+				rtcheck_enter();
+				hotswap->old[i] = hotswap_step(hotswap, in[i]);
+				rtcheck_leave();
+				flush_events(sidecar);
+			}
+			rtcheck_enter();
+			hotswap_install(hotswap, swap);
+			rtcheck_leave();
+		}
+
+		for (int i = 0; i < n; i++) {
+			while (next < automation->nr && automation->p[next].sample == total + i) {
+				float *p = automation->p[next++].pot;
+				eff->update(p[0], p[1], p[2], p[3]);
+			}
+			if (effect_has_sidechain)
+				effect_sidechain = sc[i];
+			effect_sample = total + i;
+			UPDATE(effect_delay);
+			// Only the DSP: the events and the output are the host's
+			rtcheck_enter();
+			float out = hotswap ? hotswap_step(hotswap, in[i]) : eff->step(in[i]);
+			rtcheck_leave();
+			if (swap)
+				out = hotswap_fade(hotswap, out, i, n);
+			flush_events(sidecar);
+			buf[i] = (int)(out * 0x80000000);
+		}
+		total += n;
+		if (hotswap)
+			hotswap_history(hotswap, in, n);
+		if (capture || replay)
+			cache_hash_words(&hash, (u32 *) buf, n);
+
+		if (emit(buf, n, quiet ? NULL : output, NULL, session_out)) {
+			cache_abort(&cache);
+			return 1;
+		}
+		if (store && emit(buf, n, NULL, store, NULL)) {
+			cache_abort(&cache);
+			store = NULL;
+		}
+	}
+	flush_events(sidecar);
+	if (hotswap)
+		hotswap_finish(hotswap);
+	if (check && !rtcheck_report())
+		fprintf(stderr, "rtcheck: %s: no calls in the process callback\n", eff->name);
+	if (capture && capture_finish(capture, cache_hash_final(&hash))) {
+		fprintf(stderr, "convert: can't write %s\n", capture_name);
+		return 1;
+	}
+	if (replay) {
+		int same = total == replay->samples && cache_hash_final(&hash) == replay->hash;
+
+		fprintf(stderr, "replay: %.3f s, output %s the capture\n",
+			total / SAMPLES_PER_SEC, same ? "identical to" : "DIFFERS from");
+		if (!same)
+			return 1;
+	}
+	if (sidecar)
+		fclose(sidecar);
+	if (output != stdout && fclose(output)) {
+		fprintf(stderr, "convert: FLAC output failed\n");
+		return 1;
+	}
+	if (store)
+		cache_stats(&cache, 0, 0, cache_commit(&cache));
+
+	if (session) {
+		char tmp[1024], path[1024];
+
+		session_path(session, tmp, sizeof(tmp), "out.raw.tmp", -1);
+		session_path(session, path, sizeof(path), "out.raw", -1);
+		session->samples = total;
+		session->automation = *automation;
+		if (fclose(session_out) || rename(tmp, path) || session_save(session))
+			fprintf(stderr, "session: can't save %s\n", session->dir);
+		fprintf(stderr, "session: rendered %.2f s of %.2f s, from %.2f s\n",
+			(total - resume) / SAMPLES_PER_SEC, total / SAMPLES_PER_SEC,
+			resume / SAMPLES_PER_SEC);
+	}
+
+	if (quiet) {
+		double elapsed = now() - start;
+		fprintf(stderr, "%s: %u samples in %.3f s (%.1f ns/sample, %.0fx realtime)\n",
+			eff->name, total, elapsed, elapsed * 1e9 / total,
+			total / SAMPLES_PER_SEC / elapsed);
 	}
 	return 0;
 }
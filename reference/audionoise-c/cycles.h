@@ -0,0 +1,497 @@
+//
+// Cortex-M33 cycle estimates for code run on an x86-64 host
+//
+// The pedal's core (RP2354 at 150 MHz) is a Cortex-M33 with a
+// single-precision FPU and nothing more: no SIMD, no double precision
+// in hardware. There's no emulator for it here, so instead the code
+// runs natively under ptrace, one instruction at a time, and each x86
+// instruction is charged what the same work costs on the M33:
+//
+//  - integer ops, moves and float add/sub/mul/compare are a cycle per
+//    32-bit lane, so a 4-wide SSE op is four; an FMA is three
+//  - float divide and square root are 14 (they don't pipeline)
+//  - anything in double precision is a libgcc soft-float call
+//  - a load is 2 cycles for the first word and 1 for each after
+//    it (LDM/VLDM), a store 1 per word; branches 2, calls and
+//    returns 3
+//
+// Calls into the math library don't get stepped: glibc's versions
+// are nothing like what the pedal links, so each known function is
+// charged a fixed cost (cycles_libm[], from published Cortex-M4/M33
+// numbers for single-precision libm) and runs to its return at full
+// speed. Other library code (memset, say) is stepped like ours.
+//
+// It's an estimate, good to maybe +-30%: x86 folds loads into
+// arithmetic and has fewer registers, and compilers copy scalars
+// with packed moves, which are charged as one lane. What it does get
+// right is which effects are near the budget, and why: the class
+// counts show where the cycles go.
+//
+// x86-64 Linux only. Needs <sys/ptrace.h>, <sys/user.h>, <sys/wait.h>,
+// <stddef.h> and <dlfcn.h>; link with -ldl.
+//
+#if !defined(__x86_64__)
+#error "cycles.h decodes x86-64 instructions"
+#endif
+
+enum cycles_class {
+	CY_NOP, CY_INT, CY_MOVE, CY_MUL, CY_DIV, CY_BRANCH, CY_CALL,
+	CY_FLOAT, CY_FMA, CY_FDIV, CY_SHUFFLE, CY_DOUBLE, CY_DDIV,
+	CY_LOAD, CY_STORE, CY_LIBM, CY_CLASSES
+};
+
+static const char *const cycles_name[CY_CLASSES] = {
+	"nop", "int", "move", "mul", "div", "branch", "call",
+	"float", "fma", "fdiv", "shuffle", "double", "ddiv",
+	"load", "store", "libm",
+};
+
+// Per 32-bit lane, or per word for the loads and stores
+static const uint cycles_m33[CY_CLASSES] = {
+	[CY_NOP] = 0, [CY_INT] = 1, [CY_MOVE] = 1, [CY_MUL] = 1,
+	[CY_DIV] = 6, [CY_BRANCH] = 2, [CY_CALL] = 3,
+	[CY_FLOAT] = 1, [CY_FMA] = 3, [CY_FDIV] = 14, [CY_SHUFFLE] = 1,
+	[CY_DOUBLE] = 40, [CY_DDIV] = 120,
+	[CY_LOAD] = 2, [CY_STORE] = 1,
+};
+
+static const struct cycles_libm {
+	const char *name;
+	uint cycles;
+} cycles_libm[] = {
+	{ "sinf", 100 }, { "cosf", 100 }, { "sincosf", 130 }, { "tanf", 150 },
+	{ "expf", 60 }, { "exp2f", 50 }, { "exp10f", 70 }, { "logf", 60 },
+	{ "log2f", 60 }, { "log10f", 70 }, { "powf", 150 }, { "tanhf", 120 },
+	{ "atanf", 100 }, { "atan2f", 130 }, { "asinf", 120 }, { "acosf", 120 },
+	{ "sinhf", 120 }, { "coshf", 120 }, { "expm1f", 80 }, { "log1pf", 80 },
+	{ "fmodf", 80 }, { "hypotf", 40 }, { "cbrtf", 100 }, { "sqrtf", 14 },
+	{ "floorf", 2 }, { "ceilf", 2 }, { "roundf", 2 }, { "truncf", 2 },
+	{ "rintf", 2 }, { "lrintf", 3 }, { "fabsf", 1 },
+	// Double precision is all soft-float
+	{ "sin", 2500 }, { "cos", 2500 }, { "exp", 2000 }, { "exp2", 1800 },
+	{ "log", 2000 }, { "log2", 2000 }, { "log10", 2200 }, { "pow", 4000 },
+	{ "sqrt", 600 }, { "atan2", 3000 }, { "fmod", 800 }, { "lrint", 60 },
+	{ "floor", 40 }, { "fabs", 2 },
+};
+
+static const void *cycles_libm_addr[ARRAY_SIZE(cycles_libm)];
+
+// Where the math library functions ended up, ifuncs resolved. A
+// forked child has the same ones at the same addresses.
+static void cycles_init(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(cycles_libm); i++)
+		cycles_libm_addr[i] = dlsym(RTLD_DEFAULT, cycles_libm[i].name);
+}
+
+static int cycles_libm_find(unsigned long ip)
+{
+	for (int i = 0; i < ARRAY_SIZE(cycles_libm); i++) {
+		if (cycles_libm_addr[i] == (const void *) ip)
+			return i;
+	}
+	return -1;
+}
+
+struct cycles_insn {
+	int cls, lanes;		// the operation, and how many lanes of it
+	int mem, store, words;	// memory operand, written, how many words
+};
+
+// One-byte opcodes that have a ModRM byte (VEX and EVEX aside)
+static int cycles_has_modrm(int op)
+{
+	if (op < 0x40)
+		return (op & 7) < 4;
+	return op == 0x62 || op == 0x63 || op == 0x69 || op == 0x6b ||
+		(op >= 0x80 && op <= 0x8f) || op == 0xc0 || op == 0xc1 ||
+		op == 0xc6 || op == 0xc7 || (op >= 0xd0 && op <= 0xd3) ||
+		(op >= 0xd8 && op <= 0xdf) || op == 0xf6 || op == 0xf7 ||
+		op == 0xfe || op == 0xff;
+}
+
+// SSE/AVX float arithmetic: 'pp' picks ps, pd, ss or sd
+static void cycles_float(struct cycles_insn *in, int pp, int l, int cls)
+{
+	int dbl = pp == 1 || pp == 3;
+
+	in->cls = dbl ? (cls == CY_FDIV ? CY_DDIV : CY_DOUBLE) : cls;
+	in->lanes = pp == 0 ? 4 << l : pp == 1 ? 2 << l : 1;
+	in->words = pp >= 2 ? 1 + dbl : 4 << l;
+}
+
+static void cycles_map0(struct cycles_insn *in, int op, int reg)
+{
+	in->cls = CY_INT;
+	if (op < 0x40) {
+		// ALU r/m, reg: everything but cmp writes r/m
+		in->store = !(op & 2) && (op & 0x38) != 0x38;
+	} else if (op >= 0x50 && op <= 0x5f) {
+		in->cls = CY_MOVE;	// push, pop
+		in->mem = 1;
+		in->store = op < 0x58;
+	} else if (op >= 0x70 && op <= 0x7f) {
+		in->cls = CY_BRANCH;
+	} else if (op >= 0x80 && op <= 0x83) {
+		in->store = reg != 7;
+	} else if (op == 0x88 || op == 0x89 || op == 0xc6 || op == 0xc7) {
+		in->cls = CY_MOVE;
+		in->store = 1;
+	} else if (op == 0x8a || op == 0x8b) {
+		in->cls = CY_MOVE;
+	} else if (op == 0x8d) {
+		in->mem = 0;		// lea doesn't touch memory
+	} else if (op == 0x69 || op == 0x6b) {
+		in->cls = CY_MUL;
+	} else if (op == 0x90 || op == 0xcc) {
+		in->cls = CY_NOP;
+	} else if (op == 0xc0 || op == 0xc1 || (op >= 0xd0 && op <= 0xd3)) {
+		in->store = 1;
+	} else if (op == 0xc2 || op == 0xc3 || op == 0xe8) {
+		in->cls = CY_CALL;
+	} else if ((op >= 0xe0 && op <= 0xe3) || op == 0xe9 || op == 0xeb) {
+		in->cls = CY_BRANCH;
+	} else if (op == 0xf6 || op == 0xf7) {
+		in->cls = reg >= 6 ? CY_DIV : reg >= 4 ? CY_MUL : CY_INT;
+		in->store = reg == 2 || reg == 3;
+	} else if (op == 0xfe || op == 0xff) {
+		if (reg == 2 || reg == 3)
+			in->cls = CY_CALL;
+		else if (reg == 4 || reg == 5)
+			in->cls = CY_BRANCH;
+		in->store = reg < 2 || reg == 6;
+	}
+}
+
+static void cycles_map1(struct cycles_insn *in, int op, int pp, int l)
+{
+	int vec = 4 << l;
+
+	in->cls = CY_INT;
+	switch (op) {
+	case 0x10: case 0x11: case 0x28: case 0x29: case 0x2b:
+		cycles_float(in, pp, l, CY_MOVE);
+		in->cls = CY_MOVE;
+		in->store = op & 1;
+		// Packed register copies are mostly scalars being moved
+		if (!in->mem)
+			in->lanes = 1;
+		return;
+	case 0x12: case 0x13: case 0x16: case 0x17:
+		in->cls = in->mem ? CY_MOVE : CY_SHUFFLE;
+		in->lanes = in->words = 2;
+		in->store = op & 1;
+		return;
+	case 0x14: case 0x15: case 0xc6:
+		in->cls = CY_SHUFFLE;
+		in->lanes = in->words = vec;
+		return;
+	case 0x2a: case 0x2c: case 0x2d:
+		// Conversions to and from integers are scalar
+		cycles_float(in, pp >= 2 ? pp : 2, 0, CY_FLOAT);
+		return;
+	case 0x2e: case 0x2f:
+		cycles_float(in, pp ? 3 : 2, 0, CY_FLOAT);
+		return;
+	case 0x51:
+		cycles_float(in, pp, l, CY_FDIV);
+		return;
+	case 0x52: case 0x53:
+		// No reciprocal estimates: it's a divide
+		cycles_float(in, pp, l, CY_FDIV);
+		return;
+	case 0x54: case 0x55: case 0x56: case 0x57:
+		cycles_float(in, pp, l, CY_INT);
+		in->cls = CY_INT;
+		// fabs, negate, zeroing: scalar work done with packed ops
+		if (!in->mem)
+			in->lanes = 1;
+		return;
+	case 0x58: case 0x59: case 0x5c: case 0x5d: case 0x5f: case 0xc2:
+		cycles_float(in, pp, l, CY_FLOAT);
+		return;
+	case 0x5a:
+		cycles_float(in, pp, l, CY_DOUBLE);
+		in->cls = CY_DOUBLE;
+		return;
+	case 0x5b:
+		cycles_float(in, 0, l, CY_FLOAT);
+		return;
+	case 0x5e:
+		cycles_float(in, pp, l, CY_FDIV);
+		return;
+	case 0x6e: case 0x7e:
+		in->cls = CY_MOVE;
+		in->words = pp == 2 ? 2 : 1;
+		in->store = op == 0x7e && pp != 2;
+		return;
+	case 0x6f: case 0x7f: case 0xd6: case 0xe7:
+		in->cls = CY_MOVE;
+		in->lanes = in->mem ? vec : 1;
+		in->words = op == 0xd6 ? 2 : vec;
+		in->store = op != 0x6f;
+		return;
+	case 0x70:
+		in->cls = CY_SHUFFLE;
+		in->lanes = in->words = vec;
+		return;
+	case 0x1e:		// endbr64
+	case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1f:
+		in->cls = CY_NOP;
+		in->mem = 0;
+		return;
+	case 0xaf: case 0xd5: case 0xe5: case 0xf4:
+		in->cls = CY_MUL;
+		break;
+	}
+	if (op >= 0x80 && op <= 0x8f) {
+		in->cls = CY_BRANCH;
+	} else if (op >= 0x60 && op <= 0x6d) {
+		in->cls = CY_SHUFFLE;
+	} else if (op >= 0x90 && op <= 0x9f) {
+		in->store = 1;		// setcc
+	}
+	// SSE integer ops are 66-prefixed and work on every lane
+	if (pp == 1 && op >= 0x60)
+		in->lanes = in->words = vec;
+}
+
+static void cycles_map2(struct cycles_insn *in, int op, int w, int l)
+{
+	int vec = 4 << l;
+
+	in->cls = CY_INT;
+	in->lanes = in->words = vec;
+	if (op >= 0x96 && op <= 0xbf && (op & 0xf) >= 6) {
+		// vfmadd and friends: the odd ones in 98..9f are scalar
+		int scalar = (op & 0xf) >= 8 && (op & 1);
+
+		cycles_float(in, scalar ? 2 + w : w, l, CY_FMA);
+		if (in->cls == CY_DOUBLE)
+			in->lanes *= 2;
+	} else if (op == 0x00 || op == 0x0c || op == 0x0d || op == 0x16 ||
+		   op == 0x18 || op == 0x19 || op == 0x36) {
+		in->cls = CY_SHUFFLE;
+	} else if (op == 0x40) {
+		in->cls = CY_MUL;
+	}
+}
+
+static void cycles_map3(struct cycles_insn *in, int op, int l)
+{
+	int vec = 4 << l;
+
+	in->cls = CY_SHUFFLE;
+	in->lanes = in->words = vec;
+	if (op >= 0x08 && op <= 0x0b) {
+		// round: VRINT
+		cycles_float(in, op == 0x08 ? 0 : op == 0x09 ? 1 : op == 0x0a ? 2 : 3, l, CY_FLOAT);
+	} else if (op == 0x40) {
+		cycles_float(in, 0, l, CY_FMA);
+	} else if (op >= 0x14 && op <= 0x17) {
+		in->lanes = in->words = 1;
+		in->store = 1;
+	}
+}
+
+static void cycles_decode(const unsigned char *p, struct cycles_insn *in)
+{
+	int pp = 0, map = 0, w = 0, l = 0;
+
+	*in = (struct cycles_insn) { CY_INT, 1, 0, 0, 1 };
+	for (;; p++) {
+		if (*p == 0x66)
+			pp = 1;
+		else if (*p == 0xf3)
+			pp = 2;
+		else if (*p == 0xf2)
+			pp = 3;
+		else if (*p != 0xf0 && *p != 0x2e && *p != 0x36 && *p != 0x3e &&
+			 *p != 0x26 && *p != 0x64 && *p != 0x65 && *p != 0x67)
+			break;
+	}
+	if ((*p & 0xf0) == 0x40)
+		w = (*p++ >> 3) & 1;
+
+	if (*p == 0xc5) {
+		map = 1;
+		l = (p[1] >> 2) & 1;
+		pp = p[1] & 3;
+		p += 2;
+	} else if (*p == 0xc4) {
+		map = p[1] & 0x1f;
+		w = p[2] >> 7;
+		l = (p[2] >> 2) & 1;
+		pp = p[2] & 3;
+		p += 3;
+	} else if (*p == 0x62) {
+		map = p[1] & 3;
+		w = p[2] >> 7;
+		l = (p[3] >> 5) & 3;
+		pp = p[2] & 3;
+		p += 4;
+	} else if (*p == 0x0f) {
+		map = 1;
+		if (p[1] == 0x38 || p[1] == 0x3a)
+			map = p[1] == 0x38 ? 2 : 3;
+		p += map == 1 ? 1 : 2;
+	}
+
+	int op = p[0], modrm = p[1];
+	int has_modrm = map ? !(map == 1 && ((op >= 0x80 && op <= 0x8f) ||
+					     (op >= 0xc8 && op <= 0xcf) ||
+					     op == 0x05 || op == 0x0b || op == 0x31 || op == 0xa2))
+			    : cycles_has_modrm(op);
+
+	in->mem = has_modrm && (modrm >> 6) != 3;
+	switch (map) {
+	case 0:
+		cycles_map0(in, op, (modrm >> 3) & 7);
+		break;
+	case 1:
+		cycles_map1(in, op, pp, l);
+		break;
+	case 2:
+		cycles_map2(in, op, w, l);
+		break;
+	default:
+		cycles_map3(in, op, l);
+		break;
+	}
+}
+
+// What the instruction costs, and where it goes in 'count'
+static uint cycles_charge(const struct cycles_insn *in, uint64_t *count)
+{
+	uint op = in->cls == CY_MOVE && in->mem ? 0 : cycles_m33[in->cls] * in->lanes;
+	uint load = 0, store = 0;
+
+	if (in->mem) {
+		if (in->store)
+			store = cycles_m33[CY_STORE] * in->words;
+		// Read-modify-write reads it first
+		if (!in->store || in->cls != CY_MOVE)
+			load = cycles_m33[CY_LOAD] + in->words - 1;
+	}
+	if (count) {
+		count[in->cls] += op;
+		count[CY_LOAD] += load;
+		count[CY_STORE] += store;
+	}
+	return op + load + store;
+}
+
+//
+// The traced side brackets what's to be measured: cycles_begin()
+// stops it and starts the stepping, and each cycles_mark() ends a
+// split. After the last one it runs at full speed again.
+//
+static __attribute__((noinline, noipa)) void cycles_begin(void)
+{
+	asm volatile("int3");
+}
+
+static __attribute__((noinline, noipa)) void cycles_mark(void)
+{
+	asm volatile("");
+}
+
+// Forks a child to be traced: returns 0 in it, its pid in the parent
+static pid_t cycles_fork(void)
+{
+	int status;
+
+	fflush(NULL);
+	pid_t pid = fork();
+	if (!pid) {
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		return 0;
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) PTRACE_O_EXITKILL);
+	return pid;
+}
+
+// Lets a math library call run to its return address at full speed
+static int cycles_skip_call(pid_t pid)
+{
+	struct user_regs_struct regs;
+	int status;
+
+	ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+	unsigned long ret = ptrace(PTRACE_PEEKDATA, pid, (void *) regs.rsp, NULL);
+	long word = ptrace(PTRACE_PEEKTEXT, pid, (void *) ret, NULL);
+
+	ptrace(PTRACE_POKETEXT, pid, (void *) ret, (void *) ((word & ~0xffL) | 0xcc));
+	ptrace(PTRACE_CONT, pid, NULL, NULL);
+	if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP)
+		return -1;
+	ptrace(PTRACE_POKETEXT, pid, (void *) ret, (void *) word);
+	ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+	regs.rip = ret;
+	ptrace(PTRACE_SETREGS, pid, NULL, &regs);
+	return 0;
+}
+
+// Runs the child to its next cycles_begin() and steps it through
+// 'marks' splits, with their costs in split[] and their classes
+// added to count[split][class] (which can be NULL). Returns 1 when the child is done, 0
+// after a region, -1 if it died.
+static int cycles_region(pid_t pid, int marks, uint *split, uint64_t (*count)[CY_CLASSES])
+{
+	extern char __executable_start[], etext[];
+	unsigned long mark = (unsigned long) cycles_mark;
+	int status, sig = 0, jumped = 0;
+	uint cost = 0;
+
+	for (;;) {
+		// Signals other than ours are passed on
+		ptrace(PTRACE_CONT, pid, NULL, (void *) (long) sig);
+		if (waitpid(pid, &status, 0) != pid)
+			return -1;
+		if (WIFEXITED(status))
+			return 1;
+		if (!WIFSTOPPED(status))
+			return -1;
+		sig = WSTOPSIG(status);
+		if (sig == SIGTRAP)
+			break;
+	}
+
+	for (int m = 0; m < marks; ) {
+		unsigned long ip = ptrace(PTRACE_PEEKUSER, pid,
+					  (void *) offsetof(struct user, regs.rip), NULL);
+		struct cycles_insn in;
+		int libm;
+
+		if (ip == mark) {
+			split[m++] = cost;
+			cost = 0;
+			if (m == marks)
+				break;
+		}
+		// A call or jump out of the program may be into libm
+		if (jumped && (ip < (unsigned long) __executable_start || ip >= (unsigned long) etext) &&
+		    (libm = cycles_libm_find(ip)) >= 0) {
+			cost += cycles_libm[libm].cycles;
+			if (count)
+				count[m][CY_LIBM] += cycles_libm[libm].cycles;
+			if (cycles_skip_call(pid))
+				return -1;
+			jumped = 0;
+			continue;
+		}
+
+		// Same program, same libraries: the code is at 'ip' here too
+		cycles_decode((const unsigned char *) ip, &in);
+		cost += cycles_charge(&in, count ? count[m] : NULL);
+		jumped = in.cls == CY_CALL || in.cls == CY_BRANCH;
+
+		if (ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL) ||
+		    waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status))
+			return -1;
+	}
+	return 0;
+}
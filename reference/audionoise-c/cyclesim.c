@@ -0,0 +1,293 @@
+//
+// Estimate the pedal's cycles per sample for effects and chains
+//
+//	cyclesim [-m MHz] [-s seconds] [-v] [effect | effect+effect... ...]
+//
+// Every effect (or the named ones, or chains of them joined with
+// '+') is run over the test signals in gen.h at a few pot settings,
+// like rtcheck does, and each sample's steps are single-stepped
+// through cycles.h's Cortex-M33 cost model. The inits, the signal
+// generation and the pot smoothing run at full speed; they're not
+// in the per-sample deadline.
+//
+// Prints the worst and mean cycles per sample against the budget,
+// which is the clock (-m, default 150 MHz) over 48 kHz; chains get
+// a line for the whole chain and one for each effect in it. An
+// effect that does its work a frame at a time (pitch, onset, the
+// tracking harmonics) has a mean that fits and a worst case that
+// doesn't: that's 'buffer', it needs a block callback to spread the
+// frame out. -v adds where the cycles go, by instruction class.
+//
+// Exits with 1 if anything doesn't fit the per-sample deadline.
+//
+// Single-stepping is slow, a few million instructions a second, so
+// the default is 20ms of input per setting. Link with -ldl and
+// -Wl,-z,now, so the lazy binding of the math library isn't counted.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "gen.h"
+#include "cycles.h"
+
+#define BLOCK 256
+#define MAX_CHAIN 8
+
+static const float settings[][4] = {
+	{ 0.5, 0.5, 0.5, 0.5 },
+	{ 0, 0, 0, 0 },
+	{ 1, 1, 1, 1 },
+	{ 0.25, 0.75, 0.1, 0.9 },
+};
+
+struct split {
+	uint worst;
+	uint64_t total;
+	uint64_t count[CY_CLASSES];
+};
+
+struct target {
+	const char *name;
+	struct effect *chain[MAX_CHAIN];
+	int nr;
+	uint64_t samples;
+	struct split split[MAX_CHAIN], all;
+};
+
+// What the harness itself costs around a step
+static void nothing_init(float pot1, float pot2, float pot3, float pot4)
+{
+}
+
+static float nothing_step(float in)
+{
+	return in;
+}
+
+static struct effect nothing = { "nothing", nothing_init, nothing_init, nothing_step };
+
+// Runs in the traced child
+static void run_chain(struct effect **chain, int nr, uint length, int devnull)
+{
+	float in[BLOCK];
+
+	gen_init(length * ARRAY_SIZE(settings));
+	effect_has_sidechain = 1;
+	dup2(devnull, 2);
+
+	for (int s = 0; s < ARRAY_SIZE(settings); s++) {
+		const struct generator *g = generators + s % ARRAY_SIZE(generators);
+		const float *p = settings[s];
+
+		for (int e = 0; e < nr; e++)
+			chain[e]->init(p[0], p[1], p[2], p[3]);
+
+		for (uint done = 0; done < length; done += BLOCK) {
+			gen_block(g, in, BLOCK);
+			for (int i = 0; i < BLOCK; i++) {
+				float out = in[i];
+
+				effect_sidechain = gen_white_sample() * GEN_LEVEL;
+				UPDATE(effect_delay);
+
+				cycles_begin();
+				for (int e = 0; e < nr; e++) {
+					out = chain[e]->step(out);
+					cycles_mark();
+				}
+				in[i] = out;
+			}
+		}
+	}
+}
+
+// Steps a target through, less 'overhead' per effect
+static int simulate(struct target *t, uint length, uint overhead, int devnull)
+{
+	uint split[MAX_CHAIN];
+
+	pid_t pid = cycles_fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		run_chain(t->chain, t->nr, length, devnull);
+		_exit(0);
+	}
+
+	for (;;) {
+		uint64_t count[MAX_CHAIN][CY_CLASSES] = { };
+		uint sum = 0;
+
+		int ret = cycles_region(pid, t->nr, split, count);
+		if (ret)
+			return ret < 0 ? -1 : 0;
+
+		for (int e = 0; e < t->nr; e++) {
+			struct split *s = t->split + e;
+			uint c = split[e] > overhead ? split[e] - overhead : 0;
+
+			if (c > s->worst)
+				s->worst = c;
+			s->total += c;
+			sum += c;
+			for (int i = 0; i < CY_CLASSES; i++) {
+				s->count[i] += count[e][i];
+				t->all.count[i] += count[e][i];
+			}
+		}
+		if (sum > t->all.worst)
+			t->all.worst = sum;
+		t->all.total += sum;
+		t->samples++;
+	}
+}
+
+static const char *verdict(uint worst, double mean, double budget)
+{
+	if (worst <= budget)
+		return "ok";
+	return mean <= budget ? "buffer" : "TOO SLOW";
+}
+
+static void report(const char *name, const struct split *s, uint64_t samples, double budget, int verbose)
+{
+	double mean = (double) s->total / samples;
+
+	printf("%-30s %9u %9.0f %8.1f%% %8.1f%%  %s\n", name, s->worst, mean,
+	       100 * s->worst / budget, 100 * mean / budget, verdict(s->worst, mean, budget));
+	if (!verbose)
+		return;
+
+	uint64_t total = 0;
+	for (int i = 0; i < CY_CLASSES; i++)
+		total += s->count[i];
+	printf("%-30s", "");
+	for (int i = 0; i < CY_CLASSES; i++) {
+		if (total && s->count[i] * 100 >= total)
+			printf(" %s %.0f%%", cycles_name[i], 100.0 * s->count[i] / total);
+	}
+	printf("\n");
+}
+
+static int parse_target(struct target *t, char *arg)
+{
+	t->name = strdup(arg);
+	for (char *name = strtok(arg, "+"); name; name = strtok(NULL, "+")) {
+		struct effect *eff = find_effect(name);
+
+		if (!eff || strcmp(eff->name, name)) {
+			fprintf(stderr, "cyclesim: no effect '%s'\n", name);
+			return -1;
+		}
+		if (t->nr == MAX_CHAIN) {
+			fprintf(stderr, "cyclesim: at most %d effects in a chain\n", MAX_CHAIN);
+			return -1;
+		}
+		t->chain[t->nr++] = eff;
+	}
+	return t->nr ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	float mhz = 150, seconds = 0.02;
+	int opt, verbose = 0, failed = 0;
+
+	while ((opt = getopt(argc, argv, "+m:s:v")) != -1) {
+		switch (opt) {
+		case 'm':	// core clock in MHz
+			mhz = atof(optarg);
+			break;
+		case 's':	// seconds per pot setting
+			seconds = atof(optarg);
+			break;
+		case 'v':	// cycles by instruction class
+			verbose = 1;
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	int nr = argc ? argc : ARRAY_SIZE(effects);
+	struct target *targets = calloc(nr, sizeof(*targets));
+	if (!targets)
+		return 1;
+	for (int i = 0; i < nr; i++) {
+		struct target *t = targets + i;
+
+		if (argc) {
+			if (parse_target(t, argv[i]))
+				return 1;
+		} else {
+			t->name = effects[i].name;
+			t->chain[t->nr++] = effects + i;
+		}
+	}
+
+	int devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return 1;
+	cycles_init();
+
+	double budget = mhz * 1e6 / SAMPLES_PER_SEC;
+	uint length = seconds * SAMPLES_PER_SEC;
+
+	// The harness's own call and loop around each step
+	struct target base = { "nothing", { &nothing }, 1 };
+	if (simulate(&base, BLOCK, 0, devnull) || !base.samples) {
+		fprintf(stderr, "cyclesim: can't trace (ptrace not allowed?)\n");
+		return 1;
+	}
+	uint overhead = base.split[0].total / base.samples;
+
+	printf("Cortex-M33 at %g MHz: %.0f cycles per sample\n\n", mhz, budget);
+	printf("%-30s %9s %9s %9s %9s\n", "effect", "worst", "mean", "worst%", "mean%");
+	for (int i = 0; i < nr; i++) {
+		struct target *t = targets + i;
+
+		fflush(stdout);
+		if (simulate(t, length, overhead, devnull) || !t->samples) {
+			fprintf(stderr, "cyclesim: %s: the traced child died\n", t->name);
+			failed = 1;
+			continue;
+		}
+		report(t->name, &t->all, t->samples, budget, verbose && t->nr == 1);
+		if (t->nr > 1) {
+			for (int e = 0; e < t->nr; e++) {
+				char name[64];
+
+				snprintf(name, sizeof(name), "  %s", t->chain[e]->name);
+				report(name, t->split + e, t->samples, budget, verbose);
+			}
+		}
+		failed |= t->all.worst > budget;
+	}
+	return failed;
+}
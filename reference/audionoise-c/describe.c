@@ -0,0 +1,154 @@
+//
+// Describe a recording: per-frame and whole-file features
+//
+//	describe [-f frames.tsv] < input.raw
+//
+// The input is raw 32-bit samples like 'convert'. It's streamed in
+// a pair of frames at a time, so the length doesn't matter. Every
+// frame gets the descriptors in analysis.h, written one line per
+// frame to 'frames.tsv' if asked for, and stdout gets their mean
+// and standard deviation over the file as "name mean std" lines,
+// followed by the loudness, peak and duration of the whole thing.
+//
+// The speed goes to stderr.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "analysis.h"
+
+// Two frames overlapping by a hop span three hops
+#define SPAN (3*FRAME_HOP)
+
+static struct frame_work frames;
+static struct feature_work work;
+static double sum[FRAME_FEATURES], sum2[FRAME_FEATURES];
+static long nr_frames;
+static FILE *out;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void add_frame(const float *f)
+{
+	if (out) {
+		fprintf(out, "%.4f", nr_frames * FRAME_HOP / SAMPLES_PER_SEC);
+		for (int i = 0; i < FRAME_FEATURES; i++)
+			fprintf(out, "\t%g", f[i]);
+		fprintf(out, "\n");
+	}
+	for (int i = 0; i < FRAME_FEATURES; i++) {
+		sum[i] += f[i];
+		sum2[i] += (double) f[i] * f[i];
+	}
+	nr_frames++;
+}
+
+int main(int argc, char **argv)
+{
+	float buf[SPAN], fa[FRAME_FEATURES], fb[FRAME_FEATURES];
+	s32 raw[SPAN];
+	double loudness = 0;
+	float peak = 0;
+	long total = 0;
+	int opt, have = 0;
+
+	while ((opt = getopt(argc, argv, "f:")) != -1) {
+		switch (opt) {
+		case 'f':	// per-frame features
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	frame_features_init();
+	features_k_weighting(&work);
+	if (out) {
+		fprintf(out, "time");
+		for (int i = 0; i < FRAME_FEATURES; i++)
+			fprintf(out, "\t%s", frame_feature_name(i));
+		fprintf(out, "\n");
+	}
+
+	double start = now();
+	for (;;) {
+		int n = fread(raw, 4, SPAN - have, stdin);
+
+		for (int i = 0; i < n; i++) {
+			float x = raw[i] / (float)0x80000000;
+			float a = fabsf(x);
+
+			buf[have + i] = x;
+			if (a > peak)
+				peak = a;
+		}
+		loudness += features_k_sum(buf + have, n, &work);
+		total += n;
+		have += n;
+		if (have < SPAN)
+			break;
+
+		frame_features(buf, buf + FRAME_HOP, fa, fb, &frames);
+		add_frame(fa);
+		add_frame(fb);
+
+		// The next pair starts where the second frame did
+		memmove(buf, buf + 2*FRAME_HOP, FRAME_HOP * sizeof(float));
+		have = FRAME_HOP;
+	}
+
+	// One more whole frame may fit in what's left
+	if (have >= FRAME_SIZE) {
+		frame_features(buf, NULL, fa, NULL, &frames);
+		add_frame(fa);
+	}
+	double elapsed = now() - start;
+
+	if (out)
+		fclose(out);
+	if (!nr_frames) {
+		fprintf(stderr, "Not enough input\n");
+		return 1;
+	}
+
+	for (int i = 0; i < FRAME_FEATURES; i++) {
+		double mean = sum[i] / nr_frames;
+		double var = sum2[i] / nr_frames - mean * mean;
+		printf("%s\t%g\t%g\n", frame_feature_name(i), mean, var > 0 ? sqrt(var) : 0);
+	}
+	printf("loudness\t%g\n", features_lufs(loudness, total));
+	printf("peak\t%g\n", 20 * log10f(peak + 1e-9f));
+	printf("duration\t%g\n", total / SAMPLES_PER_SEC);
+
+	fprintf(stderr, "describe: %ld frames, %.1f s in %.3f s (%.0fx realtime)\n",
+		nr_frames, total / SAMPLES_PER_SEC, elapsed,
+		total / SAMPLES_PER_SEC / elapsed);
+	return 0;
+}
@@ -6,13 +6,20 @@
 // Approximate a pitch shifter. Not a great one, I'm
 // afraid.
 //
-struct {
+static struct {
 	struct lfo_state lfo;
 	float step;
 } disco;
 
 #define DISCONT_SHIFT 12
 #define DISCONT_STEPS (1 << DISCONT_SHIFT)
+#define DISCONT_DELAY (2*DISCONT_STEPS + 2)
+
+#if !defined(EMBEDDED) || WITH_DISCONT
+_Static_assert(DISCONT_DELAY <= SAMPLE_ARRAY_SIZE, "sample_array is too small for discont");
+#endif
+EFFECT_MEMORY(discont, sizeof(disco), 0, DISCONT_DELAY, 0);
+EFFECT_STATE(discont, REGION(disco));
 
 #define SEMITONE_MULT (1.0594630943592953f)
 
@@ -21,7 +28,7 @@ struct {
 
 #define TONESTEPS 100
 
-void discont_init(float pot1, float pot2, float pot3, float pot4)
+static void discont_init(float pot1, float pot2, float pot3, float pot4)
 {
 	// Which direction do we walk the samples?
 	// Walking backwards lowers the pitch
@@ -41,7 +48,7 @@ void discont_init(float pot1, float pot2, float pot3, float pot4)
 
 // i is discontinuous when sin**2 is 0
 // ni is discontinuous when cos**2 (aka 1-sin**2) is 0
-float discont_step(float in)
+static float discont_step(float in)
 {
 	// The 'idx << 1' is because we only use half the wave,
 	// we'll use 'sin**2' that is the same in both halves
@@ -0,0 +1,70 @@
+//
+// Double-buffered block processing for the pedal
+//
+// The codec's DMA runs round and round over a receive and a transmit
+// buffer of two halves each, and interrupts at the middle and at the
+// end. At the half-transfer interrupt the first half of 'rx' has
+// just filled and the first half of 'tx' has just gone out, so
+// dma_irq(0) turns the one into the other while the DMA works on the
+// second halves; at the end it's dma_irq(1). That's an interrupt per
+// block instead of one per sample, and the effects run in a tight
+// loop in between.
+//
+// The cost is latency: a sample waits for its half to fill, and the
+// result for the other half to go out, which is two blocks in all
+// (DMA_LATENCY). The deadline is a block period: dma_irq(h) has to
+// be done before the DMA comes back round to tx[h].
+//
+// The buffers are the codec's 32-bit frames, left-justified; the
+// right channel is the sidechain. The block size is set once, with
+// dma_init(), since the host simulates several (dmasim.c); the
+// firmware uses DMA_BLOCK.
+//
+// Include after effects.h.
+//
+#ifndef DMA_BLOCK
+#define DMA_BLOCK 32
+#endif
+#define DMA_MAX_BLOCK 64
+#define DMA_MAX_CHAIN 8
+
+#define DMA_LATENCY(block) (2 * (block))
+
+static struct {
+	int32_t rx[2][DMA_MAX_BLOCK], side[2][DMA_MAX_BLOCK];
+	int32_t tx[2][DMA_MAX_BLOCK];
+	int block, nr;
+	float (*step[DMA_MAX_CHAIN])(float);
+} dma;
+
+static int dma_init(int block, struct effect **chain, int nr)
+{
+	if (block < 1 || block > DMA_MAX_BLOCK || nr > DMA_MAX_CHAIN)
+		return -1;
+	memset(&dma, 0, sizeof(dma));
+	dma.block = block;
+	dma.nr = nr;
+	for (int i = 0; i < nr; i++)
+		dma.step[i] = chain[i]->step;
+	return 0;
+}
+
+// The half-transfer (0) and transfer-complete (1) interrupts
+static void dma_irq(int half)
+{
+	const int32_t *in = dma.rx[half], *side = dma.side[half];
+	int32_t *out = dma.tx[half];
+
+	for (int i = 0; i < dma.block; i++) {
+		float s = in[i] * (1.0f / 0x80000000);
+
+		effect_sidechain = side[i] * (1.0f / 0x80000000);
+		UPDATE(effect_delay);
+		for (int e = 0; e < dma.nr; e++)
+			s = dma.step[e](s);
+
+		// Anything at full scale or over is clipped
+		s = fmaxf(-1.0f, fminf(s, 0x7fffff80 / (float) 0x80000000));
+		out[i] = (int32_t) (s * 0x80000000);
+	}
+}
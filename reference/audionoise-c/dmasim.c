@@ -0,0 +1,237 @@
+//
+// Simulate the pedal's codec DMA and block interrupts on the host
+//
+//	dmasim [-m MHz] [-s seconds] [-i cycles] [-b block,block...] effect[+effect...]
+//
+// Runs the chain through dma.h at each block size (default 1, 16,
+// 32 and 64; 1 is the interrupt-per-sample design), over the test
+// signals in gen.h at a few pot settings. Each interrupt handler is
+// single-stepped through cycles.h's Cortex-M33 model to get what
+// that block costs, plus a fixed cost per interrupt for the
+// exception entry and exit with the FPU state and the DMA flag
+// handling (-i, default 50 cycles).
+//
+// Those costs then go on a timeline: the DMA raises an interrupt
+// every block period, a handler starts when the interrupt comes in
+// or when the one before it is done, whichever is later, and has to
+// be done within a block period, before the DMA wraps round to the
+// half it's writing. One that isn't is an overrun, a click.
+//
+// For each block size prints the latency the two buffers add, the
+// average CPU load, the worst single block against its period, the
+// overruns, and the cycles per sample left over for more effects.
+// Exits with 1 if there were overruns at every block size.
+//
+// Link with -ldl and -Wl,-z,now, like cyclesim.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "gen.h"
+#include "cycles.h"
+#include "dma.h"
+
+#define MAX_SIZES 8
+
+static const float settings[][4] = {
+	{ 0.5, 0.5, 0.5, 0.5 },
+	{ 0, 0, 0, 0 },
+	{ 1, 1, 1, 1 },
+	{ 0.25, 0.75, 0.1, 0.9 },
+};
+
+struct timeline {
+	double period, now, busy, worst;
+	uint blocks, overruns;
+};
+
+// Runs in the traced child: the codec fills a half, the interrupt
+// handler runs on it
+static void run_codec(struct effect **chain, int nr, int block, uint length, int devnull)
+{
+	float in[DMA_MAX_BLOCK];
+	int half = 0;
+
+	gen_init(length * ARRAY_SIZE(settings));
+	effect_has_sidechain = 1;
+	dup2(devnull, 2);
+	if (dma_init(block, chain, nr))
+		return;
+
+	for (int s = 0; s < ARRAY_SIZE(settings); s++) {
+		const struct generator *g = generators + s % ARRAY_SIZE(generators);
+		const float *p = settings[s];
+
+		for (int e = 0; e < nr; e++)
+			chain[e]->init(p[0], p[1], p[2], p[3]);
+
+		for (uint done = 0; done < length; done += block) {
+			gen_block(g, in, block);
+			for (int i = 0; i < block; i++) {
+				dma.rx[half][i] = in[i] * 0x80000000;
+				dma.side[half][i] = gen_white_sample() * GEN_LEVEL * 0x80000000;
+			}
+
+			cycles_begin();
+			dma_irq(half);
+			cycles_mark();
+			half ^= 1;
+		}
+	}
+}
+
+// Where the handler for this block starts and ends
+static void schedule(struct timeline *t, double cost)
+{
+	double arrival = t->blocks * t->period;
+	double start = t->now > arrival ? t->now : arrival;
+
+	t->now = start + cost;
+	t->busy += cost;
+	if (cost > t->worst)
+		t->worst = cost;
+	if (t->now > arrival + t->period)
+		t->overruns++;
+	t->blocks++;
+}
+
+static int simulate(struct effect **chain, int nr, int block, uint length,
+		    struct timeline *t, uint irq, int devnull)
+{
+	uint cost;
+
+	pid_t pid = cycles_fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		run_codec(chain, nr, block, length, devnull);
+		_exit(0);
+	}
+	for (;;) {
+		int ret = cycles_region(pid, 1, &cost, NULL);
+
+		if (ret)
+			return ret < 0 || !t->blocks ? -1 : 0;
+		schedule(t, irq + cost);
+	}
+}
+
+static int parse_chain(struct effect **chain, char *arg)
+{
+	int nr = 0;
+
+	for (char *name = strtok(arg, "+"); name; name = strtok(NULL, "+")) {
+		struct effect *eff = find_effect(name);
+
+		if (!eff || strcmp(eff->name, name)) {
+			fprintf(stderr, "dmasim: no effect '%s'\n", name);
+			return -1;
+		}
+		if (nr == DMA_MAX_CHAIN) {
+			fprintf(stderr, "dmasim: at most %d effects in a chain\n", DMA_MAX_CHAIN);
+			return -1;
+		}
+		chain[nr++] = eff;
+	}
+	return nr;
+}
+
+int main(int argc, char **argv)
+{
+	int size[MAX_SIZES] = { 1, 16, 32, 64 }, sizes = 4;
+	float mhz = 150, seconds = 0.02;
+	uint irq = 50;
+	int opt, ok = 0;
+
+	while ((opt = getopt(argc, argv, "+m:s:i:b:")) != -1) {
+		switch (opt) {
+		case 'm':	// core clock in MHz
+			mhz = atof(optarg);
+			break;
+		case 's':	// seconds per pot setting
+			seconds = atof(optarg);
+			break;
+		case 'i':	// cycles per interrupt, entry to exit
+			irq = atoi(optarg);
+			break;
+		case 'b':	// block sizes
+			sizes = 0;
+			for (char *b = strtok(optarg, ","); b && sizes < MAX_SIZES; b = strtok(NULL, ","))
+				size[sizes++] = atoi(b);
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	struct effect *chain[DMA_MAX_CHAIN];
+	char *name = argc == 1 ? strdup(argv[0]) : NULL;
+	int nr = argc == 1 ? parse_chain(chain, argv[0]) : -1;
+	if (nr <= 0) {
+		fprintf(stderr, "usage: dmasim [-m MHz] [-s seconds] [-i cycles] [-b block,...] effect[+effect...]\n");
+		return 1;
+	}
+	for (int i = 0; i < sizes; i++) {
+		if (size[i] < 1 || size[i] > DMA_MAX_BLOCK) {
+			fprintf(stderr, "dmasim: blocks are 1 to %d samples\n", DMA_MAX_BLOCK);
+			return 1;
+		}
+	}
+
+	int devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return 1;
+	cycles_init();
+
+	double budget = mhz * 1e6 / SAMPLES_PER_SEC;
+	uint length = seconds * SAMPLES_PER_SEC;
+
+	printf("%s on a Cortex-M33 at %g MHz: %.0f cycles per sample, %u per interrupt\n\n",
+	       name, mhz, budget, irq);
+	printf("%5s %10s %8s %11s %9s %11s\n",
+	       "block", "latency", "load", "worst/slot", "overruns", "free/sample");
+	for (int i = 0; i < sizes; i++) {
+		struct timeline t = { .period = size[i] * budget };
+
+		fflush(stdout);
+		if (simulate(chain, nr, size[i], length, &t, irq, devnull)) {
+			fprintf(stderr, "dmasim: block %d: the traced child died\n", size[i]);
+			return 1;
+		}
+		double elapsed = t.blocks * t.period;
+		double free = budget * (1 - t.busy / elapsed);
+
+		printf("%5d %7.2f ms %7.1f%% %10.1f%% %9u %11.0f  %s\n", size[i],
+		       1000 * DMA_LATENCY(size[i]) / SAMPLES_PER_SEC,
+		       100 * t.busy / elapsed, 100 * t.worst / t.period, t.overruns,
+		       free > 0 ? free : 0, t.overruns ? "overruns" : "ok");
+		ok |= !t.overruns;
+	}
+	return !ok;
+}
@@ -1,14 +1,25 @@
 //
 // Minimal echo effect
 //
+#ifndef ECHO_MAX_MS
+#define ECHO_MAX_MS 1000
+#endif
+#define ECHO_DELAY ((int) (ECHO_MAX_MS * SAMPLES_PER_MSEC) + 2)
+
+#if !defined(EMBEDDED) || WITH_ECHO
+_Static_assert(ECHO_DELAY <= SAMPLE_ARRAY_SIZE, "sample_array is too small for the echo");
+#endif
+EFFECT_MEMORY(echo, 0, 0, ECHO_DELAY, 0);
+EFFECT_STATE(echo);
+
 static inline void echo_init(float pot1, float pot2, float pot3, float pot4)
 {
-	effect_set_delay(pot1 * 1000);	// delay = 0 .. 1s
+	effect_set_delay(pot1 * ECHO_MAX_MS);	// delay = 0 .. 1s
 	effect_set_lfo_ms(pot3*4);	// LFO = 0 .. 4ms
 	effect_set_feedback(pot4);	// feedback = 0 .. 100%
 
 	fprintf(stderr, "echo:");
-	fprintf(stderr, " delay=%g ms", pot1 * 1000);
+	fprintf(stderr, " delay=%g ms", pot1 * ECHO_MAX_MS);
 	fprintf(stderr, " lfo=%g ms", pot3*4);
 	fprintf(stderr, " feedback=%g\n", pot4);
 }
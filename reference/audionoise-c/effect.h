@@ -26,3 +26,72 @@ static inline void effect_set_delay(float ms)
 	if (samples > 0 && samples < SAMPLE_ARRAY_SIZE)
 		target_effect_delay = samples;
 }
+
+//
+// Timestamped events from analysis effects (onsets and such).
+// The effect queues them from its step function, and the host
+// writes them out afterwards, so the step itself never does I/O.
+//
+struct effect_event {
+	uint sample;
+	float value;
+};
+
+#define EFFECT_EVENTS 64
+static struct effect_event effect_events[EFFECT_EVENTS];
+static uint effect_event_head, effect_event_tail;
+
+// The host's running sample count, which is what event times are
+// in. A host that writes events out sets it before every step.
+static uint effect_sample;
+
+static inline void effect_event(uint sample, float value)
+{
+	uint head = effect_event_head;
+
+	// Host isn't keeping up, drop it
+	if (head - effect_event_tail >= EFFECT_EVENTS)
+		return;
+	effect_events[head % EFFECT_EVENTS] = (struct effect_event) { sample, value };
+	effect_event_head = head + 1;
+}
+
+//
+// Second input for effects that take one (the vocoder carrier).
+// The host sets it before every step when it has one.
+//
+static float effect_sidechain;
+static int effect_has_sidechain;
+
+//
+// What an effect needs in RAM, declared right after its state so
+// that it's hard to forget: the state itself, its own delay lines
+// (both in bytes), how much of the shared sample_array it reads
+// back (in samples), and its const tables, which stay in flash on
+// the pedal. 'memreport' prints these for the build.
+//
+// An effect that reads effect_sidechain adds ".sidechain = 1" at the
+// end, so a host knows to give it one before it runs the init.
+//
+struct effect_memory {
+	uint state, delay, shared, tables;
+	int sidechain;
+};
+
+#define EFFECT_MEMORY(name, state, delay, shared, tables, ...) \
+	static const struct effect_memory name##_memory = { state, delay, shared, tables, __VA_ARGS__ }
+
+//
+// And the globals that state actually lives in, which is what a
+// session snapshot (snapshot.h) saves and restores. The shared
+// ones above go in every snapshot, so an effect that only uses
+// those has none of its own.
+//
+struct effect_region {
+	void *p;
+	size_t size;
+};
+
+#define REGION(x) { &(x), sizeof(x) }
+#define EFFECT_STATE(name, ...) \
+	static const struct effect_region name##_state[] = { __VA_ARGS__ }
@@ -0,0 +1,141 @@
+//
+// All the effects, and the table the tools look them up in
+//
+// Include after the core headers (util, lfo, effect, vec, biquad
+// and fft).
+//
+#include "flanger.h"
+#include "echo.h"
+#include "fm.h"
+#include "osc_bank.h"
+#include "phaser.h"
+#include "discont.h"
+#include "reverb.h"
+#include "magnitude.h"
+#include "vocoder.h"
+#include "onset.h"
+#include "pitch.h"
+#include "harmonic_track.h"
+#include "bass_harmonic.h"
+#include "guitar_harmonic.h"
+#include "synth_harmonic.h"
+#include "vocal_harmonic.h"
+
+// 'update' is what a pot change calls: it takes the new pots without
+// resetting anything, so tails and tracking carry on. For most effects
+// init does only that, and is used for both.
+#define EFF_UPDATE(x, update) \
+	{ #x, x##_init, update, x##_step, &x##_memory, x##_state, ARRAY_SIZE(x##_state) }
+#define EFF(x) EFF_UPDATE(x, x##_init)
+
+// The embedded profile only has the effects it was built with
+struct effect {
+	const char *name;
+	void (*init)(float,float,float,float);
+	void (*update)(float,float,float,float);
+	float (*step)(float);
+	const struct effect_memory *memory;
+	const struct effect_region *state;
+	int nr_state;
+} effects[] = {
+#if !defined(EMBEDDED) || WITH_DISCONT
+	EFF(discont),
+#endif
+#if !defined(EMBEDDED) || WITH_PHASER
+	EFF(phaser),
+#endif
+#if !defined(EMBEDDED) || WITH_FLANGER
+	EFF(flanger),
+#endif
+#if !defined(EMBEDDED) || WITH_ECHO
+	EFF(echo),
+#endif
+#if !defined(EMBEDDED) || WITH_FM
+	EFF(fm),
+#endif
+#if !defined(EMBEDDED) || WITH_OSC_BANK
+	EFF_UPDATE(osc_bank, osc_bank_update),
+#endif
+#if !defined(EMBEDDED) || WITH_REVERB
+	EFF_UPDATE(reverb, reverb_update),
+#endif
+#if !defined(EMBEDDED) || WITH_VOCODER
+	EFF_UPDATE(vocoder, vocoder_update),
+#endif
+#if !defined(EMBEDDED) || WITH_MAGNITUDE
+	EFF(magnitude),
+#endif
+#if !defined(EMBEDDED) || WITH_PITCH
+	EFF_UPDATE(pitch, pitch_update),
+#endif
+#if !defined(EMBEDDED) || WITH_ONSET
+	EFF_UPDATE(onset, onset_update),
+#endif
+#if !defined(EMBEDDED) || WITH_BASS_HARMONIC
+	EFF(bass_harmonic),
+#endif
+#if !defined(EMBEDDED) || WITH_GUITAR_HARMONIC
+	EFF(guitar_harmonic),
+#endif
+#if !defined(EMBEDDED) || WITH_SYNTH_HARMONIC
+	EFF(synth_harmonic),
+#endif
+#if !defined(EMBEDDED) || WITH_VOCAL_HARMONIC
+	EFF(vocal_harmonic),
+#endif
+#if !defined(EMBEDDED) || WITH_BASS_HARMONIC_TRACK
+	EFF_UPDATE(bass_harmonic_track, bass_harmonic_update),
+#endif
+#if !defined(EMBEDDED) || WITH_GUITAR_HARMONIC_TRACK
+	EFF_UPDATE(guitar_harmonic_track, guitar_harmonic_update),
+#endif
+#if !defined(EMBEDDED) || WITH_SYNTH_HARMONIC_TRACK
+	EFF_UPDATE(synth_harmonic_track, synth_harmonic_update),
+#endif
+#if !defined(EMBEDDED) || WITH_VOCAL_HARMONIC_TRACK
+	EFF_UPDATE(vocal_harmonic_track, vocal_harmonic_update),
+#endif
+};
+
+#define UPDATE(x) x += 0.001 * (target_##x - x)
+
+// A block through a chain, a sample at a time through all of it.
+// 'out' can be 'in', and 'side' NULL if there's no sidechain.
+static inline void effect_chain_block(struct effect *const *chain, int nr, const float *in,
+				      const float *side, float *out, int n)
+{
+	for (int i = 0; i < n; i++) {
+		float s = in[i];
+
+		if (side)
+			effect_sidechain = side[i];
+		UPDATE(effect_delay);
+		for (int e = 0; e < nr; e++)
+			s = chain[e]->step(s);
+		out[i] = s;
+	}
+}
+
+// Two effects can't run side by side if their state is in the same
+// globals, or if they both use effect.h's shared delay
+static inline int effects_clash(const struct effect *a, const struct effect *b)
+{
+	if (a == b || (a->memory->shared && b->memory->shared))
+		return 1;
+	for (int i = 0; i < a->nr_state; i++) {
+		for (int j = 0; j < b->nr_state; j++) {
+			if (a->state[i].p == b->state[j].p)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static inline struct effect *find_effect(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
+		if (!strcmp(name, effects[i].name))
+			return effects+i;
+	}
+	return NULL;
+}
@@ -0,0 +1,82 @@
+//
+// Embedded build profile for the pedal (RP2354)
+//
+// Build with -DEMBEDDED and a -DWITH_<EFFECT> for each effect the
+// firmware needs, say -DEMBEDDED -DWITH_PHASER -DWITH_ECHO. Only
+// those go in the effects table, and since all the effect state is
+// static, an optimized build drops everything the table doesn't
+// reach (add -Wno-unused for the warnings about what it dropped).
+//
+// The memory the host build sizes for the worst case is sized for
+// the selected effects instead:
+//
+//  - the shared delay line, sample_array, is the next power of two
+//    above the longest delay any of them reads back
+//  - the FFT tables are only as big as the largest FFT they do
+//
+// and the biggest per-effect delays are knobs: ECHO_MAX_MS (the echo
+// pot range, default 1000) and REVERB_SIZE (samples per reverb line,
+// default 8192, smaller caps the size pot). Each effect declares
+// its memory with EFFECT_MEMORY(), and 'memreport' prints it and
+// checks the whole build against EMBEDDED_RAM.
+//
+// The firmware runs the effects from the codec's DMA interrupts a
+// block at a time, with dma.h; DMA_BLOCK sets the block size.
+//
+// Included by util.h, before anything is sized. The delays here
+// are in samples at 48 kHz, and the effects check them with static
+// asserts, so they can't silently fall out of step.
+//
+#ifndef EMBEDDED_RAM
+#define EMBEDDED_RAM (520 * 1024)	// RP2354 SRAM
+#endif
+
+#ifndef ECHO_MAX_MS
+#define ECHO_MAX_MS 1000
+#endif
+
+// How much of sample_array each of its users needs, at most
+#define EMBEDDED_DELAY_ECHO (ECHO_MAX_MS * 48 + 2)
+#define EMBEDDED_DELAY_FLANGER (2 * 4 * 48 + 2)
+#define EMBEDDED_DELAY_DISCONT (2 * 4096 + 2)
+
+#define EMBEDDED_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// -DWITH_ECHO makes WITH_ECHO 1, and in #if anything undefined is 0
+#define EMBEDDED_DELAY EMBEDDED_MAX(					\
+	EMBEDDED_MAX(WITH_ECHO * EMBEDDED_DELAY_ECHO,			\
+		     WITH_FLANGER * EMBEDDED_DELAY_FLANGER),		\
+	WITH_DISCONT * EMBEDDED_DELAY_DISCONT)
+
+#if EMBEDDED_DELAY <= 16
+#define SAMPLE_ARRAY_SIZE 16
+#elif EMBEDDED_DELAY <= 512
+#define SAMPLE_ARRAY_SIZE 512
+#elif EMBEDDED_DELAY <= 1024
+#define SAMPLE_ARRAY_SIZE 1024
+#elif EMBEDDED_DELAY <= 2048
+#define SAMPLE_ARRAY_SIZE 2048
+#elif EMBEDDED_DELAY <= 4096
+#define SAMPLE_ARRAY_SIZE 4096
+#elif EMBEDDED_DELAY <= 8192
+#define SAMPLE_ARRAY_SIZE 8192
+#elif EMBEDDED_DELAY <= 16384
+#define SAMPLE_ARRAY_SIZE 16384
+#elif EMBEDDED_DELAY <= 32768
+#define SAMPLE_ARRAY_SIZE 32768
+#elif EMBEDDED_DELAY <= 65536
+#define SAMPLE_ARRAY_SIZE 65536
+#else
+#define SAMPLE_ARRAY_SIZE 131072
+#endif
+
+// The pitch detector (and so every harmonic enhancer, which can
+// track) does 2048-point FFTs, the onset detector 1024
+#if WITH_PITCH || WITH_BASS_HARMONIC || WITH_GUITAR_HARMONIC || \
+    WITH_SYNTH_HARMONIC || WITH_VOCAL_HARMONIC || \
+    WITH_BASS_HARMONIC_TRACK || WITH_GUITAR_HARMONIC_TRACK || \
+    WITH_SYNTH_HARMONIC_TRACK || WITH_VOCAL_HARMONIC_TRACK
+#define FFT_MAX_SHIFT 11
+#elif WITH_ONSET
+#define FFT_MAX_SHIFT 10
+#endif
@@ -0,0 +1,103 @@
+//
+// Plain radix-2 complex FFT
+//
+// In-place on separate real/imaginary arrays, sizes are powers of
+// two up to FFT_MAX. The twiddles for the stage with butterfly
+// span 'h' live at fft_cos[h .. 2h-1], so every stage reads them
+// contiguously and the wide stages go through vec.h.
+//
+// Call fft_init() once before use. Nothing here allocates.
+//
+#ifndef FFT_MAX_SHIFT
+#define FFT_MAX_SHIFT 13	// the embedded profile makes it smaller
+#endif
+#define FFT_MAX (1 << FFT_MAX_SHIFT)
+
+static float fft_cos[FFT_MAX], fft_sin[FFT_MAX];
+static unsigned short fft_reverse[FFT_MAX];
+
+static void fft_init(void)
+{
+	if (fft_cos[1])
+		return;
+	for (int h = 1; h < FFT_MAX; h <<= 1) {
+		for (int j = 0; j < h; j++) {
+			fft_cos[h+j] = cos(M_PI * j / h);
+			fft_sin[h+j] = -sin(M_PI * j / h);
+		}
+	}
+	for (int i = 0; i < FFT_MAX; i++) {
+		int r = 0;
+		for (int b = 0; b < FFT_MAX_SHIFT; b++)
+			r |= ((i >> b) & 1) << (FFT_MAX_SHIFT-1-b);
+		fft_reverse[i] = r;
+	}
+}
+
+// Bit-reverse reorder, combined with the first two stages
+// (where the twiddles are just 1 and -i)
+static void fft_first_stages(float *re, float *im, int n)
+{
+	int shift = FFT_MAX_SHIFT - __builtin_ctz(n);
+
+	for (int i = 0; i < n; i++) {
+		int j = fft_reverse[i] >> shift;
+		if (i < j) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (int k = 0; k < n; k += 4) {
+		float *r = re + k, *m = im + k;
+		float ar = r[0] + r[1], ai = m[0] + m[1];
+		float br = r[0] - r[1], bi = m[0] - m[1];
+		float cr = r[2] + r[3], ci = m[2] + m[3];
+		float dr = r[2] - r[3], di = m[2] - m[3];
+
+		// d * -i = (di, -dr)
+		r[0] = ar + cr; m[0] = ai + ci;
+		r[2] = ar - cr; m[2] = ai - ci;
+		r[1] = br + di; m[1] = bi - dr;
+		r[3] = br - di; m[3] = bi + dr;
+	}
+}
+
+// Forward transform, unnormalized. 'n' is at least 4.
+static void fft(float *re, float *im, int n)
+{
+	fft_first_stages(re, im, n);
+
+	for (int h = 4; h < n; h <<= 1) {
+		const float *wr = fft_cos + h, *wi = fft_sin + h;
+
+		for (int k = 0; k < n; k += 2*h) {
+			float *ar = re + k, *ai = im + k;
+			float *br = ar + h, *bi = ai + h;
+
+			for (int j = 0; j < h; j += VEC_WIDTH) {
+				vec4 xr = vec4_load(br+j), xi = vec4_load(bi+j);
+				vec4 c = vec4_load(wr+j), s = vec4_load(wi+j);
+				vec4 tr = xr*c - xi*s, ti = xr*s + xi*c;
+				vec4 ur = vec4_load(ar+j), ui = vec4_load(ai+j);
+
+				vec4_store(ar+j, ur + tr); vec4_store(ai+j, ui + ti);
+				vec4_store(br+j, ur - tr); vec4_store(bi+j, ui - ti);
+			}
+		}
+	}
+}
+
+// Inverse transform, scaled by 1/n. Swapping real and
+// imaginary parts turns the forward transform into the
+// inverse one.
+static void ifft(float *re, float *im, int n)
+{
+	float scale = 1.0f / n;
+
+	fft(im, re, n);
+	for (int i = 0; i < n; i++) {
+		re[i] *= scale;
+		im[i] *= scale;
+	}
+}
@@ -0,0 +1,1073 @@
+//
+// FLAC encoder and decoder for convert
+//
+// Both sides are stdio streams of the usual raw 32-bit samples, made
+// with fopencookie(), so the rest of convert doesn't know about them:
+// flac_output() encodes what's written to it, and flac_input()
+// decodes a FLAC stream (or passes anything else straight through).
+//
+// The encoder writes mono 32-bit frames of FLAC_BLOCK samples (FLAC
+// 1.4 and later read those), so it's lossless: the wasted-bits check
+// keeps anything that came from fewer bits as small as it was. Each
+// frame picks the smallest of a constant, verbatim, fixed predictor
+// or LPC subframe. The LPC analysis is a Tukey window and vec4
+// autocorrelation, Levinson-Durbin for every order up to 12, and
+// the order with the smallest estimated size is quantized to 15
+// bit coefficients and Rice coded with the best partitioning.
+//
+// Frames don't depend on each other, so they're encoded in batches
+// of FLAC_BATCH per job, by that many threads. The DSP fills the next
+// batch while the threads work on the last one, and batches go out
+// in order as soon as they're done.
+//
+// The decoder handles any FLAC stream up to 8 channels and 32 bits,
+// mixing it down to mono and checking the frame CRCs. The sample rate
+// is taken as it is: there's no resampling.
+//
+// Needs <stdint.h>, <pthread.h>, and _GNU_SOURCE for fopencookie().
+//
+#define FLAC_BLOCK 4096
+#define FLAC_MAX_BLOCK 65535
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_ORDER 12
+#define FLAC_PRECISION 15
+#define FLAC_MAX_PARTITION 8
+#define FLAC_BATCH 8
+#define FLAC_MAX_JOBS 64
+#define FLAC_BPS 32
+
+// CRCs a nibble at a time, so that the tables stay small and const
+static const uint8_t flac_crc8_nibble[16] = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+	0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d
+};
+
+static const uint16_t flac_crc16_nibble[16] = {
+	0x0000, 0x8005, 0x800f, 0x000a, 0x801b, 0x001e, 0x0014, 0x8011,
+	0x8033, 0x0036, 0x003c, 0x8039, 0x0028, 0x802d, 0x8027, 0x0022
+};
+
+static inline uint8_t flac_crc8_byte(uint8_t crc, uint8_t b)
+{
+	crc = (crc << 4) ^ flac_crc8_nibble[(crc >> 4) ^ (b >> 4)];
+	return (crc << 4) ^ flac_crc8_nibble[(crc >> 4) ^ (b & 15)];
+}
+
+static inline uint16_t flac_crc16_byte(uint16_t crc, uint8_t b)
+{
+	crc = (crc << 4) ^ flac_crc16_nibble[(crc >> 12) ^ (b >> 4)];
+	return (crc << 4) ^ flac_crc16_nibble[(crc >> 12) ^ (b & 15)];
+}
+
+//
+// Encoder
+//
+struct flac_bits {
+	uint8_t *buf;
+	size_t pos;
+	uint64_t acc;
+	int n;
+};
+
+// Up to 32 bits at a time, most significant first
+static inline void flac_put(struct flac_bits *b, uint32_t v, int bits)
+{
+	if (!bits)
+		return;
+	b->acc = (b->acc << bits) | (v & (0xffffffffu >> (32 - bits)));
+	b->n += bits;
+	while (b->n >= 8) {
+		b->n -= 8;
+		b->buf[b->pos++] = b->acc >> b->n;
+	}
+}
+
+static inline void flac_align(struct flac_bits *b)
+{
+	if (b->n)
+		flac_put(b, 0, 8 - b->n);
+}
+
+static inline void flac_put_rice(struct flac_bits *b, int64_t r, int k)
+{
+	uint64_t u = ((uint64_t) r << 1) ^ (uint64_t) (r >> 63);
+	uint64_t q = u >> k;
+
+	while (q >= 32) {
+		flac_put(b, 0, 32);
+		q -= 32;
+	}
+	flac_put(b, 1, q + 1);
+	flac_put(b, u, k);
+}
+
+// Frame numbers are coded like UTF-8
+static void flac_put_utf8(struct flac_bits *b, uint32_t v)
+{
+	if (v < 0x80) {
+		flac_put(b, v, 8);
+		return;
+	}
+	int bytes = v < 0x800 ? 2 : v < 0x10000 ? 3 : v < 0x200000 ? 4 : v < 0x4000000 ? 5 : 6;
+	int shift = 6 * (bytes - 1);
+
+	flac_put(b, ((0xff00 >> bytes) & 0xff) | (v >> shift), 8);
+	for (shift -= 6; shift >= 0; shift -= 6)
+		flac_put(b, 0x80 | ((v >> shift) & 0x3f), 8);
+}
+
+struct flac_rice {
+	int order, method;
+	uint8_t param[1 << FLAC_MAX_PARTITION];
+	uint64_t bits;
+};
+
+// Bits for 'count' values summing to 'sum' (after the sign fold) with
+// Rice parameter k. It's an upper bound: the quotients are rounded
+// down one by one.
+static inline uint64_t flac_rice_bits(uint64_t sum, uint count, int k)
+{
+	return (uint64_t) count * (k + 1) + (sum >> k);
+}
+
+static int flac_rice_param(uint64_t sum, uint count, uint64_t *bits)
+{
+	int k = 0;
+
+	if (count && sum > count)
+		k = 63 - __builtin_clzll(sum / count);
+	if (k > 30)
+		k = 30;
+
+	int best = k;
+	*bits = flac_rice_bits(sum, count, k);
+	for (int t = k - 1; t <= k + 1; t += 2) {
+		if (t < 0 || t > 30)
+			continue;
+		uint64_t b = flac_rice_bits(sum, count, t);
+		if (b < *bits) {
+			*bits = b;
+			best = t;
+		}
+	}
+	return best;
+}
+
+// Pick the partition order and parameters. The sums are found for
+// the finest partitioning and merged pairwise for the coarser ones.
+static void flac_rice_plan(const int64_t *res, int n, int pred, struct flac_rice *r)
+{
+	uint64_t sum[1 << FLAC_MAX_PARTITION];
+	int max = 0;
+
+	while (max < FLAC_MAX_PARTITION && !(n & (1 << max)) && (n >> (max + 1)) > pred)
+		max++;
+
+	int parts = 1 << max, size = n >> max;
+	for (int p = 0; p < parts; p++) {
+		uint64_t s = 0;
+		for (int i = p ? p * size : pred; i < (p + 1) * size; i++)
+			s += ((uint64_t) res[i] << 1) ^ (uint64_t) (res[i] >> 63);
+		sum[p] = s;
+	}
+
+	r->bits = UINT64_MAX;
+	for (int order = max; order >= 0; order--) {
+		uint8_t param[1 << FLAC_MAX_PARTITION];
+		uint64_t bits = 6;
+		int maxk = 0;
+
+		parts = 1 << order;
+		size = n >> order;
+		for (int p = 0; p < parts; p++) {
+			uint64_t b;
+			param[p] = flac_rice_param(sum[p], size - (p ? 0 : pred), &b);
+			if (param[p] > maxk)
+				maxk = param[p];
+			bits += b;
+		}
+		bits += parts * (maxk > 14 ? 5 : 4);
+		if (bits < r->bits) {
+			r->bits = bits;
+			r->order = order;
+			r->method = maxk > 14;
+			memcpy(r->param, param, parts);
+		}
+		for (int p = 0; p < parts / 2; p++)
+			sum[p] = sum[2*p] + sum[2*p + 1];
+	}
+}
+
+static void flac_put_residual(struct flac_bits *b, const int64_t *res, int n, int pred, const struct flac_rice *r)
+{
+	int parts = 1 << r->order, size = n >> r->order;
+
+	flac_put(b, r->method, 2);
+	flac_put(b, r->order, 4);
+	for (int p = 0; p < parts; p++) {
+		int k = r->param[p];
+
+		flac_put(b, k, r->method ? 5 : 4);
+		for (int i = p ? p * size : pred; i < (p + 1) * size; i++)
+			flac_put_rice(b, res[i], k);
+	}
+}
+
+// Fixed polynomial predictors: the order with the smallest total
+// absolute residual, of those whose residual fits in 32 bits like
+// decoders want. Returns -1 if none of them does.
+static int flac_fixed(const int32_t *x, int n, int64_t *res)
+{
+	int64_t sum[5] = { 0 }, max[5] = { 0 }, last[5] = { 0 };
+	int order = -1;
+
+	// Each order's residual is the difference of the one below. The
+	// sums are from the fifth sample, where all of them start.
+	for (int i = 0; i < n; i++) {
+		int64_t e = x[i];
+
+		for (int o = 0; o <= 4 && o <= i; o++) {
+			int64_t diff = e - last[o];
+
+			last[o] = e;
+			if (llabs(e) > max[o])
+				max[o] = llabs(e);
+			if (i >= 4)
+				sum[o] += llabs(e);
+			e = diff;
+		}
+	}
+	for (int o = 0; o <= 4 && (!o || n > 4); o++) {
+		if (max[o] <= INT32_MAX && (order < 0 || sum[o] < sum[order]))
+			order = o;
+	}
+	if (order < 0)
+		return -1;
+
+	for (int i = order; i < n; i++) {
+		int64_t p;
+		switch (order) {
+		case 0: p = 0; break;
+		case 1: p = x[i-1]; break;
+		case 2: p = 2 * (int64_t) x[i-1] - x[i-2]; break;
+		case 3: p = 3 * (int64_t) x[i-1] - 3 * (int64_t) x[i-2] + x[i-3]; break;
+		default: p = 4 * (int64_t) x[i-1] - 6 * (int64_t) x[i-2] + 4 * (int64_t) x[i-3] - x[i-4]; break;
+		}
+		res[i] = x[i] - p;
+	}
+	return order;
+}
+
+struct flac_lpc {
+	int order, shift;
+	int32_t coeff[FLAC_MAX_ORDER];
+};
+
+// Returns 0 if LPC isn't worth trying
+static int flac_lpc(const int32_t *x, int n, int bps, struct flac_lpc *lpc, int64_t *res)
+{
+	float xw[FLAC_BLOCK + 16];
+	double autoc[FLAC_MAX_ORDER + 1], a[FLAC_MAX_ORDER], err;
+	double coeff[FLAC_MAX_ORDER][FLAC_MAX_ORDER], error[FLAC_MAX_ORDER];
+	int max = n > 64 ? FLAC_MAX_ORDER : 0;
+
+	if (!max)
+		return 0;
+
+	// Tukey(0.5): flat in the middle, Hann tapers on the outer quarters
+	int taper = n / 4;
+	for (int i = 0; i < n; i++) {
+		float w = 1;
+		if (i < taper)
+			w = 0.5f - 0.5f * cosf(M_PI * i / taper);
+		else if (i >= n - taper)
+			w = 0.5f - 0.5f * cosf(M_PI * (n - 1 - i) / taper);
+		xw[i] = x[i] * w;
+	}
+	memset(xw + n, 0, 16 * sizeof(float));
+
+	int len = (n + VEC_WIDTH-1) & ~(VEC_WIDTH-1);
+	for (int lag = 0; lag <= max; lag++)
+		autoc[lag] = vec_dot(xw, xw + lag, len);
+	if (autoc[0] <= 0)
+		return 0;
+
+	// Levinson-Durbin, keeping the predictor for every order
+	err = autoc[0] * (1 + 1e-9);
+	for (int i = 0; i < max; i++) {
+		double r = -autoc[i+1];
+		int j;
+
+		for (j = 0; j < i; j++)
+			r -= a[j] * autoc[i-j];
+		r /= err;
+		a[i] = r;
+		for (j = 0; j < i/2; j++) {
+			double t = a[j];
+			a[j] += r * a[i-1-j];
+			a[i-1-j] += r * t;
+		}
+		if (i & 1)
+			a[j] += a[j] * r;
+		err *= 1 - r * r;
+		if (err <= 0) {
+			max = i;
+			break;
+		}
+		for (j = 0; j <= i; j++)
+			coeff[i][j] = -a[j];
+		error[i] = err;
+	}
+	if (!max)
+		return 0;
+
+	// Estimated frame bits for each order: the residual entropy
+	// from the prediction error, plus the warm-up and coefficients
+	double best = INFINITY;
+	for (int i = 0; i < max; i++) {
+		double per = 0.5 * log2(error[i] * 2.0 / n + 1e-30);
+		double bits = (per > 0 ? per : 0) * (n - i - 1) + (i + 1) * (bps + FLAC_PRECISION);
+		if (bits < best) {
+			best = bits;
+			lpc->order = i + 1;
+		}
+	}
+
+	// Quantize with the rounding error carried along
+	const double *c = coeff[lpc->order - 1];
+	double cmax = 0;
+	for (int j = 0; j < lpc->order; j++)
+		cmax = fmax(cmax, fabs(c[j]));
+	if (cmax <= 0)
+		return 0;
+
+	int exp;
+	frexp(cmax, &exp);
+	int shift = FLAC_PRECISION - 1 - exp;
+	if (shift < 0)
+		return 0;
+	if (shift > 15)
+		shift = 15;
+	lpc->shift = shift;
+
+	const int qmax = (1 << (FLAC_PRECISION - 1)) - 1;
+	double e = 0;
+	for (int j = 0; j < lpc->order; j++) {
+		e += c[j] * (1 << shift);
+		long q = lround(e);
+		q = q > qmax ? qmax : q < -qmax-1 ? -qmax-1 : q;
+		e -= q;
+		lpc->coeff[j] = q;
+	}
+
+	for (int i = lpc->order; i < n; i++) {
+		int64_t sum = 0;
+		for (int j = 0; j < lpc->order; j++)
+			sum += (int64_t) lpc->coeff[j] * x[i-1-j];
+		res[i] = x[i] - (sum >> shift);
+
+		// Decoders want 32-bit residuals, and a predictor this
+		// bad is no use anyway
+		if (llabs(res[i]) >= (1 << 30))
+			return 0;
+	}
+	return 1;
+}
+
+// A zero bit, the six bit type, and the wasted bits in unary
+static void flac_subframe_header(struct flac_bits *b, int type, int wasted)
+{
+	flac_put(b, type, 7);
+	if (wasted) {
+		flac_put(b, 1, 1);
+		flac_put(b, 1, wasted);
+	} else {
+		flac_put(b, 0, 1);
+	}
+}
+
+static void flac_verbatim(struct flac_bits *b, const int32_t *x, int n, int bps, int wasted)
+{
+	flac_subframe_header(b, 1, wasted);
+	for (int i = 0; i < n; i++)
+		flac_put(b, x[i], bps);
+}
+
+static void flac_subframe(struct flac_bits *b, int32_t *x, int n, int bps)
+{
+	int64_t res[FLAC_BLOCK], lpc_res[FLAC_BLOCK];
+	struct flac_rice fixed_rice, lpc_rice;
+	struct flac_lpc lpc = { .order = 1 };
+	uint32_t bits = 0;
+	int i;
+
+	for (i = 1; i < n && x[i] == x[0]; i++)
+		;
+	if (i == n) {
+		flac_subframe_header(b, 0, 0);
+		flac_put(b, x[0], bps);
+		return;
+	}
+
+	// Low bits that are zero everywhere are only sent once
+	for (i = 0; i < n; i++)
+		bits |= x[i];
+	int wasted = __builtin_ctz(bits);
+	if (wasted) {
+		for (i = 0; i < n; i++)
+			x[i] >>= wasted;
+		bps -= wasted;
+	}
+
+	uint64_t fixed_bits = UINT64_MAX;
+	int order = flac_fixed(x, n, res);
+	if (order >= 0) {
+		flac_rice_plan(res, n, order, &fixed_rice);
+		fixed_bits = fixed_rice.bits + order * bps;
+	}
+
+	uint64_t lpc_bits = UINT64_MAX;
+	if (flac_lpc(x, n, bps, &lpc, lpc_res)) {
+		flac_rice_plan(lpc_res, n, lpc.order, &lpc_rice);
+		lpc_bits = lpc_rice.bits + lpc.order * (bps + FLAC_PRECISION) + 9;
+	}
+
+	// Verbatim whenever the estimate was too optimistic
+	struct flac_bits start = *b;
+	size_t limit = b->pos + ((uint64_t) n * bps + 64) / 8;
+	if (order < 0 && lpc_bits == UINT64_MAX) {
+		flac_verbatim(b, x, n, bps, wasted);
+		return;
+	}
+	if (lpc_bits < fixed_bits) {
+		flac_subframe_header(b, 0x20 | (lpc.order - 1), wasted);
+		for (i = 0; i < lpc.order; i++)
+			flac_put(b, x[i], bps);
+		flac_put(b, FLAC_PRECISION - 1, 4);
+		flac_put(b, lpc.shift, 5);
+		for (i = 0; i < lpc.order; i++)
+			flac_put(b, lpc.coeff[i], FLAC_PRECISION);
+		flac_put_residual(b, lpc_res, n, lpc.order, &lpc_rice);
+	} else {
+		flac_subframe_header(b, 0x08 | order, wasted);
+		for (i = 0; i < order; i++)
+			flac_put(b, x[i], bps);
+		flac_put_residual(b, res, n, order, &fixed_rice);
+	}
+	if (b->pos > limit) {
+		*b = start;
+		flac_verbatim(b, x, n, bps, wasted);
+	}
+}
+
+struct flac_frame {
+	int32_t sample[FLAC_BLOCK];
+	int n;
+	uint number;
+	uint8_t *data;
+	size_t size;
+};
+
+static void flac_encode_frame(struct flac_frame *f)
+{
+	struct flac_bits b = { f->data };
+	int block = f->n == FLAC_BLOCK ? 12 : 7;
+
+	flac_put(&b, 0xfff8, 16);
+	flac_put(&b, block, 4);
+	flac_put(&b, SAMPLES_PER_SEC == 48000 ? 10 : 0, 4);
+	flac_put(&b, 0, 4);
+	flac_put(&b, 7, 3);		// 32 bits, like the raw samples
+	flac_put(&b, 0, 1);
+	flac_put_utf8(&b, f->number);
+	if (block == 7)
+		flac_put(&b, f->n - 1, 16);
+
+	uint8_t crc8 = 0;
+	for (size_t i = 0; i < b.pos; i++)
+		crc8 = flac_crc8_byte(crc8, f->data[i]);
+	flac_put(&b, crc8, 8);
+
+	flac_subframe(&b, f->sample, f->n, FLAC_BPS);
+	flac_align(&b);
+
+	uint16_t crc16 = 0;
+	for (size_t i = 0; i < b.pos; i++)
+		crc16 = flac_crc16_byte(crc16, f->data[i]);
+	flac_put(&b, crc16, 16);
+	f->size = b.pos;
+}
+
+struct flac_encoder;
+
+struct flac_job {
+	struct flac_encoder *e;
+	pthread_t thread;
+	int first, started;
+};
+
+struct flac_encoder {
+	FILE *out;
+	int jobs, per_batch;
+	struct flac_frame *batch[2];
+	int cur, filled, bytes;
+	int running, running_frames;
+	struct flac_job job[FLAC_MAX_JOBS];
+	uint frames;
+	uint64_t total;
+	uint min_frame, max_frame;
+	int error;
+};
+
+static void *flac_job(void *arg)
+{
+	struct flac_job *job = arg;
+	struct flac_encoder *e = job->e;
+	struct flac_frame *batch = e->batch[e->running];
+
+	for (int i = job->first; i < e->running_frames; i += e->jobs)
+		flac_encode_frame(batch + i);
+	return NULL;
+}
+
+// Wait for the batch in flight, and write it out
+static void flac_wait(struct flac_encoder *e)
+{
+	if (e->running < 0)
+		return;
+	for (int j = 0; j < e->jobs && j < e->running_frames; j++) {
+		if (e->job[j].started)
+			pthread_join(e->job[j].thread, NULL);
+	}
+
+	struct flac_frame *batch = e->batch[e->running];
+	for (int i = 0; i < e->running_frames; i++) {
+		struct flac_frame *f = batch + i;
+
+		if (fwrite(f->data, 1, f->size, e->out) != f->size)
+			e->error = 1;
+		if (!e->min_frame || f->size < e->min_frame)
+			e->min_frame = f->size;
+		if (f->size > e->max_frame)
+			e->max_frame = f->size;
+		e->total += f->n;
+	}
+	e->running = -1;
+}
+
+static void flac_submit(struct flac_encoder *e)
+{
+	flac_wait(e);
+	e->running = e->cur;
+	e->running_frames = e->filled;
+	for (int j = 0; j < e->jobs && j < e->filled; j++) {
+		e->job[j].e = e;
+		e->job[j].first = j;
+		e->job[j].started = !pthread_create(&e->job[j].thread, NULL, flac_job, e->job + j);
+
+		// No thread, do it here
+		if (!e->job[j].started)
+			flac_job(e->job + j);
+	}
+	e->cur ^= 1;
+	e->filled = 0;
+}
+
+static void flac_streaminfo(struct flac_encoder *e, uint8_t *buf)
+{
+	struct flac_bits b = { buf };
+
+	flac_put(&b, 0x80, 8);		// last metadata block, STREAMINFO
+	flac_put(&b, 34, 24);
+	flac_put(&b, FLAC_BLOCK, 16);
+	flac_put(&b, FLAC_BLOCK, 16);
+	flac_put(&b, e->min_frame, 24);
+	flac_put(&b, e->max_frame, 24);
+	flac_put(&b, SAMPLES_PER_SEC, 20);
+	flac_put(&b, 0, 3);		// one channel
+	flac_put(&b, FLAC_BPS - 1, 5);
+	flac_put(&b, e->total >> 32, 4);
+	flac_put(&b, e->total, 32);
+	for (int i = 0; i < 4; i++)	// no MD5
+		flac_put(&b, 0, 32);
+}
+
+static ssize_t flac_write(void *cookie, const char *buf, size_t size)
+{
+	struct flac_encoder *e = cookie;
+	size_t done = 0;
+
+	while (done < size) {
+		struct flac_frame *f = e->batch[e->cur] + e->filled;
+		size_t room = FLAC_BLOCK * 4 - e->bytes;
+		size_t n = size - done < room ? size - done : room;
+
+		memcpy((char *) f->sample + e->bytes, buf + done, n);
+		e->bytes += n;
+		done += n;
+		if (e->bytes == FLAC_BLOCK * 4) {
+			f->n = FLAC_BLOCK;
+			f->number = e->frames++;
+			e->bytes = 0;
+			if (++e->filled == e->per_batch)
+				flac_submit(e);
+		}
+	}
+	return e->error ? -1 : size;
+}
+
+// Whatever of the batches got allocated
+static void flac_free(struct flac_encoder *e)
+{
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; e->batch[i] && j < e->per_batch; j++)
+			free(e->batch[i][j].data);
+		free(e->batch[i]);
+	}
+	free(e);
+}
+
+// The last frame can be short. Then STREAMINFO is rewritten with the
+// length and frame sizes, if the output can seek.
+static int flac_close(void *cookie)
+{
+	struct flac_encoder *e = cookie;
+	uint8_t info[38];
+
+	if (e->bytes >= 4) {
+		struct flac_frame *f = e->batch[e->cur] + e->filled++;
+		f->n = e->bytes / 4;
+		f->number = e->frames++;
+	}
+	if (e->filled)
+		flac_submit(e);
+	flac_wait(e);
+
+	flac_streaminfo(e, info);
+	if (!fseeko(e->out, 4, SEEK_SET)) {
+		if (fwrite(info, 1, sizeof(info), e->out) != sizeof(info))
+			e->error = 1;
+		fseeko(e->out, 0, SEEK_END);
+	}
+	if (fflush(e->out))
+		e->error = 1;
+
+	int error = e->error;
+	flac_free(e);
+	return error ? -1 : 0;
+}
+
+static int flac_alloc(struct flac_encoder *e)
+{
+	for (int i = 0; i < 2; i++) {
+		e->batch[i] = calloc(e->per_batch, sizeof(struct flac_frame));
+		if (!e->batch[i])
+			return -1;
+		for (int j = 0; j < e->per_batch; j++) {
+			e->batch[i][j].data = malloc(FLAC_BLOCK * 8 + 64);
+			if (!e->batch[i][j].data)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static FILE *flac_output(FILE *out, int jobs)
+{
+	struct flac_encoder *e = calloc(1, sizeof(*e));
+	uint8_t header[42];
+	FILE *file = NULL;
+
+	if (!e)
+		return NULL;
+	e->out = out;
+	e->jobs = jobs < 1 ? 1 : jobs > FLAC_MAX_JOBS ? FLAC_MAX_JOBS : jobs;
+	e->per_batch = e->jobs * FLAC_BATCH;
+	e->running = -1;
+
+	memcpy(header, "fLaC", 4);
+	flac_streaminfo(e, header + 4);
+	if (flac_alloc(e) || fwrite(header, 1, sizeof(header), out) != sizeof(header) ||
+	    !(file = fopencookie(e, "w", (cookie_io_functions_t) {
+			.write = flac_write, .close = flac_close }))) {
+		flac_free(e);
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, 1 << 16);
+	return file;
+}
+
+//
+// Decoder
+//
+struct flac_reader {
+	FILE *in;
+	uint64_t acc;
+	int bits, eof;
+	uint8_t crc8;
+	uint16_t crc16;
+};
+
+// Bytes are only pulled in when they're needed, so at any byte
+// boundary the CRCs cover exactly what's been read
+static inline void flac_byte(struct flac_reader *r)
+{
+	int c = getc_unlocked(r->in);
+
+	if (c == EOF) {
+		r->eof = 1;
+		c = 0;
+	}
+	r->crc8 = flac_crc8_byte(r->crc8, c);
+	r->crc16 = flac_crc16_byte(r->crc16, c);
+	r->acc = (r->acc << 8) | c;
+	r->bits += 8;
+}
+
+static inline uint32_t flac_get(struct flac_reader *r, int n)
+{
+	if (!n)
+		return 0;
+	while (r->bits < n)
+		flac_byte(r);
+	r->bits -= n;
+	return (r->acc >> r->bits) & (0xffffffffu >> (32 - n));
+}
+
+static inline int64_t flac_get_signed(struct flac_reader *r, int n)
+{
+	uint64_t v;
+
+	if (!n)
+		return 0;
+	if (n > 32) {
+		v = (uint64_t) flac_get(r, n - 32) << 32;
+		v |= flac_get(r, 32);
+	} else {
+		v = flac_get(r, n);
+	}
+	return (int64_t) (v << (64 - n)) >> (64 - n);
+}
+
+static inline uint32_t flac_unary(struct flac_reader *r)
+{
+	uint32_t q = 0;
+
+	for (;;) {
+		if (!r->bits)
+			flac_byte(r);
+		// A truncated stream would otherwise be zeros forever
+		if (r->eof)
+			return q;
+		uint32_t left = r->acc & ((1u << r->bits) - 1);
+		if (left) {
+			int top = 31 - __builtin_clz(left);
+			q += r->bits - 1 - top;
+			r->bits = top;
+			return q;
+		}
+		q += r->bits;
+		r->bits = 0;
+	}
+}
+
+struct flac_decoder {
+	struct flac_reader r;
+	int channels, bps, rate;
+	int64_t *ch[FLAC_MAX_CHANNELS];
+	s32 *out;
+	int frame_bytes, pos;
+	uint frames, bad;
+	char pending[4];
+	int pending_len;
+};
+
+static int flac_residual(struct flac_reader *r, int64_t *res, int n, int pred)
+{
+	int method = flac_get(r, 2);
+	int order = flac_get(r, 4);
+	int parts = 1 << order, size = n >> order;
+
+	if (method > 1 || (size << order) != n || size < pred)
+		return -1;
+	int escape = method ? 31 : 15;
+	for (int p = 0; p < parts; p++) {
+		int k = flac_get(r, method ? 5 : 4);
+		int i = p ? p * size : pred, end = (p + 1) * size;
+
+		if (k == escape) {
+			int raw = flac_get(r, 5);
+			for (; i < end; i++)
+				res[i] = flac_get_signed(r, raw);
+			continue;
+		}
+		for (; i < end; i++) {
+			uint64_t u = ((uint64_t) flac_unary(r) << k) | flac_get(r, k);
+			res[i] = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+		}
+	}
+	return r->eof ? -1 : 0;
+}
+
+static int flac_decode_subframe(struct flac_reader *r, int64_t *x, int n, int bps)
+{
+	int i, type;
+
+	flac_get(r, 1);
+	type = flac_get(r, 6);
+	int wasted = flac_get(r, 1) ? flac_unary(r) + 1 : 0;
+	bps -= wasted;
+	if (bps <= 0)
+		return -1;
+
+	if (type == 0) {
+		int64_t v = flac_get_signed(r, bps);
+		for (i = 0; i < n; i++)
+			x[i] = v;
+	} else if (type == 1) {
+		for (i = 0; i < n; i++)
+			x[i] = flac_get_signed(r, bps);
+	} else if (type >= 8 && type <= 12) {
+		int order = type - 8;
+
+		if (order > n)
+			return -1;
+		for (i = 0; i < order; i++)
+			x[i] = flac_get_signed(r, bps);
+		if (flac_residual(r, x, n, order))
+			return -1;
+		for (i = order; i < n; i++) {
+			switch (order) {
+			case 1: x[i] += x[i-1]; break;
+			case 2: x[i] += 2*x[i-1] - x[i-2]; break;
+			case 3: x[i] += 3*x[i-1] - 3*x[i-2] + x[i-3]; break;
+			case 4: x[i] += 4*x[i-1] - 6*x[i-2] + 4*x[i-3] - x[i-4]; break;
+			}
+		}
+	} else if (type >= 32) {
+		int order = (type & 31) + 1;
+		int64_t coeff[32];
+
+		if (order > n)
+			return -1;
+		for (i = 0; i < order; i++)
+			x[i] = flac_get_signed(r, bps);
+		int precision = flac_get(r, 4) + 1;
+		int shift = flac_get_signed(r, 5);
+		if (precision == 16 || shift < 0)
+			return -1;
+		for (i = 0; i < order; i++)
+			coeff[i] = flac_get_signed(r, precision);
+		if (flac_residual(r, x, n, order))
+			return -1;
+		for (i = order; i < n; i++) {
+			int64_t sum = 0;
+			for (int j = 0; j < order; j++)
+				sum += coeff[j] * x[i-1-j];
+			x[i] += sum >> shift;
+		}
+	} else {
+		return -1;
+	}
+
+	if (wasted) {
+		for (i = 0; i < n; i++)
+			x[i] = (uint64_t) x[i] << wasted;
+	}
+	return r->eof ? -1 : 0;
+}
+
+// Returns the number of samples, 0 at the end, -1 on errors
+static int flac_decode_frame(struct flac_decoder *d)
+{
+	static const int sizes[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+	struct flac_reader *r = &d->r;
+	int n, bps, assignment, channels;
+
+	r->crc8 = 0;
+	r->crc16 = 0;
+	uint32_t sync = flac_get(r, 15);
+	if (r->eof)
+		return 0;
+	if (sync != 0x7ffc)
+		return -1;
+	flac_get(r, 1);
+
+	int block = flac_get(r, 4);
+	int rate = flac_get(r, 4);
+	assignment = flac_get(r, 4);
+	bps = sizes[flac_get(r, 3)];
+	flac_get(r, 1);
+	if (!bps)
+		bps = d->bps;
+
+	// Frame or sample number, UTF-8 style
+	uint32_t c = flac_get(r, 8);
+	for (uint32_t mask = 0x40; (c & 0x80) && (c & mask); mask >>= 1)
+		flac_get(r, 8);
+
+	if (block == 1)
+		n = 192;
+	else if (block >= 2 && block <= 5)
+		n = 576 << (block - 2);
+	else if (block == 6)
+		n = flac_get(r, 8) + 1;
+	else if (block == 7)
+		n = flac_get(r, 16) + 1;
+	else if (block >= 8)
+		n = 256 << (block - 8);
+	else
+		return -1;
+
+	if (rate == 12)
+		flac_get(r, 8);
+	else if (rate == 13 || rate == 14)
+		flac_get(r, 16);
+
+	uint8_t crc8 = r->crc8;
+	if (flac_get(r, 8) != crc8 || !bps || n > FLAC_MAX_BLOCK)
+		return -1;
+
+	channels = assignment < 8 ? assignment + 1 : 2;
+	if (assignment > 10)
+		return -1;
+	for (int ch = 0; ch < channels; ch++) {
+		// The side channel has an extra bit
+		int side = (assignment == 8 && ch == 1) || (assignment == 9 && ch == 0) ||
+			   (assignment == 10 && ch == 1);
+		if (flac_decode_subframe(r, d->ch[ch], n, bps + side))
+			return -1;
+	}
+	if (r->bits & 7)
+		flac_get(r, r->bits & 7);
+
+	uint16_t crc16 = r->crc16;
+	if (flac_get(r, 16) != crc16 && !d->bad++)
+		fprintf(stderr, "flac: CRC error in frame %u\n", d->frames);
+	d->frames++;
+
+	int64_t *a = d->ch[0], *b = d->ch[1];
+	for (int i = 0; i < n; i++) {
+		switch (assignment) {
+		case 8: b[i] = a[i] - b[i]; break;
+		case 9: a[i] += b[i]; break;
+		case 10: {
+			int64_t mid = ((uint64_t) a[i] << 1) | (b[i] & 1);
+			a[i] = (mid + b[i]) >> 1;
+			b[i] = (mid - b[i]) >> 1;
+			break;
+		}
+		}
+	}
+
+	// Mix down, and scale to the full 32 bits
+	for (int i = 0; i < n; i++) {
+		int64_t sum = 0;
+		for (int ch = 0; ch < channels; ch++)
+			sum += d->ch[ch][i];
+		sum = sum * ((int64_t) 1 << (32 - bps)) / channels;
+		d->out[i] = sum > INT32_MAX ? INT32_MAX : sum < INT32_MIN ? INT32_MIN : sum;
+	}
+	return n;
+}
+
+static ssize_t flac_read(void *cookie, char *buf, size_t size)
+{
+	struct flac_decoder *d = cookie;
+	size_t done = 0;
+
+	while (done < size) {
+		if (d->pos == d->frame_bytes) {
+			int n = flac_decode_frame(d);
+			if (n <= 0) {
+				// No way to resync, that's the end
+				if (n < 0)
+					fprintf(stderr, "flac: bad frame %u\n", d->frames);
+				d->r.eof = 1;
+				break;
+			}
+			d->frame_bytes = n * 4;
+			d->pos = 0;
+		}
+		size_t n = d->frame_bytes - d->pos;
+		if (n > size - done)
+			n = size - done;
+		memcpy(buf + done, (char *) d->out + d->pos, n);
+		d->pos += n;
+		done += n;
+	}
+	return done;
+}
+
+// Not FLAC: whatever was peeked at goes first
+static ssize_t flac_raw_read(void *cookie, char *buf, size_t size)
+{
+	struct flac_decoder *d = cookie;
+	size_t done = 0;
+
+	while (d->pos < d->pending_len && done < size)
+		buf[done++] = d->pending[d->pos++];
+	return done + fread(buf + done, 1, size - done, d->r.in);
+}
+
+static int flac_input_close(void *cookie)
+{
+	struct flac_decoder *d = cookie;
+
+	for (int ch = 0; ch < FLAC_MAX_CHANNELS; ch++)
+		free(d->ch[ch]);
+	free(d->out);
+	free(d);
+	return 0;
+}
+
+static int flac_metadata(struct flac_decoder *d)
+{
+	struct flac_reader *r = &d->r;
+	int last;
+
+	do {
+		last = flac_get(r, 1);
+		int type = flac_get(r, 7);
+		uint32_t len = flac_get(r, 24);
+
+		if (type == 0 && len >= 34) {
+			flac_get(r, 32);	// block sizes
+			flac_get(r, 32); flac_get(r, 16);	// frame sizes
+			d->rate = flac_get(r, 20);
+			d->channels = flac_get(r, 3) + 1;
+			d->bps = flac_get(r, 5) + 1;
+			flac_get(r, 4); flac_get(r, 32);	// length
+			len -= 18;
+		}
+		while (len--)
+			flac_get(r, 8);
+	} while (!last && !r->eof);
+	return r->eof ? -1 : 0;
+}
+
+static inline FILE *flac_input(FILE *in)
+{
+	struct flac_decoder *d = calloc(1, sizeof(*d));
+	cookie_io_functions_t io = { .read = flac_read, .close = flac_input_close };
+
+	if (!d)
+		return NULL;
+	d->r.in = in;
+	d->pending_len = fread(d->pending, 1, 4, in);
+	if (d->pending_len < 4 || memcmp(d->pending, "fLaC", 4)) {
+		io.read = flac_raw_read;
+		return fopencookie(d, "r", io);
+	}
+
+	for (int ch = 0; ch < FLAC_MAX_CHANNELS; ch++)
+		d->ch[ch] = malloc(FLAC_MAX_BLOCK * sizeof(int64_t));
+	d->out = malloc(FLAC_MAX_BLOCK * sizeof(s32));
+	if (!d->ch[FLAC_MAX_CHANNELS-1] || !d->out || flac_metadata(d)) {
+		flac_input_close(d);
+		return NULL;
+	}
+	if (d->rate && d->rate != SAMPLES_PER_SEC)
+		fprintf(stderr, "flac: %d Hz input, processed as %g Hz\n", d->rate, SAMPLES_PER_SEC);
+	return fopencookie(d, "r", io);
+}
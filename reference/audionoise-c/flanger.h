@@ -1,10 +1,20 @@
 // Flanger effect based on the MIT-licensed DaisySP library by Electrosmith
 // which in turn seems to be based on Soundpipe by Paul Batchelor
 
+// The LFO swings the delay up to twice the pot setting
+#define FLANGER_MAX_MS 4
+#define FLANGER_DELAY (2 * (int) (FLANGER_MAX_MS * SAMPLES_PER_MSEC) + 2)
+
+#if !defined(EMBEDDED) || WITH_FLANGER
+_Static_assert(FLANGER_DELAY <= SAMPLE_ARRAY_SIZE, "sample_array is too small for the flanger");
+#endif
+EFFECT_MEMORY(flanger, 0, 0, FLANGER_DELAY, 0);
+EFFECT_STATE(flanger);
+
 static inline void flanger_init(float pot1, float pot2, float pot3, float pot4)
 {
 	effect_set_lfo(pot1*pot1*10);	// lfo = 0 .. 10Hz
-	effect_set_delay(pot2 * 4);	// delay = 0 .. 4 ms
+	effect_set_delay(pot2 * FLANGER_MAX_MS);	// delay = 0 .. 4 ms
 	effect_set_depth(pot3);		// depth = 0 .. 100%
 	effect_set_feedback(pot4);	// feedback = 0 .. 100%
 
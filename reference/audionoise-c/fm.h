@@ -6,6 +6,10 @@
 static struct lfo_state base_lfo, modulator_lfo;
 static float fm_volume, fm_base_freq, fm_freq_range;
 
+EFFECT_MEMORY(fm, sizeof(base_lfo) + sizeof(modulator_lfo) + 3 * sizeof(float), 0, 0, 0);
+EFFECT_STATE(fm, REGION(base_lfo), REGION(modulator_lfo), REGION(fm_volume),
+	     REGION(fm_base_freq), REGION(fm_freq_range));
+
 static inline void fm_init(float pot1, float pot2, float pot3, float pot4)
 {
 	fm_volume = pot1;
@@ -0,0 +1,130 @@
+//
+// Test signal generators for 'convert -g'
+//
+// Each one fills a whole block at a time, and they all start from
+// fixed seeds and phases, so every run produces exactly the same
+// samples. 'length' is the total number of samples, which the
+// sweep uses to span the whole run. Peaks are at about GEN_LEVEL.
+//
+//  sweep:     exponential sine sweep, 20Hz .. 20kHz
+//  white:     white noise
+//  pink:      pink noise (Paul Kellet's filter)
+//  impulse:   an impulse at the start of every second
+//  multitone: 31 sines on the third-octave centers, random phases
+//  bursts:    100ms white noise bursts, one every second
+//
+#define GEN_LEVEL 0.5f
+#define GEN_LOW 20.0
+#define GEN_HIGH 20000.0
+#define GEN_TONES 31
+
+static struct {
+	uint sample, length, seed;
+	struct lfo_state lfo;
+	double sweep_step, sweep_mult;
+	float pink[7];
+	struct osc_bank bank;
+} gen;
+
+static inline float gen_white_sample(void)
+{
+	return (int)xorshift32(&gen.seed) * (1.0f / 0x80000000);
+}
+
+static void gen_init(uint length)
+{
+	memset(&gen, 0, sizeof(gen));
+	gen.length = length;
+	gen.seed = 1;
+
+	gen.sweep_step = GEN_LOW * F_STEP;
+	gen.sweep_mult = pow(GEN_HIGH / GEN_LOW, 1.0 / (length ? length : 1));
+
+	_osc_bank_init(&gen.bank);
+	for (int i = 0; i < GEN_TONES; i++) {
+		_osc_bank_voice(&gen.bank, i, GEN_LOW * pow(2, i / 3.0), GEN_LEVEL / 2 / sqrtf(GEN_TONES));
+		gen.bank.phase[i / VEC_WIDTH][i % VEC_WIDTH] = xorshift32(&gen.seed);
+	}
+}
+
+static void gen_sweep(float *out, int n)
+{
+	for (int i = 0; i < n; i++) {
+		gen.lfo.step = (uint) gen.sweep_step;
+		gen.sweep_step *= gen.sweep_mult;
+		out[i] = lfo_step(&gen.lfo, lfo_sinewave) * GEN_LEVEL;
+	}
+}
+
+static void gen_white(float *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = gen_white_sample() * GEN_LEVEL;
+}
+
+static void gen_pink(float *out, int n)
+{
+	float *b = gen.pink;
+
+	for (int i = 0; i < n; i++) {
+		float white = gen_white_sample();
+
+		b[0] = 0.99886f * b[0] + white * 0.0555179f;
+		b[1] = 0.99332f * b[1] + white * 0.0750759f;
+		b[2] = 0.96900f * b[2] + white * 0.1538520f;
+		b[3] = 0.86650f * b[3] + white * 0.3104856f;
+		b[4] = 0.55000f * b[4] + white * 0.5329522f;
+		b[5] = -0.7616f * b[5] - white * 0.0168980f;
+		float pink = b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + white * 0.5362f;
+		b[6] = white * 0.115926f;
+
+		// The filter has a gain of about 8 at its peak
+		out[i] = pink * (GEN_LEVEL / 8);
+	}
+}
+
+static void gen_impulse(float *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = (gen.sample + i) % (uint)SAMPLES_PER_SEC ? 0 : GEN_LEVEL;
+}
+
+static void gen_multitone(float *out, int n)
+{
+	memset(out, 0, n * sizeof(float));
+	_osc_bank_render(&gen.bank, out, n);
+}
+
+static void gen_bursts(float *out, int n)
+{
+	const uint on = SAMPLES_PER_SEC / 10;
+
+	for (int i = 0; i < n; i++) {
+		float white = gen_white_sample() * GEN_LEVEL;
+		out[i] = (gen.sample + i) % (uint)SAMPLES_PER_SEC < on ? white : 0;
+	}
+}
+
+#define GEN(x) { #x, gen_##x }
+static const struct generator {
+	const char *name;
+	void (*block)(float *out, int n);
+} generators[] = {
+	GEN(sweep), GEN(white), GEN(pink), GEN(impulse),
+	GEN(multitone), GEN(bursts),
+};
+
+static inline const struct generator *gen_find(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(generators); i++) {
+		if (!strcmp(name, generators[i].name))
+			return generators+i;
+	}
+	return NULL;
+}
+
+static void gen_block(const struct generator *g, float *out, int n)
+{
+	g->block(out, n);
+	gen.sample += n;
+}
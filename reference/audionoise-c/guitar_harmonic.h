@@ -12,7 +12,7 @@
 //   Path C: Odd harmonics (hard clip, LPF 1.5-2.5 kHz)
 //
 
-struct {
+static struct {
 	// Path A - Fundamental / Dry
 	struct biquad fund_hpf;
 	float fund_level;
@@ -27,9 +27,19 @@ struct {
 
 	// Output
 	float output_level;
+
+	// Optional pitch tracking of the even/odd filters
+	struct harmonic_tracker track;
 } guitar_harmonic;
 
-void guitar_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+EFFECT_MEMORY(guitar_harmonic, sizeof(guitar_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_MEMORY(guitar_harmonic_track, sizeof(guitar_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_STATE(guitar_harmonic, REGION(guitar_harmonic));
+EFFECT_STATE(guitar_harmonic_track, REGION(guitar_harmonic));
+
+// A pot change only sets the levels, which leaves a tracker
+// alone
+static void guitar_harmonic_update(float pot1, float pot2, float pot3, float pot4)
 {
 	// pot1: Dry/Fundamental level
 	// pot2: Even harmonics (warmth)
@@ -41,6 +51,15 @@ void guitar_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	guitar_harmonic.odd_level = pot3 * pot3;   // Log response
 	guitar_harmonic.output_level = 0.5f + pot4 * 0.5f;
 
+	fprintf(stderr, "guitar_harmonic:");
+	fprintf(stderr, " dry=%.2f", guitar_harmonic.fund_level);
+	fprintf(stderr, " even=%.2f", guitar_harmonic.even_level);
+	fprintf(stderr, " odd=%.2f", guitar_harmonic.odd_level);
+	fprintf(stderr, " out=%.2f\n", guitar_harmonic.output_level);
+}
+
+static void guitar_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+{
 	// Path A: 1st-order HPF at 80 Hz
 	biquad_hpf(&guitar_harmonic.fund_hpf, 80.0f, 0.707f);
 
@@ -52,17 +71,17 @@ void guitar_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	// Path C: 2nd-order LPF at 2 kHz (center of 1.5-2.5)
 	biquad_lpf(&guitar_harmonic.odd_lpf, 2000.0f, 0.707f);
 
-	fprintf(stderr, "guitar_harmonic:");
-	fprintf(stderr, " dry=%.2f", guitar_harmonic.fund_level);
-	fprintf(stderr, " even=%.2f", guitar_harmonic.even_level);
-	fprintf(stderr, " odd=%.2f", guitar_harmonic.odd_level);
-	fprintf(stderr, " out=%.2f\n", guitar_harmonic.output_level);
+	guitar_harmonic.track.enabled = 0;
+	guitar_harmonic_update(pot1, pot2, pot3, pot4);
 }
 
-float guitar_harmonic_step(float in)
+static float guitar_harmonic_step(float in)
 {
 	float path_a, path_b, path_c;
 
+	if (guitar_harmonic.track.enabled)
+		harmonic_track_step(&guitar_harmonic.track, in);
+
 	// Path A: Fundamental - preserve transient snap and chord clarity
 	path_a = biquad_step(&guitar_harmonic.fund_hpf, in);
 	path_a *= guitar_harmonic.fund_level;
@@ -86,3 +105,20 @@ float guitar_harmonic_step(float in)
 
 	return limit_value(out);
 }
+
+// Tracking mode: the even/odd filter corners follow the played
+// fundamental, keeping their ratio to the nominal 250 Hz
+static void guitar_harmonic_track_init(float pot1, float pot2, float pot3, float pot4)
+{
+	struct harmonic_tracker *t = &guitar_harmonic.track;
+
+	guitar_harmonic_init(pot1, pot2, pot3, pot4);
+
+	harmonic_track_init(t, 250.0f, 70.0f, 1200.0f);
+	harmonic_track_filter(t, &guitar_harmonic.even_lpf[0], 650.0f, 0.707f);
+	harmonic_track_filter(t, &guitar_harmonic.even_lpf[1], 650.0f, 0.707f);
+	harmonic_track_filter(t, &guitar_harmonic.odd_lpf, 2000.0f, 0.707f);
+
+	fprintf(stderr, "guitar_harmonic: tracking 70-1200 Hz\n");
+}
+#define guitar_harmonic_track_step guitar_harmonic_step
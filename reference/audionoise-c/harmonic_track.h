@@ -0,0 +1,114 @@
+//
+// Pitch tracking for the harmonic enhancers
+//
+// The enhancers pick their even/odd path filter corners for one
+// nominal fundamental. In tracking mode those corners instead keep
+// the same ratio to the fundamental the pitch detector hears, so
+// the harmonic emphasis stays put as you move up the neck.
+//
+// Filters are only redesigned at control rate (every
+// HARMONIC_CONTROL samples). In between, the coefficients ramp
+// linearly towards the new design, which costs five adds per
+// filter per sample and avoids zipper noise.
+//
+// The tracked filters are all lowpasses, and each one is found by
+// its offset from the tracker (both live in the effect's state),
+// so the state holds no addresses and a session snapshot of it
+// (snapshot.h) is good in any process.
+//
+#define HARMONIC_CONTROL 32
+#define HARMONIC_MAX_FILTERS 4
+#define HARMONIC_MIN_CONFIDENCE 0.8f
+
+struct harmonic_filter {
+	long offset;
+	float ratio, Q;
+	struct biquad_coeff delta;
+};
+
+struct harmonic_tracker {
+	struct pitch_detector pd;
+	struct harmonic_filter filter[HARMONIC_MAX_FILTERS];
+	int nr, enabled, count;
+	float nominal, min_f0, max_f0;
+	float f0, target_f0;
+};
+
+static void harmonic_track_init(struct harmonic_tracker *ht, float nominal, float min_f0, float max_f0)
+{
+	pitch_detector_init(&ht->pd, 0.15f);
+	ht->nr = 0;
+	ht->count = 0;
+	ht->nominal = ht->f0 = ht->target_f0 = nominal;
+	ht->min_f0 = min_f0;
+	ht->max_f0 = max_f0;
+	ht->enabled = 1;
+}
+
+static inline struct biquad_coeff *harmonic_track_coeff(struct harmonic_tracker *ht,
+							struct harmonic_filter *hf)
+{
+	return &((struct biquad *) ((char *) ht + hf->offset))->coeff;
+}
+
+// 'corner' is where the filter sits for the nominal fundamental
+static void harmonic_track_filter(struct harmonic_tracker *ht, struct biquad *bq,
+				  float corner, float Q)
+{
+	struct harmonic_filter *hf = ht->filter + ht->nr++;
+
+	hf->offset = (char *) bq - (char *) ht;
+	hf->ratio = corner / ht->nominal;
+	hf->Q = Q;
+	memset(&hf->delta, 0, sizeof(hf->delta));
+}
+
+static void harmonic_track_retune(struct harmonic_tracker *ht)
+{
+	const float scale = 1.0f / HARMONIC_CONTROL;
+
+	// Glide a third of the way there every control period
+	ht->f0 += (ht->target_f0 - ht->f0) * 0.3f;
+
+	for (int i = 0; i < ht->nr; i++) {
+		struct harmonic_filter *hf = ht->filter + i;
+		struct biquad_coeff *c = harmonic_track_coeff(ht, hf), next;
+		float f = hf->ratio * ht->f0;
+
+		if (f > 0.4f * SAMPLES_PER_SEC)
+			f = 0.4f * SAMPLES_PER_SEC;
+		_biquad_lpf(&next, f, hf->Q);
+
+		hf->delta.b0 = (next.b0 - c->b0) * scale;
+		hf->delta.b1 = (next.b1 - c->b1) * scale;
+		hf->delta.b2 = (next.b2 - c->b2) * scale;
+		hf->delta.a1 = (next.a1 - c->a1) * scale;
+		hf->delta.a2 = (next.a2 - c->a2) * scale;
+	}
+}
+
+static inline void harmonic_track_step(struct harmonic_tracker *ht, float in)
+{
+	if (pitch_detector_step(&ht->pd, in)) {
+		float f = ht->pd.freq;
+		if (ht->pd.confidence > HARMONIC_MIN_CONFIDENCE &&
+		    f >= ht->min_f0 && f <= ht->max_f0)
+			ht->target_f0 = f;
+	}
+
+	for (int i = 0; i < ht->nr; i++) {
+		struct harmonic_filter *hf = ht->filter + i;
+		struct biquad_coeff *c = harmonic_track_coeff(ht, hf);
+
+		c->b0 += hf->delta.b0;
+		c->b1 += hf->delta.b1;
+		c->b2 += hf->delta.b2;
+		c->a1 += hf->delta.a1;
+		c->a2 += hf->delta.a2;
+	}
+
+	if (++ht->count < HARMONIC_CONTROL)
+		return;
+	ht->count = 0;
+	harmonic_track_retune(ht);
+}
@@ -0,0 +1,472 @@
+//
+// Click-free effect chain hot-swap for 'convert -w swaps.txt'
+//
+// A swap file has one "seconds effect p1 p2 p3 p4 [effect p1 p2 p3 p4
+// ...]" line per change, in time order, and at each one the running
+// chain is replaced by the new one, with an equal-power crossfade
+// over one block. The audio thread never allocates, locks, or runs
+// an init for it. An effect can only be in a chain once, and only
+// one of them can use effect.h's shared delay (see effects_clash()).
+//
+// All the effect state is global (see search.c and snapshot.h), so
+// two chains can't simply sit side by side in one address space. A
+// chain "instance" is instead an image of just its state: effect.h's
+// shared globals (snapshot_shared) and each of its effects'
+// EFFECT_STATE() regions, one after the other. They're made by a
+// builder process, forked once at startup: on request from the
+// control thread it initializes the new chain, warms it up on the
+// last HOTSWAP_WARM input samples, and copies those regions into a
+// preallocated shared image. That's all off the audio thread, and
+// nothing the builder does can touch the live state. (Forking for
+// every chain would be simpler, but every fork makes the live pages
+// copy-on-write again, and the audio thread would pay for that.)
+//
+// Chains come from a small pool, with their images mapped once at
+// startup. A ready chain is published with an atomic pointer store.
+// At a block boundary the audio thread exchanges it out, runs the old
+// chain over the block, copies the new image back into the regions,
+// runs the new chain over the same block and fades between the two.
+// The old chain goes on a single-producer ring of retired chains,
+// and the control thread returns it to the pool later.
+//
+// Nothing else is in the copy, so the host's globals and libc's are
+// left alone, and other threads can go on using them while it
+// happens. The one table an init builds outside its state, fft.h's,
+// is built at startup instead.
+//
+// Include after effects.h and snapshot.h. Needs <stdatomic.h>,
+// <pthread.h>, <sys/mman.h> and <sys/wait.h>.
+//
+#define HOTSWAP_BLOCK 256	// the most a host's block can be
+#define HOTSWAP_CHAIN 4
+#define HOTSWAP_REGIONS 32
+#define HOTSWAP_POOL 3
+#define HOTSWAP_WARM 4096
+#define MAX_SWAPS 256
+
+struct hotswap_chain {
+	int nr, ok;
+	uint at;
+	struct effect *effect[HOTSWAP_CHAIN];
+	float pot[HOTSWAP_CHAIN][4];
+
+	// What goes in the image, in order
+	const struct effect_region *region[HOTSWAP_REGIONS];
+	int nr_regions;
+	size_t size;
+	char *image;
+};
+
+// What the builder needs to see of the audio thread
+struct hotswap_shared {
+	atomic_uint history_pos;
+	float history[HOTSWAP_WARM];
+};
+
+struct hotswap {
+	// The schedule, read-only once the control thread runs
+	int nr_swaps;
+	struct hotswap_chain swap[MAX_SWAPS];
+	float fade_out[HOTSWAP_BLOCK], fade_in[HOTSWAP_BLOCK];
+
+	// The pool, and which of it the control thread has handed out
+	struct hotswap_chain pool[HOTSWAP_POOL];
+	int in_use[HOTSWAP_POOL];
+
+	// Control thread to audio thread, and back again
+	_Atomic(struct hotswap_chain *) pending;
+	struct hotswap_chain *retired[HOTSWAP_POOL];
+	atomic_uint retired_head, retired_tail;
+	atomic_int stop;
+
+	// Audio thread only
+	struct hotswap_chain *current;
+	int next, swaps;
+	float old[HOTSWAP_BLOCK];
+	double worst;
+
+	struct hotswap_shared *shared;
+	pthread_t control;
+	pid_t builder;
+	int request, reply;
+};
+
+static double hotswap_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The shared globals, then each effect's regions
+static int hotswap_layout(struct hotswap_chain *c)
+{
+	c->nr_regions = 0;
+	for (int i = 0; i < ARRAY_SIZE(snapshot_shared); i++)
+		c->region[c->nr_regions++] = snapshot_shared + i;
+	for (int e = 0; e < c->nr; e++) {
+		for (int i = 0; i < c->effect[e]->nr_state; i++) {
+			if (c->nr_regions == HOTSWAP_REGIONS)
+				return -1;
+			c->region[c->nr_regions++] = c->effect[e]->state + i;
+		}
+	}
+	c->size = 0;
+	for (int i = 0; i < c->nr_regions; i++)
+		c->size += c->region[i]->size;
+	return 0;
+}
+
+// Parses "seconds effect p1 p2 p3 p4 [effect p1 p2 p3 p4 ...]"
+static int hotswap_parse(char *line, struct hotswap_chain *c)
+{
+	char *tok = strtok(line, " \t\n");
+
+	if (!tok)
+		return -1;
+	c->at = atof(tok) * SAMPLES_PER_SEC;
+	c->nr = 0;
+	while ((tok = strtok(NULL, " \t\n")) != NULL) {
+		struct effect *eff = find_effect(tok);
+
+		if (!eff || c->nr == HOTSWAP_CHAIN)
+			return -1;
+		for (int e = 0; e < c->nr; e++) {
+			if (effects_clash(c->effect[e], eff)) {
+				fprintf(stderr, "hotswap: %s and %s can't share a chain\n",
+					c->effect[e]->name, eff->name);
+				return -1;
+			}
+		}
+		c->effect[c->nr] = eff;
+		for (int i = 0; i < 4; i++) {
+			tok = strtok(NULL, " \t\n");
+			if (!tok)
+				return -1;
+			c->pot[c->nr][i] = atof(tok);
+		}
+		c->nr++;
+	}
+	return c->nr ? hotswap_layout(c) : -1;
+}
+
+// Only blank lines and comments are skipped: a swap that can't be
+// done fails the whole file
+static int read_swaps(const char *name, struct hotswap *hs)
+{
+	FILE *file = fopen(name, "r");
+	char line[256];
+	int nr = 0;
+
+	if (!file) {
+		perror(name);
+		return -1;
+	}
+	hs->nr_swaps = 0;
+	while (fgets(line, sizeof(line), file)) {
+		struct hotswap_chain *c = hs->swap + hs->nr_swaps;
+		const char *p = line + strspn(line, " \t\n");
+		const char *error = NULL;
+
+		nr++;
+		if (!*p || *p == '#')
+			continue;
+		if (hs->nr_swaps == MAX_SWAPS)
+			error = "too many swaps";
+		else if (hotswap_parse(line, c))
+			error = "bad swap";
+		else if (hs->nr_swaps && c->at < c[-1].at)
+			error = "swaps out of order";
+		if (error) {
+			fprintf(stderr, "%s:%d: %s\n", name, nr, error);
+			fclose(file);
+			return -1;
+		}
+		hs->nr_swaps++;
+	}
+	fclose(file);
+	return 0;
+}
+
+static struct hotswap *hotswap_alloc(void)
+{
+	struct hotswap *hs = calloc(1, sizeof(*hs));
+
+	if (!hs)
+		return NULL;
+	// cos/sin over the block: the powers always add up to one
+	for (int i = 0; i < HOTSWAP_BLOCK; i++) {
+		float t = (i + 0.5f) / HOTSWAP_BLOCK * (M_PI / 2);
+		hs->fade_out[i] = cosf(t);
+		hs->fade_in[i] = sinf(t);
+	}
+	return hs;
+}
+
+// Runs in the builder, on its own copy of everything
+static void hotswap_build(struct hotswap *hs, const struct hotswap_chain *c, char *image)
+{
+	uint pos = atomic_load(&hs->shared->history_pos);
+
+	for (int e = 0; e < c->nr; e++) {
+		const float *p = c->pot[e];
+		c->effect[e]->init(p[0], p[1], p[2], p[3]);
+	}
+	for (int i = 0; i < HOTSWAP_WARM; i++) {
+		float x = hs->shared->history[(pos + i) % HOTSWAP_WARM];
+
+		UPDATE(effect_delay);
+		for (int e = 0; e < c->nr; e++)
+			x = c->effect[e]->step(x);
+	}
+	// Whatever the warm-up found isn't in the output
+	effect_event_tail = effect_event_head;
+	for (int i = 0; i < c->nr_regions; i++) {
+		memcpy(image, c->region[i]->p, c->region[i]->size);
+		image += c->region[i]->size;
+	}
+}
+
+// Requests are a schedule entry and a pool slot to build it in
+static void hotswap_builder(struct hotswap *hs, int request, int reply)
+{
+	int msg[2];
+	char done = 1;
+
+	while (read(request, msg, sizeof(msg)) == sizeof(msg)) {
+		hotswap_build(hs, hs->swap + msg[0], hs->pool[msg[1]].image);
+		if (write(reply, &done, 1) != 1)
+			break;
+	}
+	_exit(0);
+}
+
+static void hotswap_prepare(struct hotswap *hs, struct hotswap_chain *c, int nr)
+{
+	double start = hotswap_now();
+	int msg[2] = { nr, c - hs->pool };
+	char done;
+
+	c->ok = write(hs->request, msg, sizeof(msg)) == sizeof(msg) &&
+		read(hs->reply, &done, 1) == 1;
+
+	fprintf(stderr, "hotswap: chain for %.3f s %s in %.1f ms\n",
+		c->at / SAMPLES_PER_SEC, c->ok ? "ready" : "failed",
+		(hotswap_now() - start) * 1e3);
+}
+
+// A free chain from the pool, taking back whatever the audio thread
+// has retired
+static struct hotswap_chain *hotswap_slot(struct hotswap *hs)
+{
+	while (!atomic_load(&hs->stop)) {
+		uint tail = atomic_load_explicit(&hs->retired_tail, memory_order_relaxed);
+
+		while (tail != atomic_load_explicit(&hs->retired_head, memory_order_acquire)) {
+			struct hotswap_chain *c = hs->retired[tail % HOTSWAP_POOL];
+			hs->in_use[c - hs->pool] = 0;
+			atomic_store_explicit(&hs->retired_tail, ++tail, memory_order_release);
+		}
+		for (int i = 0; i < HOTSWAP_POOL; i++) {
+			if (!hs->in_use[i]) {
+				hs->in_use[i] = 1;
+				return hs->pool + i;
+			}
+		}
+		usleep(1000);
+	}
+	return NULL;
+}
+
+// The next chain is built while the previous one is still waiting
+// for its time
+static void *hotswap_control(void *arg)
+{
+	struct hotswap *hs = arg;
+
+	for (int i = 0; i < hs->nr_swaps; i++) {
+		struct hotswap_chain *c = hotswap_slot(hs);
+		if (!c)
+			break;
+
+		char *image = c->image;
+		*c = hs->swap[i];
+		c->image = image;
+		hotswap_prepare(hs, c, i);
+
+		while (atomic_load(&hs->pending) && !atomic_load(&hs->stop))
+			usleep(1000);
+		atomic_store_explicit(&hs->pending, c, memory_order_release);
+	}
+	return NULL;
+}
+
+// The fork leaves the live pages copy-on-write: take those faults
+// before the audio thread has to, writing only the chain's own bytes
+static void hotswap_touch(const struct hotswap_chain *c)
+{
+	for (int i = 0; i < c->nr_regions; i++) {
+		char *p = c->region[i]->p, *end = p + c->region[i]->size;
+
+		// The first byte, then the start of every page after it
+		for (volatile char *q = p; q < end; q = (char *) (((uintptr_t) q | 4095) + 1))
+			*q = *q;
+	}
+}
+
+// The chain that's running now is the first one in the pool. Its
+// state is the live one, so it needs no image of its own.
+//
+// Call before any other threads are started.
+static int hotswap_start(struct hotswap *hs, struct effect *eff, const float *pot)
+{
+	struct hotswap_chain *c = hs->pool;
+	int request[2], reply[2];
+
+	c->nr = c->ok = 1;
+	c->effect[0] = eff;
+	memcpy(c->pot[0], pot, sizeof(c->pot[0]));
+	if (hotswap_layout(c))
+		return -1;
+
+	// Images are as big as the biggest chain's state
+	size_t size = 0;
+	for (int i = 0; i < hs->nr_swaps; i++)
+		size = hs->swap[i].size > size ? hs->swap[i].size : size;
+	size = (size + 63) & ~63;
+
+	// The images don't carry it, so the live process needs its own
+	fft_init();
+
+	// Populated now, so the audio thread never takes a page fault
+	// reading one
+	size_t head = (sizeof(struct hotswap_shared) + 4095) & ~4095;
+	char *map = mmap(NULL, head + HOTSWAP_POOL * size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+	if (map == MAP_FAILED)
+		return -1;
+	hs->shared = (struct hotswap_shared *) map;
+	for (int i = 0; i < HOTSWAP_POOL; i++)
+		hs->pool[i].image = map + head + i * size;
+
+	if (pipe(request))
+		return -1;
+	if (pipe(reply)) {
+		close(request[0]);
+		close(request[1]);
+		return -1;
+	}
+	hs->builder = fork();
+	if (!hs->builder) {
+		close(request[1]);
+		close(reply[0]);
+		hotswap_builder(hs, request[0], reply[1]);
+	}
+	close(request[0]);
+	close(reply[1]);
+	hs->request = request[1];
+	hs->reply = reply[0];
+	if (hs->builder < 0)
+		return -1;
+
+	for (int i = 0; i < hs->nr_swaps; i++)
+		hotswap_touch(hs->swap + i);
+
+	hs->in_use[0] = 1;
+	hs->current = c;
+
+	return pthread_create(&hs->control, NULL, hotswap_control, hs) ? -1 : 0;
+}
+
+// The input goes into the warm-up history as it's read
+static void hotswap_history(struct hotswap *hs, const float *in, int n)
+{
+	struct hotswap_shared *sh = hs->shared;
+	uint pos = atomic_load_explicit(&sh->history_pos, memory_order_relaxed);
+
+	for (int i = 0; i < n; i++)
+		sh->history[(pos + i) % HOTSWAP_WARM] = in[i];
+	atomic_store_explicit(&sh->history_pos, (pos + n) % HOTSWAP_WARM, memory_order_release);
+}
+
+// A realtime host just swaps a block late if the next chain isn't
+// ready in time; an offline render waits, so every swap lands on
+// its own block. The warm-up input still depends on when the builder
+// got to it, so the output right after a swap can vary a little
+// from run to run.
+static void hotswap_wait(struct hotswap *hs, uint total)
+{
+	if (hs->next < hs->nr_swaps && hs->swap[hs->next].at <= total) {
+		while (!atomic_load_explicit(&hs->pending, memory_order_acquire))
+			usleep(100);
+	}
+}
+
+// Called at every block boundary: the chain to swap to, if it's time
+static struct hotswap_chain *hotswap_take(struct hotswap *hs, uint total)
+{
+	struct hotswap_chain *c = atomic_load_explicit(&hs->pending, memory_order_acquire);
+
+	if (!c || c->at > total)
+		return NULL;
+	atomic_exchange_explicit(&hs->pending, NULL, memory_order_acq_rel);
+	hs->next++;
+	if (c->ok)
+		return c;
+
+	uint head = atomic_load_explicit(&hs->retired_head, memory_order_relaxed);
+	hs->retired[head % HOTSWAP_POOL] = c;
+	atomic_store_explicit(&hs->retired_head, head + 1, memory_order_release);
+	return NULL;
+}
+
+// After the old chain has done its last block: the new chain's state
+// becomes the live one. Only its regions are written.
+static void hotswap_install(struct hotswap *hs, struct hotswap_chain *c)
+{
+	double start = hotswap_now();
+	const char *image = c->image;
+
+	for (int i = 0; i < c->nr_regions; i++) {
+		memcpy(c->region[i]->p, image, c->region[i]->size);
+		image += c->region[i]->size;
+	}
+
+	uint head = atomic_load_explicit(&hs->retired_head, memory_order_relaxed);
+	hs->retired[head % HOTSWAP_POOL] = hs->current;
+	atomic_store_explicit(&hs->retired_head, head + 1, memory_order_release);
+	hs->current = c;
+
+	double t = hotswap_now() - start;
+	if (t > hs->worst)
+		hs->worst = t;
+	hs->swaps++;
+}
+
+static inline float hotswap_step(struct hotswap *hs, float x)
+{
+	struct hotswap_chain *c = hs->current;
+
+	for (int e = 0; e < c->nr; e++)
+		x = c->effect[e]->step(x);
+	return x;
+}
+
+// Sample 'i' of an 'n' sample crossfade block
+static inline float hotswap_fade(struct hotswap *hs, float x, int i, int n)
+{
+	int k = i * HOTSWAP_BLOCK / n;
+	return hs->old[i] * hs->fade_out[k] + x * hs->fade_in[k];
+}
+
+static void hotswap_finish(struct hotswap *hs)
+{
+	atomic_store(&hs->stop, 1);
+	pthread_join(hs->control, NULL);
+	close(hs->request);
+	close(hs->reply);
+	waitpid(hs->builder, NULL, 0);
+	fprintf(stderr, "hotswap: %d of %d swaps, longest state copy %.1f us\n",
+		hs->swaps, hs->nr_swaps, hs->worst * 1e6);
+}
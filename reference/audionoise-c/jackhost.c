@@ -0,0 +1,346 @@
+//
+// Run effect chains as a JACK client
+//
+//	jackhost [-n name] [-t seconds] [-i seconds] [-N] effect[=p1,p2,p3,p4][+effect...] ...
+//
+// Each chain (effects joined with '+', each with its own pots after
+// '=', all 0.5 if not given) is an instance with its own ports named
+// after its effects: <chain>_in and <chain>_out, and <chain>_side if
+// one of its effects takes a sidechain (.sidechain in its
+// EFFECT_MEMORY()). Unless -N, the instances are connected to
+// system:capture_N and system:playback_N in turn, and a sidechain to
+// the other capture port.
+//
+// The process callback hands the period buffers straight to the
+// chains with effect_chain_block(): the input port's buffer in, the
+// output port's out, nothing copied on the way. Since the effect
+// state is global, an effect can only be in one instance, and only
+// one of echo, flanger and discont can be used, since they all
+// share effect.h's delay.
+//
+// Every -i seconds (default 1) it writes a line of JSON to stdout
+// with what the bridge (server/jack-bridge.ts) keeps as the server
+// state: the sample rate and period, JACK's DSP load, the xruns
+// since the start, the time this client spent in its callback over
+// the period, and its ports with their connections. It runs until
+// it's killed, or for -t seconds.
+//
+// Built against JACK with -DHAVE_JACK and -ljack. Without it, the
+// server is jackstub.h's stand-in, which works like jackd's dummy
+// backend, so it runs anywhere:
+//
+//	gcc -O2 -o jackhost jackhost.c -lm -lpthread
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+
+#ifdef HAVE_JACK
+#include <jack/jack.h>
+#else
+#include "jackstub.h"
+#endif
+
+#define MAX_INSTANCES 8
+#define MAX_CHAIN 8
+
+static struct instance {
+	char name[64];
+	struct effect *chain[MAX_CHAIN];
+	int nr;
+	float pot[MAX_CHAIN][4];
+	jack_port_t *in, *out, *side;
+} instances[MAX_INSTANCES];
+static int nr_instances;
+
+static jack_client_t *client;
+static atomic_uint_fast64_t busy_ns;
+static atomic_int xruns;
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The realtime thread: no allocation, no locks, no I/O
+static int process(jack_nframes_t n, void *arg)
+{
+	uint64_t start = now_ns();
+
+	for (int i = 0; i < nr_instances; i++) {
+		struct instance *inst = instances + i;
+		const float *in = jack_port_get_buffer(inst->in, n);
+		const float *side = inst->side ? jack_port_get_buffer(inst->side, n) : NULL;
+		float *out = jack_port_get_buffer(inst->out, n);
+
+		effect_chain_block(inst->chain, inst->nr, in, side, out, n);
+	}
+	atomic_fetch_add(&busy_ns, now_ns() - start);
+	return 0;
+}
+
+static int xrun(void *arg)
+{
+	atomic_fetch_add(&xruns, 1);
+	return 0;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int parse_instance(struct instance *inst, char *arg)
+{
+	for (char *name = strtok(arg, "+"); name; name = strtok(NULL, "+")) {
+		char *pots = strchr(name, '=');
+
+		if (inst->nr == MAX_CHAIN)
+			return -1;
+		float *pot = inst->pot[inst->nr];
+		for (int i = 0; i < 4; i++)
+			pot[i] = 0.5;
+		if (pots) {
+			*pots++ = 0;
+			if (sscanf(pots, "%f,%f,%f,%f", pot, pot+1, pot+2, pot+3) != 4)
+				return -1;
+		}
+
+		struct effect *eff = find_effect(name);
+		if (!eff || strcmp(eff->name, name)) {
+			fprintf(stderr, "jackhost: no effect '%s'\n", name);
+			return -1;
+		}
+		inst->chain[inst->nr++] = eff;
+
+		// The ports go by the effects, without the pots
+		size_t len = strlen(inst->name);
+		snprintf(inst->name + len, sizeof(inst->name) - len, "%s%s", len ? "+" : "", name);
+	}
+	return inst->nr ? 0 : -1;
+}
+
+// All the instances share the effect state, so no two effects in the
+// whole process may clash (see effects_clash())
+static int check_instances(void)
+{
+	struct effect *seen[MAX_INSTANCES * MAX_CHAIN];
+	int nr = 0;
+
+	for (int i = 0; i < nr_instances; i++) {
+		for (int e = 0; e < instances[i].nr; e++) {
+			struct effect *eff = instances[i].chain[e];
+
+			for (int j = 0; j < nr; j++) {
+				if (effects_clash(seen[j], eff)) {
+					fprintf(stderr, "jackhost: %s and %s can't run together\n",
+						seen[j]->name, eff->name);
+					return -1;
+				}
+			}
+			seen[nr++] = eff;
+		}
+	}
+	return 0;
+}
+
+static int setup_instance(struct instance *inst)
+{
+	char port[80];
+	int side = 0;
+
+	// effect_has_sidechain is for the whole process, but only the
+	// effects that take one read it, and they're all in instances
+	// that have the port
+	for (int e = 0; e < inst->nr; e++)
+		side |= inst->chain[e]->memory->sidechain;
+	if (side)
+		effect_has_sidechain = 1;
+	for (int e = 0; e < inst->nr; e++) {
+		const float *p = inst->pot[e];
+		inst->chain[e]->init(p[0], p[1], p[2], p[3]);
+	}
+
+	snprintf(port, sizeof(port), "%.63s_in", inst->name);
+	inst->in = jack_port_register(client, port, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+	snprintf(port, sizeof(port), "%.63s_out", inst->name);
+	inst->out = jack_port_register(client, port, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	if (side) {
+		snprintf(port, sizeof(port), "%.63s_side", inst->name);
+		inst->side = jack_port_register(client, port, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+	}
+	if (!inst->in || !inst->out || (side && !inst->side)) {
+		fprintf(stderr, "jackhost: can't register the ports for %s\n", inst->name);
+		return -1;
+	}
+	return 0;
+}
+
+// After activating: JACK only connects active clients
+static void connect_instance(struct instance *inst, int index)
+{
+	char port[64];
+
+	snprintf(port, sizeof(port), "system:capture_%d", index % 2 + 1);
+	jack_connect(client, port, jack_port_name(inst->in));
+	snprintf(port, sizeof(port), "system:playback_%d", index % 2 + 1);
+	jack_connect(client, jack_port_name(inst->out), port);
+	if (inst->side) {
+		snprintf(port, sizeof(port), "system:capture_%d", (index + 1) % 2 + 1);
+		jack_connect(client, port, jack_port_name(inst->side));
+	}
+}
+
+static void status_port(jack_port_t *port, const char *direction, int *first)
+{
+	const char **conn = jack_port_get_connections(port);
+
+	printf("%s{\"name\":\"%s\",\"direction\":\"%s\",\"connections\":[",
+	       *first ? "" : ",", jack_port_name(port), direction);
+	for (int i = 0; conn && conn[i]; i++)
+		printf("%s\"%s\"", i ? "," : "", conn[i]);
+	printf("]}");
+	if (conn)
+		jack_free(conn);
+	*first = 0;
+}
+
+static void status(double elapsed)
+{
+	jack_nframes_t rate = jack_get_sample_rate(client);
+	uint64_t busy = atomic_exchange(&busy_ns, 0);
+	int first = 1;
+
+	printf("{\"sampleRate\":%u,\"bufferSize\":%u,\"cpuLoad\":%.2f,\"dspLoad\":%.2f,\"xruns\":%d,\"ports\":[",
+	       rate, jack_get_buffer_size(client), jack_cpu_load(client),
+	       elapsed > 0 ? 100 * busy * 1e-9 / elapsed : 0.0, atomic_load(&xruns));
+	for (int i = 0; i < nr_instances; i++) {
+		struct instance *inst = instances + i;
+
+		status_port(inst->in, "input", &first);
+		if (inst->side)
+			status_port(inst->side, "input", &first);
+		status_port(inst->out, "output", &first);
+	}
+	printf("]}\n");
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = "audionoise";
+	float seconds = 0, interval = 1;
+	int opt, connect = 1;
+
+	while ((opt = getopt(argc, argv, "+n:t:i:N")) != -1) {
+		switch (opt) {
+		case 'n':	// client name
+			name = optarg;
+			break;
+		case 't':	// seconds to run, 0 for until killed
+			seconds = atof(optarg);
+			break;
+		case 'i':	// seconds between status lines
+			interval = atof(optarg);
+			break;
+		case 'N':	// leave the ports unconnected
+			connect = 0;
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (!argc || argc > MAX_INSTANCES || interval <= 0) {
+		fprintf(stderr, "usage: jackhost [-n name] [-t seconds] [-i seconds] [-N] "
+			"effect[=p1,p2,p3,p4][+effect...] ...\n");
+		return 1;
+	}
+	for (int i = 0; i < argc; i++) {
+		char arg[256];
+
+		// Parsed in a copy, to have all of it for the message
+		snprintf(arg, sizeof(arg), "%s", argv[i]);
+		if (parse_instance(instances + i, arg)) {
+			fprintf(stderr, "jackhost: bad chain '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+	nr_instances = argc;
+	if (check_instances())
+		return 1;
+
+	jack_status_t st;
+	client = jack_client_open(name, JackNoStartServer, &st);
+	if (!client) {
+		fprintf(stderr, "jackhost: can't connect to the JACK server (status %#x)\n", st);
+		return 1;
+	}
+	if (jack_get_sample_rate(client) != SAMPLES_PER_SEC)
+		fprintf(stderr, "jackhost: the server runs at %u Hz, the effects are tuned for %g\n",
+			jack_get_sample_rate(client), SAMPLES_PER_SEC);
+
+	for (int i = 0; i < nr_instances; i++) {
+		if (setup_instance(instances + i)) {
+			jack_client_close(client);
+			return 1;
+		}
+	}
+	jack_set_process_callback(client, process, NULL);
+	jack_set_xrun_callback(client, xrun, NULL);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (jack_activate(client)) {
+		fprintf(stderr, "jackhost: can't activate\n");
+		jack_client_close(client);
+		return 1;
+	}
+	for (int i = 0; connect && i < nr_instances; i++)
+		connect_instance(instances + i, i);
+
+	uint64_t start = now_ns(), last = start;
+	while (!stop) {
+		struct timespec ts = { interval, (interval - (int) interval) * 1e9 };
+
+		nanosleep(&ts, NULL);
+		uint64_t t = now_ns();
+		status((t - last) * 1e-9);
+		last = t;
+		if (seconds > 0 && (t - start) * 1e-9 >= seconds)
+			break;
+	}
+
+	jack_deactivate(client);
+	jack_client_close(client);
+	return 0;
+}
@@ -0,0 +1,346 @@
+//
+// A stand-in for the JACK server, for testing without one
+//
+// The part of the libjack client API that jackhost.c uses, served by
+// a server that lives in the client's own process and works like
+// 'jackd -d dummy': a thread wakes up every period on the clock, as
+// a soundcard would, puts noise on system:capture_1 and _2, runs the
+// process callback, and takes whatever is connected to
+// system:playback_1 and _2. No soundcard, no jackd, no libjack.
+//
+// Like JACK, an input port connected to exactly one output gets that
+// output's buffer itself, so nothing is copied; with none it gets
+// silence, with more the sum. The load is what JACK's is, the time
+// spent in the process callback over the period, averaged over
+// JACKSTUB_AVERAGE periods, and a cycle that isn't done when the
+// next one is due is an xrun.
+//
+// JACKSTUB_RATE and JACKSTUB_PERIOD in the environment set the
+// sample rate (default 48000) and the period (default 256), as
+// jackd's -r and -p would. One client at a time.
+//
+// Connections can be made while the server thread runs the cycles:
+// the new one goes into from[] first, and only then is the count
+// published, with a release store that the cycle's acquire load
+// pairs with, so the cycle never sees a slot that isn't filled.
+//
+// Include after util.h. Needs <pthread.h>, <sched.h>, <time.h>,
+// <stdint.h>, <stdatomic.h> and <errno.h>.
+//
+#define JACK_DEFAULT_AUDIO_TYPE "32 bit float mono audio"
+#define JACKSTUB_PORTS 64
+#define JACKSTUB_CONNECTIONS 8
+#define JACKSTUB_MAX_PERIOD 4096
+#define JACKSTUB_AVERAGE 32
+
+typedef uint32_t jack_nframes_t;
+typedef float jack_default_audio_sample_t;
+typedef int (*JackProcessCallback)(jack_nframes_t nframes, void *arg);
+typedef int (*JackXRunCallback)(void *arg);
+
+typedef enum {
+	JackNullOption = 0x00,
+	JackNoStartServer = 0x01,
+} jack_options_t;
+
+typedef enum {
+	JackFailure = 0x01,
+	JackServerFailed = 0x10,
+} jack_status_t;
+
+enum JackPortFlags {
+	JackPortIsInput = 0x1,
+	JackPortIsOutput = 0x2,
+	JackPortIsPhysical = 0x4,
+	JackPortIsTerminal = 0x10,
+};
+
+typedef struct jack_port {
+	char name[64];
+	unsigned long flags;
+	struct jack_port *from[JACKSTUB_CONNECTIONS];
+	atomic_int connections;
+	float buf[JACKSTUB_MAX_PERIOD];
+} jack_port_t;
+
+typedef struct jack_client {
+	char name[32];
+	JackProcessCallback process;
+	void *process_arg;
+	JackXRunCallback xrun;
+	void *xrun_arg;
+	pthread_t thread;
+	atomic_int active;
+} jack_client_t;
+
+static struct {
+	jack_client_t *client;
+	jack_port_t port[JACKSTUB_PORTS];
+	int ports;
+	jack_nframes_t rate, period;
+	uint seed;
+	_Atomic float load;
+	double busy[JACKSTUB_AVERAGE];
+} jackstub;
+
+static double jackstub_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static jack_port_t *jackstub_port(const char *name, unsigned long flags)
+{
+	if (jackstub.ports == JACKSTUB_PORTS)
+		return NULL;
+
+	jack_port_t *p = jackstub.port + jackstub.ports++;
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	p->flags = flags;
+	return p;
+}
+
+static jack_port_t *jackstub_find(const char *name)
+{
+	for (int i = 0; i < jackstub.ports; i++) {
+		if (!strcmp(jackstub.port[i].name, name))
+			return jackstub.port + i;
+	}
+	return NULL;
+}
+
+static int jackstub_env(const char *name, int def, int max)
+{
+	const char *s = getenv(name);
+	int v = s ? atoi(s) : def;
+
+	return v > 0 && v <= max ? v : def;
+}
+
+static jack_client_t *jack_client_open(const char *name, jack_options_t options,
+				       jack_status_t *status, ...)
+{
+	if (jackstub.client) {
+		if (status)
+			*status = JackFailure;
+		return NULL;
+	}
+	jack_client_t *c = calloc(1, sizeof(*c));
+	if (!c) {
+		if (status)
+			*status = JackFailure | JackServerFailed;
+		return NULL;
+	}
+	snprintf(c->name, sizeof(c->name), "%s", name);
+
+	memset(&jackstub, 0, sizeof(jackstub));
+	jackstub.client = c;
+	jackstub.rate = jackstub_env("JACKSTUB_RATE", 48000, 384000);
+	jackstub.period = jackstub_env("JACKSTUB_PERIOD", 256, JACKSTUB_MAX_PERIOD);
+	jackstub.seed = 1;
+	jackstub_port("system:capture_1", JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal);
+	jackstub_port("system:capture_2", JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal);
+	jackstub_port("system:playback_1", JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal);
+	jackstub_port("system:playback_2", JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal);
+	if (status)
+		*status = 0;
+	return c;
+}
+
+static int jack_set_process_callback(jack_client_t *c, JackProcessCallback fn, void *arg)
+{
+	c->process = fn;
+	c->process_arg = arg;
+	return 0;
+}
+
+static int jack_set_xrun_callback(jack_client_t *c, JackXRunCallback fn, void *arg)
+{
+	c->xrun = fn;
+	c->xrun_arg = arg;
+	return 0;
+}
+
+static jack_port_t *jack_port_register(jack_client_t *c, const char *name, const char *type,
+				       unsigned long flags, unsigned long size)
+{
+	char full[64];
+
+	if (strcmp(type, JACK_DEFAULT_AUDIO_TYPE) || c->active)
+		return NULL;
+	snprintf(full, sizeof(full), "%s:%s", c->name, name);
+	return jackstub_find(full) ? NULL : jackstub_port(full, flags);
+}
+
+static const char *jack_port_name(const jack_port_t *p)
+{
+	return p->name;
+}
+
+static inline int jack_port_flags(const jack_port_t *p)
+{
+	return p->flags;
+}
+
+static void *jack_port_get_buffer(jack_port_t *p, jack_nframes_t n)
+{
+	int nr = atomic_load_explicit(&p->connections, memory_order_acquire);
+
+	if (p->flags & JackPortIsOutput)
+		return p->buf;
+	if (nr == 1)
+		return p->from[0]->buf;
+
+	memset(p->buf, 0, n * sizeof(float));
+	for (int i = 0; i < nr; i++) {
+		for (int j = 0; j < n; j++)
+			p->buf[j] += p->from[i]->buf[j];
+	}
+	return p->buf;
+}
+
+static int jack_connect(jack_client_t *c, const char *source, const char *dest)
+{
+	jack_port_t *from = jackstub_find(source), *to = jackstub_find(dest);
+
+	if (!from || !to || !(from->flags & JackPortIsOutput) || !(to->flags & JackPortIsInput))
+		return -1;
+
+	// Only this thread writes the count, so it can read it as is
+	int nr = atomic_load_explicit(&to->connections, memory_order_relaxed);
+	if (nr == JACKSTUB_CONNECTIONS)
+		return -1;
+	for (int i = 0; i < nr; i++) {
+		if (to->from[i] == from)
+			return EEXIST;
+	}
+	to->from[nr] = from;
+	atomic_store_explicit(&to->connections, nr + 1, memory_order_release);
+	return 0;
+}
+
+// The full names of what the port is connected to, NULL-terminated,
+// to be freed with jack_free()
+static const char **jack_port_get_connections(const jack_port_t *p)
+{
+	const char **names = calloc(JACKSTUB_PORTS + 1, sizeof(*names));
+	int nr = 0;
+
+	if (!names)
+		return NULL;
+	for (int i = 0; i < jackstub.ports; i++) {
+		const jack_port_t *q = jackstub.port + i;
+		int conns = atomic_load_explicit(&q->connections, memory_order_relaxed);
+
+		for (int j = 0; j < conns; j++) {
+			if (q == p)
+				names[nr++] = q->from[j]->name;
+			else if (q->from[j] == p)
+				names[nr++] = q->name;
+		}
+	}
+	if (!nr) {
+		free(names);
+		return NULL;
+	}
+	return names;
+}
+
+static void jack_free(void *p)
+{
+	free(p);
+}
+
+static jack_nframes_t jack_get_sample_rate(jack_client_t *c)
+{
+	return jackstub.rate;
+}
+
+static jack_nframes_t jack_get_buffer_size(jack_client_t *c)
+{
+	return jackstub.period;
+}
+
+static float jack_cpu_load(jack_client_t *c)
+{
+	return jackstub.load;
+}
+
+// The dummy backend: a cycle every period, on the clock
+static void *jackstub_server(void *arg)
+{
+	jack_client_t *c = arg;
+	jack_nframes_t n = jackstub.period;
+	double period = (double) n / jackstub.rate;
+	double next = jackstub_now();
+	uint cycle = 0;
+
+	while (c->active) {
+		struct timespec ts;
+
+		next += period;
+		ts.tv_sec = next;
+		ts.tv_nsec = (next - ts.tv_sec) * 1e9;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		double start = jackstub_now();
+		for (int p = 0; p < 2; p++) {
+			float *buf = jackstub.port[p].buf;
+
+			for (int i = 0; i < n; i++)
+				buf[i] = (int) xorshift32(&jackstub.seed) * (0.25f / 0x80000000);
+		}
+		if (c->process)
+			c->process(n, c->process_arg);
+		for (int p = 2; p < 4; p++)
+			jack_port_get_buffer(jackstub.port + p, n);
+		double end = jackstub_now();
+
+		double busy = 0;
+		jackstub.busy[cycle++ % JACKSTUB_AVERAGE] = end - start;
+		for (int i = 0; i < JACKSTUB_AVERAGE; i++)
+			busy += jackstub.busy[i];
+		jackstub.load = 100 * busy / (JACKSTUB_AVERAGE * period);
+
+		// Done after the next cycle was due: the soundcard ran dry
+		if (end > next + period) {
+			if (c->xrun)
+				c->xrun(c->xrun_arg);
+			next = end;
+		}
+	}
+	return NULL;
+}
+
+static int jack_activate(jack_client_t *c)
+{
+	struct sched_param param = { .sched_priority = 70 };
+
+	c->active = 1;
+	if (pthread_create(&c->thread, NULL, jackstub_server, c)) {
+		c->active = 0;
+		return -1;
+	}
+	// Like jackd -R, if we're allowed to
+	pthread_setschedparam(c->thread, SCHED_FIFO, &param);
+	return 0;
+}
+
+static int jack_deactivate(jack_client_t *c)
+{
+	if (c->active) {
+		c->active = 0;
+		pthread_join(c->thread, NULL);
+	}
+	return 0;
+}
+
+static int jack_client_close(jack_client_t *c)
+{
+	jack_deactivate(c);
+	jackstub.client = NULL;
+	free(c);
+	return 0;
+}
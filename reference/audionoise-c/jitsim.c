@@ -0,0 +1,130 @@
+//
+// Local packet network simulator for the jitter buffer
+//
+// Reads raw 32-bit samples on stdin like 'convert', chops them
+// into packets, sends them through a pretend network with
+// random delay, loss and sender clock drift, and plays them out
+// through the jitter buffer to stdout.
+//
+//	jitsim [jitter_ms [loss_% [drift_ppm [seed]]]] < in.raw > out.raw
+//
+// The network delay is a fixed 20ms plus an exponentially
+// distributed jitter with the given mean, so there's the odd
+// very late packet and reordering like on a real network.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "jitter.h"
+
+#define BASE_DELAY (0.020 * SAMPLES_PER_SEC)
+#define MAX_INFLIGHT 256
+
+static struct jitter_buffer jb;
+
+static struct packet {
+	uint seq;
+	double arrival;
+	float samples[JITTER_PACKET];
+} inflight[MAX_INFLIGHT];
+static int nr_inflight;
+
+static float random_fraction(uint *rng)
+{
+	return (xorshift32(rng) >> 8) * (1.0f / (1 << 24));
+}
+
+static int read_packet(float *samples)
+{
+	s32 buf[JITTER_PACKET];
+	size_t n = fread(buf, 4, JITTER_PACKET, stdin);
+
+	if (!n)
+		return 0;
+	for (int i = 0; i < JITTER_PACKET; i++)
+		samples[i] = i < n ? buf[i] / (float)0x80000000 : 0;
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	float jitter_ms = argc > 1 ? atof(argv[1]) : 5;
+	float loss = argc > 2 ? atof(argv[2]) / 100 : 0.01;
+	float drift = argc > 3 ? atof(argv[3]) * 1e-6 : 0;
+	uint rng = argc > 4 ? atoi(argv[4]) : 1;
+	float mean = jitter_ms * SAMPLES_PER_SEC / 1000;
+	uint sent = 0, dropped = 0, reordered = 0, last_arrived = 0;
+	int eof = 0;
+
+	if (!rng)
+		rng = 1;
+	jitter_init(&jb);
+
+	fprintf(stderr, "jitsim:");
+	fprintf(stderr, " jitter=%g ms", jitter_ms);
+	fprintf(stderr, " loss=%g%%", loss * 100);
+	fprintf(stderr, " drift=%g ppm\n", drift * 1e6);
+
+	for (uint t = 0; ; t++) {
+		// Sender: a packet goes out once it has been captured
+		while (!eof && (sent+1) * JITTER_PACKET * (1 + drift) <= t) {
+			struct packet *p = inflight + nr_inflight;
+
+			if (!read_packet(p->samples)) {
+				eof = 1;
+				break;
+			}
+			p->seq = sent++;
+			// Lost, or the network's queue is full
+			if (random_fraction(&rng) < loss || nr_inflight == MAX_INFLIGHT-1) {
+				dropped++;
+				continue;
+			}
+			float delay = -logf(1 - random_fraction(&rng)) * mean;
+			if (delay > 10*mean)
+				delay = 10*mean;
+			p->arrival = t + BASE_DELAY + delay;
+			nr_inflight++;
+		}
+
+		// Network: deliver whatever has arrived by now
+		for (int i = 0; i < nr_inflight; ) {
+			struct packet *p = inflight + i;
+			if (p->arrival > t) {
+				i++;
+				continue;
+			}
+			if (p->seq < last_arrived)
+				reordered++;
+			else
+				last_arrived = p->seq;
+			jitter_put(&jb, p->seq, t, p->samples);
+			*p = inflight[--nr_inflight];
+		}
+
+		if (eof && !nr_inflight && jitter_fill(&jb) <= 1)
+			break;
+
+		s32 sample = (int)(jitter_get(&jb) * 0x80000000);
+		if (fwrite(&sample, 4, 1, stdout) != 1)
+			return 1;
+	}
+
+	fprintf(stderr, "jitsim: sent=%u lost=%u reordered=%u late=%u overflows=%u\n",
+		sent, dropped, reordered, jb.late, jb.overflows);
+	fprintf(stderr, "jitsim: concealed=%.1f ms jitter=%.2f ms target=%.2f ms rate=%.5f\n",
+		jb.concealed * 1000 / SAMPLES_PER_SEC,
+		jb.jitter * 1000 / SAMPLES_PER_SEC,
+		jb.target * 1000 / SAMPLES_PER_SEC,
+		jb.rate);
+	return 0;
+}
@@ -0,0 +1,220 @@
+//
+// Adaptive jitter buffer for packetized network audio
+//
+// Packets carry a sequence number and JITTER_PACKET samples. They
+// are written into a ring at the position the sequence number says,
+// so reordering is free and a lost packet just leaves a hole.
+//
+// Playout reads the ring at a fractional position using the same
+// interpolating read as the delay effects. That lets us nudge the
+// playout speed by up to 2% to track the target fill level, which
+// absorbs clock drift and slow jitter changes without any jumps.
+//
+// The target fill follows the measured arrival jitter (RFC 3550
+// style mean deviation plus a slowly decaying peak), so a clean
+// network gets low latency and a bad one gets a deeper buffer.
+//
+// When the next samples simply aren't there (late, lost or
+// underrun) we loop the last JITTER_CONCEAL samples with two taps
+// crossfaded with sin**2/cos**2, same trick as discont.h, and fade
+// that out if the gap goes on for long. The loop is over what was
+// played, not over the packet ring, where an earlier hole would
+// still have stale samples in it. It fades in from the last sample
+// played over JITTER_FADE samples, like the real signal fades back
+// in after it, so neither end of a gap is a jump.
+//
+#define JITTER_PACKET_SHIFT 7
+#define JITTER_PACKET (1 << JITTER_PACKET_SHIFT)	// 2.7ms at 48kHz
+#define JITTER_SLOTS 128				// ~340ms of packets
+#define JITTER_RING_SIZE (JITTER_PACKET * JITTER_SLOTS)
+#define JITTER_RING_MASK (JITTER_RING_SIZE-1)
+
+#define JITTER_CONCEAL (4*JITTER_PACKET)
+#define JITTER_FADE 64
+#define JITTER_MAX_STRETCH 0.02f
+
+struct jitter_buffer {
+	float ring[JITTER_RING_SIZE];
+	uint slot_seq[JITTER_SLOTS];	// seq+1 of the packet in each slot, 0 if empty
+
+	// Sample positions. These wrap after ~24h at 48kHz,
+	// all comparisons are done on the signed difference.
+	uint newest;			// end of the newest packet we have
+	uint read_idx;
+	float read_frac, rate;
+	int playing;
+
+	// Arrival statistics, in samples
+	uint last_seq, last_arrival;
+	int have_last;
+	float jitter, peak, target;
+
+	// Concealment, and the output it loops
+	uint anchor, conceal_t;
+	float conceal_mix, conceal_gain, conceal_in, conceal_from;
+	float played[JITTER_RING_SIZE];
+	uint played_pos;
+
+	// Stats
+	uint received, late, overflows, concealed;
+};
+
+static inline void jitter_init(struct jitter_buffer *jb)
+{
+	memset(jb, 0, sizeof(*jb));
+	jb->rate = 1;
+	jb->conceal_gain = 1;
+	jb->target = 2*JITTER_PACKET;
+}
+
+static inline int jitter_available(struct jitter_buffer *jb, uint pos)
+{
+	uint seq = pos >> JITTER_PACKET_SHIFT;
+	return jb->slot_seq[seq & (JITTER_SLOTS-1)] == seq+1;
+}
+
+static inline int jitter_fill(struct jitter_buffer *jb)
+{
+	return (int)(jb->newest - jb->read_idx);
+}
+
+// 'arrival' is the local clock in samples when the packet came in
+static void jitter_put(struct jitter_buffer *jb, uint seq, uint arrival, const float *samples)
+{
+	uint start = seq << JITTER_PACKET_SHIFT;
+	uint end = start + JITTER_PACKET;
+
+	if (!jb->received)
+		jb->newest = jb->read_idx = start;
+
+	// Already played past it?
+	if (jb->playing && (int)(end - jb->read_idx) <= 1) {
+		jb->late++;
+		return;
+	}
+
+	// Way ahead of us. Something bad happened, resync.
+	if ((int)(end - jb->read_idx) > (JITTER_SLOTS-8)*JITTER_PACKET) {
+		jb->overflows++;
+		jb->read_idx = end - (uint)jb->target;
+		jb->read_frac = 0;
+	}
+
+	memcpy(jb->ring + (start & JITTER_RING_MASK), samples, JITTER_PACKET * sizeof(float));
+	jb->slot_seq[seq & (JITTER_SLOTS-1)] = seq+1;
+	if ((int)(end - jb->newest) > 0)
+		jb->newest = end;
+	jb->received++;
+
+	if (jb->have_last) {
+		int d = (int)(arrival - jb->last_arrival) - (int)(start - (jb->last_seq << JITTER_PACKET_SHIFT));
+		float ad = fabsf((float)d);
+
+		jb->jitter += (ad - jb->jitter) * (1.0f/16);
+		jb->peak = ad > jb->peak ? ad : jb->peak + (jb->jitter - jb->peak) * (1.0f/256);
+	}
+	jb->last_seq = seq;
+	jb->last_arrival = arrival;
+	jb->have_last = 1;
+
+	float target = JITTER_PACKET + 2*jb->jitter + jb->peak;
+	if (target < 2*JITTER_PACKET)
+		target = 2*JITTER_PACKET;
+	if (target > (JITTER_SLOTS/2)*JITTER_PACKET)
+		target = (JITTER_SLOTS/2)*JITTER_PACKET;
+	jb->target = target;
+}
+
+// Loop the JITTER_CONCEAL samples played before the gap
+static inline float jitter_conceal(struct jitter_buffer *jb)
+{
+	uint t = jb->conceal_t;
+	uint t2 = (t + JITTER_CONCEAL/2) % JITTER_CONCEAL;
+	uint base = jb->anchor - JITTER_CONCEAL;
+	struct sincos w = fastsincos(t * (0.5f / JITTER_CONCEAL));
+	float w1 = w.sin * w.sin;
+
+	float d1 = _sample_array_read(jb->played, JITTER_RING_MASK, base + t, 0);
+	float d2 = _sample_array_read(jb->played, JITTER_RING_MASK, base + t2, 0);
+
+	jb->conceal_t = (t + 1) % JITTER_CONCEAL;
+	float out = (d1*w1 + d2*(1-w1)) * jb->conceal_gain;
+
+	// Starting from the last sample played
+	if (jb->conceal_in > 0) {
+		out += (jb->conceal_from - out) * jb->conceal_in;
+		jb->conceal_in -= 1.0f / JITTER_FADE;
+	}
+	return out;
+}
+
+static inline float jitter_played(struct jitter_buffer *jb, float out)
+{
+	jb->played[jb->played_pos++ & JITTER_RING_MASK] = out;
+	return out;
+}
+
+static float jitter_get(struct jitter_buffer *jb)
+{
+	if (!jb->playing) {
+		if (!jb->received || jitter_fill(jb) < jb->target)
+			return jitter_played(jb, 0);
+		jb->playing = 1;
+
+		// Fade in from the silence, like after a gap
+		jb->anchor = jb->played_pos;
+		jb->conceal_mix = 1;
+	}
+
+	uint idx = jb->read_idx;
+	if (!jitter_available(jb, idx) || !jitter_available(jb, idx+1)) {
+		jb->concealed++;
+
+		// If there's newer data, this is a hole and time keeps
+		// going. Otherwise we're just starved, so hold still
+		// and let the buffer refill.
+		if ((int)(jb->newest - idx) > 1)
+			jb->read_idx++;
+
+		if (jb->conceal_mix == 0) {
+			jb->anchor = jb->played_pos;
+			jb->conceal_t = JITTER_CONCEAL/2;
+		}
+		// Also when it's still fading out of the last gap
+		if (jb->conceal_mix < 1) {
+			jb->conceal_from = jb->played[(jb->played_pos - 1) & JITTER_RING_MASK];
+			jb->conceal_in = 1;
+		}
+		jb->conceal_mix = 1;
+		jb->conceal_gain *= 0.9995f;	// ~100ms to -20dB
+		return jitter_played(jb, jitter_conceal(jb));
+	}
+
+	float out = _sample_array_read(jb->ring, JITTER_RING_MASK, idx, jb->read_frac);
+
+	// Coming back from concealment
+	if (jb->conceal_mix > 0) {
+		float mix = jb->conceal_mix;
+		out += (jitter_conceal(jb) - out) * mix;
+		mix -= 1.0f / JITTER_FADE;
+		jb->conceal_mix = mix > 0 ? mix : 0;
+	}
+	if (jb->conceal_mix == 0)
+		jb->conceal_gain = 1;
+
+	// Small time-scale change towards the target fill
+	float err = (jitter_fill(jb) - jb->target) / jb->target;
+	float rate = 1 + err * JITTER_MAX_STRETCH;
+	if (rate > 1 + JITTER_MAX_STRETCH)
+		rate = 1 + JITTER_MAX_STRETCH;
+	if (rate < 1 - JITTER_MAX_STRETCH)
+		rate = 1 - JITTER_MAX_STRETCH;
+	jb->rate += 0.001f * (rate - jb->rate);
+
+	float pos = jb->read_frac + jb->rate;
+	int n = (int) pos;
+	jb->read_idx = idx + n;
+	jb->read_frac = pos - n;
+
+	return jitter_played(jb, out);
+}
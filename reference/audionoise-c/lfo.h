@@ -88,3 +88,73 @@ float lfo_step(struct lfo_state *lfo, enum lfo_type type)
 		val = -val;
 	return val;
 }
+
+//
+// Band-limited waveforms for audio-rate use
+//
+// The naive sawtooth jumps and the triangle has sharp corners,
+// which is fine for an LFO but aliases badly at audio rates. The
+// polyBLEP / polyBLAMP trick adds a small polynomial correction
+// within one sample either side of each jump or corner, turning
+// it into a (roughly) band-limited one. Everywhere else the naive
+// value is already right, so outside of those two samples per edge
+// the only extra cost is an integer compare.
+//
+// Same shapes and ranges as lfo_step(), and the sine is unchanged.
+// Only good below SAMPLES_PER_SEC/4 or so, where the corrections
+// around different edges don't overlap.
+//
+
+// How far 'now' is from the edge in samples, if less than one
+static inline int lfo_near_edge(uint now, uint edge, uint step, float *x)
+{
+	int d = now - edge;
+
+	if ((uint)(d + step) >= 2*step)
+		return 0;
+	*x = (float) d / step;
+	return 1;
+}
+
+// Band-limited minus naive for a unit step up at distance 'x'
+static inline float polyblep(float x)
+{
+	if (x < 0)
+		return 0.5f * (x+1)*(x+1);
+	return -0.5f * (1-x)*(1-x);
+}
+
+// .. and for the slope going up by one per sample (the integral)
+static inline float polyblamp(float x)
+{
+	float a = 1 - fabsf(x);
+	return a*a*a * (1.0f/6);
+}
+
+static inline float lfo_step_bl(struct lfo_state *lfo, enum lfo_type type)
+{
+	uint now = lfo->idx, step = lfo->step;
+	float val = lfo_step(lfo, type), x;
+
+	if (type == lfo_sawtooth) {
+		// Drops by one at the wrap
+		if (lfo_near_edge(now, 0, step, &x))
+			val -= polyblep(x);
+	} else if (type == lfo_triangle) {
+		// Slope is +-4 per cycle, so it changes by 8 per cycle
+		// at the top (a quarter in) and bottom (three quarters)
+		float change = 8 * uint_to_fraction(step);
+
+		if (lfo_near_edge(now, 0x40000000, step, &x))
+			val -= change * polyblamp(x);
+		else if (lfo_near_edge(now, 0xc0000000, step, &x))
+			val += change * polyblamp(x);
+	}
+	return val;
+}
+
+void lfo_block(struct lfo_state *lfo, enum lfo_type type, float *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = lfo_step_bl(lfo, type);
+}
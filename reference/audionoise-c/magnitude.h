@@ -0,0 +1,48 @@
+//
+// Envelope follower: separate attack and decay rates
+// (as fractions of the difference per sample)
+//
+struct magnitude_state {
+	float attack, decay, value;
+};
+
+static inline float _magnitude_step(struct magnitude_state *m, float in)
+{
+	float mult, val = m->value;
+
+	in = fabs(in);
+	mult = (in > val) ? m->attack : m->decay;
+	val += mult * (in - val);
+	return m->value = val;
+}
+
+// ... and the "effect" that just outputs the envelope
+static struct magnitude_state magnitude;
+EFFECT_MEMORY(magnitude, sizeof(magnitude), 0, 0, 0);
+EFFECT_STATE(magnitude, REGION(magnitude));
+
+static inline void magnitude_init(float pot1, float pot2, float pot3, float pot4)
+{
+	magnitude.attack = pot1;
+	magnitude.decay = pot2;
+}
+
+static inline float magnitude_step(float in)
+{
+	return _magnitude_step(&magnitude, in);
+}
+
+// Four followers at once (needs vec.h)
+static inline vec4 _magnitude_step_vec(vec4 *value, vec4 in, float attack, float decay)
+{
+	vec4 val = *value;
+
+	in = (vec4) ((ivec4) in & 0x7fffffff);
+
+	// Comparisons give -1 for true, so this picks the attack
+	// rate where the input is above the envelope
+	vec4 up = __builtin_convertvector(in > val, vec4);
+	vec4 mult = decay - up * (attack - decay);
+
+	return *value = val + mult * (in - val);
+}
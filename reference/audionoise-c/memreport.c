@@ -0,0 +1,231 @@
+//
+// Report what the effects in this build need in memory
+//
+//	memreport [-b KB] [-s seconds]
+//
+// Prints the memory every effect in the table declares with
+// EFFECT_MEMORY() (state, own delay lines, how much of sample_array
+// it reads back, and const tables), then the things they share, and
+// what the build actually has in static RAM, measured from the
+// linker's symbols rather than added up.
+//
+// It then runs each effect over a few simple test signals at a few
+// pot settings, the steps on a thread whose stack was painted first,
+// to get how much stack the process callback uses at most, and
+// checks that neither the inits nor the steps touch the heap: the
+// pedal has none. The inits run off the audio path and print their
+// settings, so their stack is the firmware's main stack and isn't
+// counted here.
+//
+// Meant for the embedded profile (see embedded.h), with the same
+// flags the firmware is built with:
+//
+//	gcc -O2 -DEMBEDDED -DWITH_PHASER -DWITH_ECHO -o memreport memreport.c -lm -lpthread
+//
+// Exits with 1 if static RAM plus the deepest stack doesn't fit in
+// the budget (-b, default EMBEDDED_RAM, or 520 KB on the host), or
+// if any effect allocates.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+
+#ifndef EMBEDDED_RAM
+#define EMBEDDED_RAM (520 * 1024)
+#endif
+
+// Much more than any effect should want: it's the high-water mark
+// that gets reported, not this
+#define STACK_SIZE (256 * 1024)
+#define STACK_PAINT 0xa5
+
+#define BLOCK 256
+
+// Start and end of .data + .bss
+extern char __data_start[], _end[];
+
+static const float settings[][4] = {
+	{ 0.5, 0.5, 0.5, 0.5 },
+	{ 0, 0, 0, 0 },
+	{ 1, 1, 1, 1 },
+	{ 0.25, 0.75, 0.1, 0.9 },
+};
+
+struct run {
+	struct effect *eff;
+	uint length, seed;
+	size_t heap;
+};
+
+// A sweep, a chord, noise and silence, a second of each by default
+static float test_sample(uint n, uint length, uint *seed)
+{
+	float t = (float) (n % length) / SAMPLES_PER_SEC;
+
+	switch (n / length % 4) {
+	case 0:
+		return 0.5 * sinf(2 * M_PI * (50 + 2000 * t) * t);
+	case 1:
+		return 0.2 * (sinf(2 * M_PI * 220 * t) + sinf(2 * M_PI * 277 * t) +
+			      sinf(2 * M_PI * 330 * t));
+	case 2:
+		*seed = *seed * 1664525 + 1013904223;
+		return 0.5 * ((int) *seed / 2147483648.0f);
+	}
+	return 0;
+}
+
+static void *run_effect(void *arg)
+{
+	struct run *r = arg;
+	size_t heap = mallinfo2().uordblks;
+	float in[BLOCK];
+
+	for (uint n = 0; n < 4 * r->length; n += BLOCK) {
+		for (int i = 0; i < BLOCK; i++)
+			in[i] = test_sample(n + i, r->length, &r->seed);
+		for (int i = 0; i < BLOCK; i++) {
+			effect_sidechain = in[(i + 17) % BLOCK];
+			UPDATE(effect_delay);
+			in[i] = r->eff->step(in[i]);
+		}
+	}
+	r->heap += mallinfo2().uordblks - heap;
+	return NULL;
+}
+
+static void *run_nothing(void *arg)
+{
+	return NULL;
+}
+
+// Stack used by 'fn' on a freshly painted stack, or -1
+static long stack_used(unsigned char *stack, void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	long used = -1;
+
+	memset(stack, STACK_PAINT, STACK_SIZE);
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, stack, STACK_SIZE);
+	if (!pthread_create(&thread, &attr, fn, arg) && !pthread_join(thread, NULL)) {
+		long i = 0;
+
+		// The stack grows down, so the low end is what's left
+		while (i < STACK_SIZE && stack[i] == STACK_PAINT)
+			i++;
+		used = STACK_SIZE - i;
+	}
+	pthread_attr_destroy(&attr);
+	return used;
+}
+
+int main(int argc, char **argv)
+{
+	long budget = EMBEDDED_RAM;
+	float seconds = 1;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "b:s:")) != -1) {
+		switch (opt) {
+		case 'b':	// RAM budget in KB
+			budget = atol(optarg) * 1024;
+			break;
+		case 's':	// seconds per test signal
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	// The effects print their settings on init
+	int devnull = open("/dev/null", O_WRONLY);
+	int err = dup(2);
+	unsigned char *stack = malloc(STACK_SIZE);
+	if (devnull < 0 || err < 0 || !stack)
+		return 1;
+
+	// Resolve what the thread calls first: the dynamic linker's lazy
+	// binding would otherwise go on the first effect's stack
+	volatile float warm = sinf(seconds) + mallinfo2().uordblks;
+	(void) warm;
+
+	// The thread's own TLS and descriptor live on its stack too
+	long base = stack_used(stack, run_nothing, NULL);
+	long deepest = 0;
+
+	effect_has_sidechain = 1;
+	printf("%-24s %8s %8s %8s %8s %8s  %s\n",
+	       "effect", "state", "delay", "shared", "tables", "stack", "heap");
+	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
+		struct effect *eff = effects + i;
+		const struct effect_memory *m = eff->memory;
+		struct run r = { eff, seconds * SAMPLES_PER_SEC, 1 };
+		long used = 0;
+
+		for (int s = 0; s < ARRAY_SIZE(settings) && used >= 0; s++) {
+			const float *p = settings[s];
+
+			fflush(stderr);
+			dup2(devnull, 2);
+			size_t heap = mallinfo2().uordblks;
+			eff->init(p[0], p[1], p[2], p[3]);
+			r.heap += mallinfo2().uordblks - heap;
+			dup2(err, 2);
+
+			long n = stack_used(stack, run_effect, &r);
+			used = n < 0 ? -1 : n - base > used ? n - base : used;
+		}
+		if (used < 0) {
+			fprintf(stderr, "memreport: %s: couldn't run it\n", eff->name);
+			failed = 1;
+			continue;
+		}
+		if (used > deepest)
+			deepest = used;
+		printf("%-24s %8u %8u %8u %8u %8ld  %s\n", eff->name,
+		       m->state, m->delay, m->shared * (uint) sizeof(float), m->tables,
+		       used, r.heap ? "ALLOCATES" : "none");
+		failed |= !!r.heap;
+	}
+
+	long ram = _end - __data_start;
+	printf("\nshared:\n");
+	printf("  %-32s %8zu  (%d samples)\n", "sample_array", sizeof(sample_array), SAMPLE_ARRAY_SIZE);
+	printf("  %-32s %8zu  (if an effect does FFTs)\n", "fft tables",
+	       sizeof(fft_cos) + sizeof(fft_sin) + sizeof(fft_reverse));
+
+	printf("\n%-34s %8ld\n", "static RAM (.data + .bss)", ram);
+	printf("%-34s %8ld\n", "deepest stack", deepest);
+	printf("%-34s %8ld of %ld (%.0f%%)\n", "total", ram + deepest, budget,
+	       100.0 * (ram + deepest) / budget);
+	if (ram + deepest > budget) {
+		fprintf(stderr, "memreport: over the RAM budget by %ld bytes\n",
+			ram + deepest - budget);
+		failed = 1;
+	}
+	if (failed)
+		fprintf(stderr, "memreport: doesn't fit the embedded profile\n");
+	return failed;
+}
@@ -0,0 +1,168 @@
+//
+// Onset (transient) detector
+//
+// Two modes:
+//
+//  - fast: a fast and a slow envelope follower (magnitude.h), and
+//    an onset is when the fast one jumps well above the slow one.
+//    Practically free, good for percussive material.
+//
+//  - spectral flux: every ONSET_HOP samples take a Hann-windowed
+//    FFT and sum up how much the log magnitude of each bin went
+//    up since the last frame. Peaks of that above a running mean
+//    are onsets. Catches soft and pitched onsets too.
+//
+// Both detect a bit late: the flux is only known per frame, and
+// the envelopes take a while to separate. So the onset is moved
+// back to where the fast-minus-slow envelope first rose to 1/8
+// of its peak. The result is queued as an effect_event() with the
+// sample position and strength, and the audio passes through.
+//
+#define ONSET_FRAME 1024
+#define ONSET_HOP 256
+#define ONSET_HISTORY 2048
+#define ONSET_HISTORY_MASK (ONSET_HISTORY-1)
+#define ONSET_FRAME_MASK (ONSET_FRAME-1)
+
+static struct {
+	int spectral, armed, hop;
+	float sensitivity;
+	uint pos, min_gap, last_onset;
+	struct magnitude_state fast, slow;
+
+	// Per-sample fast-minus-slow envelope, for refining
+	float rise[ONSET_HISTORY];
+
+	// Spectral flux state. The input has its own ring rather than
+	// sample_array, which the delay effects would be writing too.
+	float ring[ONSET_FRAME];
+	float window[ONSET_FRAME];
+	float prev[ONSET_FRAME/2+1];
+	float re[ONSET_FRAME], im[ONSET_FRAME];
+	float flux[2], mean;
+	uint flux_pos;
+} onset;
+
+EFFECT_MEMORY(onset, sizeof(onset) - sizeof(onset.ring), sizeof(onset.ring), 0, 0);
+EFFECT_STATE(onset, REGION(onset));
+
+// A pot change keeps the envelopes and the onset count going
+static void onset_update(float pot1, float pot2, float pot3, float pot4)
+{
+	float gap_ms = linear(pot3, 20, 200);
+
+	onset.spectral = pot1 >= 0.5f;
+	onset.sensitivity = pot2;
+	onset.min_gap = gap_ms * SAMPLES_PER_MSEC;
+
+	fprintf(stderr, "onset:");
+	fprintf(stderr, " mode=%s", onset.spectral ? "flux" : "fast");
+	fprintf(stderr, " sensitivity=%g", pot2);
+	fprintf(stderr, " gap=%g ms\n", gap_ms);
+}
+
+// The window is built whatever the mode, so that a pot can switch
+// to flux later
+static void onset_init(float pot1, float pot2, float pot3, float pot4)
+{
+	memset(&onset, 0, sizeof(onset));
+	onset_update(pot1, pot2, pot3, pot4);
+	onset.last_onset = -onset.min_gap;
+	onset.armed = 1;
+
+	// ~1ms attack / 10ms decay, and ~30ms / 100ms
+	onset.fast.attack = 0.02f;
+	onset.fast.decay = 0.002f;
+	onset.slow.attack = 0.0007f;
+	onset.slow.decay = 0.0002f;
+
+	fft_init();
+	for (int i = 0; i < ONSET_FRAME; i++)
+		onset.window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / ONSET_FRAME);
+}
+
+// 'sample' is in the detector's own count, which starts again on
+// every init. The event goes out in the host's.
+static void onset_report(uint sample, float strength)
+{
+	if ((int)(sample - onset.last_onset) < (int)onset.min_gap)
+		return;
+	onset.last_onset = sample;
+	effect_event(effect_sample - (onset.pos - 1 - sample), strength);
+}
+
+// Find where the envelope rise started within [end-len, end)
+static uint onset_refine(uint end, int len)
+{
+	uint start = end - len, peak = start;
+	float max = 0;
+
+	for (uint i = start; i != end; i++) {
+		float r = onset.rise[i & ONSET_HISTORY_MASK];
+		if (r > max) {
+			max = r;
+			peak = i;
+		}
+	}
+	while (peak != start && onset.rise[(peak-1) & ONSET_HISTORY_MASK] > max/8)
+		peak--;
+	return peak;
+}
+
+static void onset_flux(void)
+{
+	float flux = 0;
+
+	// The oldest sample in the ring is the one at onset.pos
+	for (int i = 0; i < ONSET_FRAME; i++) {
+		onset.re[i] = onset.ring[(onset.pos + i) & ONSET_FRAME_MASK] * onset.window[i];
+		onset.im[i] = 0;
+	}
+	fft(onset.re, onset.im, ONSET_FRAME);
+
+	for (int k = 0; k <= ONSET_FRAME/2; k++) {
+		float mag = logf(1 + 100 * sqrtf(onset.re[k]*onset.re[k] + onset.im[k]*onset.im[k]));
+		float diff = mag - onset.prev[k];
+		if (diff > 0)
+			flux += diff;
+		onset.prev[k] = mag;
+	}
+
+	// Was the previous frame a peak above the running mean?
+	float threshold = onset.mean * linear(onset.sensitivity, 4, 1.5) + 1;
+	if (onset.flux[1] > onset.flux[0] && onset.flux[1] >= flux && onset.flux[1] > threshold)
+		onset_report(onset_refine(onset.flux_pos, ONSET_FRAME), onset.flux[1] / threshold);
+
+	onset.mean += (flux - onset.mean) * 0.1f;
+	onset.flux[0] = onset.flux[1];
+	onset.flux[1] = flux;
+	onset.flux_pos = onset.pos;
+}
+
+static float onset_step(float in)
+{
+	uint pos = onset.pos++;
+	float fast = _magnitude_step(&onset.fast, in);
+	float slow = _magnitude_step(&onset.slow, in);
+	float rise = fast - slow;
+
+	onset.rise[pos & ONSET_HISTORY_MASK] = rise > 0 ? rise : 0;
+
+	if (onset.spectral) {
+		onset.ring[pos & ONSET_FRAME_MASK] = in;
+		if (++onset.hop == ONSET_HOP) {
+			onset.hop = 0;
+			onset_flux();
+		}
+		return in;
+	}
+
+	float ratio = linear(onset.sensitivity, 4, 1.5);
+	if (onset.armed && fast > slow * ratio + 0.001f) {
+		onset.armed = 0;
+		onset_report(onset_refine(pos+1, ONSET_HOP), fast / (slow + 0.001f));
+	} else if (fast < slow * 1.2f) {
+		onset.armed = 1;
+	}
+	return in;
+}
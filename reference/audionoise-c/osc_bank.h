@@ -0,0 +1,186 @@
+//
+// Polyphonic sine/FM oscillator bank
+//
+// Every voice is a carrier and a modulator phase accumulator with
+// exactly the lfo_state arithmetic: a 32-bit phase that advances
+// by a 32-bit step and wraps around for free. The voices are kept
+// field by field (all the carrier phases together, and so on), so
+// four of them advance in one vec4 operation.
+//
+// The sine is a polynomial instead of the quarter_sin[] table,
+// because table lookups don't vectorize. Shifting the phase back
+// by a quarter turns sin() into cos(), which is symmetric, so the
+// absolute value of the phase folds it into -pi/2 .. pi/2, where
+// an odd 9th order polynomial is good to about 4e-6.
+//
+// Phase modulation is added in the integer phase domain, so the
+// modulator output is just scaled to phase units.
+//
+#define OSC_BANK_MAX 512
+#define OSC_BANK_VECS (OSC_BANK_MAX/VEC_WIDTH)
+
+// 2**32 / 2pi: one radian of phase modulation
+#define OSC_BANK_RADIAN (683565275.6f)
+
+struct osc_bank {
+	int vecs;
+	uvec4 phase[OSC_BANK_VECS], step[OSC_BANK_VECS];
+	uvec4 mod_phase[OSC_BANK_VECS], mod_step[OSC_BANK_VECS];
+	vec4 amp[OSC_BANK_VECS], index[OSC_BANK_VECS];
+};
+
+// sin(2pi * phase / 2**32) in every lane
+static inline vec4 osc_bank_sin(uvec4 phase)
+{
+	ivec4 p = (ivec4) (phase - 0x40000000);
+	uvec4 sign = (uvec4) (p >> 31);
+	uvec4 a = ((uvec4) p ^ sign) - sign;
+
+	// x = 0.5 - |p| / 2**31, and sin(pi*x) is what we want
+	vec4 x = 0.5f - __builtin_convertvector((ivec4) (a >> 1), vec4) * (1.0f / 0x40000000);
+	vec4 x2 = x * x;
+
+	const float c1 = 3.14159265f, c3 = -5.16771278f, c5 = 2.55016404f,
+		    c7 = -0.59926453f, c9 = 0.08214589f;
+	return x * (c1 + x2 * (c3 + x2 * (c5 + x2 * (c7 + x2 * c9))));
+}
+
+static inline void _osc_bank_init(struct osc_bank *bank)
+{
+	memset(bank, 0, sizeof(*bank));
+}
+
+// Voices are numbered from zero, and the bank only runs as many
+// groups of four as it needs to cover the highest one used
+static inline void _osc_bank_voice(struct osc_bank *bank, int i, float freq, float amp)
+{
+	int v = i / VEC_WIDTH, lane = i % VEC_WIDTH;
+
+	bank->step[v][lane] = (uint) rintf(freq * F_STEP);
+	bank->amp[v][lane] = amp;
+	if (v >= bank->vecs)
+		bank->vecs = v + 1;
+}
+
+// FM for a voice: modulator at 'ratio' times the carrier frequency,
+// with a peak phase deviation of 'index' radians. Set the voice
+// frequency first.
+static inline void _osc_bank_fm(struct osc_bank *bank, int i, float ratio, float index)
+{
+	int v = i / VEC_WIDTH, lane = i % VEC_WIDTH;
+
+	bank->mod_step[v][lane] = (uint) rintf(bank->step[v][lane] * ratio);
+	bank->index[v][lane] = index * OSC_BANK_RADIAN;
+}
+
+// Add 'n' samples of all the voices to 'out'. The voice loop is
+// the outer one so that each group's state stays in registers,
+// and the lanes are only summed once at the end of a chunk.
+#define OSC_BANK_CHUNK 64
+
+static inline void _osc_bank_render(struct osc_bank *bank, float *out, int n)
+{
+	vec4 acc[OSC_BANK_CHUNK];
+
+	for (int start = 0; start < n; start += OSC_BANK_CHUNK) {
+		int len = n - start < OSC_BANK_CHUNK ? n - start : OSC_BANK_CHUNK;
+
+		memset(acc, 0, sizeof(acc));
+		for (int v = 0; v < bank->vecs; v++) {
+			uvec4 phase = bank->phase[v], step = bank->step[v];
+			uvec4 mod_phase = bank->mod_phase[v], mod_step = bank->mod_step[v];
+			vec4 amp = bank->amp[v], index = bank->index[v];
+
+			// Plain sines don't need the modulator at all
+			if (!vec4_sum(index * index)) {
+				for (int i = 0; i < len; i++) {
+					acc[i] += osc_bank_sin(phase) * amp;
+					phase += step;
+				}
+				bank->phase[v] = phase;
+				continue;
+			}
+
+			for (int i = 0; i < len; i++) {
+				vec4 mod = osc_bank_sin(mod_phase) * index;
+				uvec4 p = phase + (uvec4) __builtin_convertvector(mod, ivec4);
+
+				acc[i] += osc_bank_sin(p) * amp;
+				phase += step;
+				mod_phase += mod_step;
+			}
+			bank->phase[v] = phase;
+			bank->mod_phase[v] = mod_phase;
+		}
+		for (int i = 0; i < len; i++)
+			out[start + i] += vec4_sum(acc[i]);
+	}
+}
+
+//
+// ... and a generator "effect" like fm.h: a detuned unison
+// cluster of FM voices, ignoring the input
+//
+//  pot1: base frequency (55 .. 880 Hz)
+//  pot2: voices (4 .. 512)
+//  pot3: detune spread (0 .. 50 cents)
+//  pot4: FM index (0 .. 3)
+//
+#define OSC_BANK_BLOCK 16
+
+static struct osc_bank osc_bank;
+static float osc_bank_out[OSC_BANK_BLOCK];
+static int osc_bank_pos;
+
+EFFECT_MEMORY(osc_bank, sizeof(osc_bank) + sizeof(osc_bank_out) + sizeof(osc_bank_pos), 0, 0, 0);
+EFFECT_STATE(osc_bank, REGION(osc_bank), REGION(osc_bank_out), REGION(osc_bank_pos));
+
+// A pot change retunes the voices where they are: the phases carry
+// on, and the voices that drop out just go quiet
+static void osc_bank_update(float pot1, float pot2, float pot3, float pot4)
+{
+	float base = 55 * powf(16, pot1);
+	int voices = 4 * powf(OSC_BANK_MAX / 4, pot2);
+	float spread = pot3 * 50;
+	float amp = 0.5f / sqrtf(voices);
+
+	memset(osc_bank.amp, 0, sizeof(osc_bank.amp));
+	osc_bank.vecs = 0;
+	for (int i = 0; i < voices; i++) {
+		float cents = voices > 1 ? spread * (2.0f * i / (voices-1) - 1) : 0;
+
+		_osc_bank_voice(&osc_bank, i, base * powf(2, cents / 1200), amp);
+		_osc_bank_fm(&osc_bank, i, 1, pot4 * 3);
+	}
+
+	fprintf(stderr, "osc_bank:");
+	fprintf(stderr, " base=%g Hz", base);
+	fprintf(stderr, " voices=%d", voices);
+	fprintf(stderr, " spread=%g cents", spread);
+	fprintf(stderr, " index=%g\n", pot4 * 3);
+}
+
+static void osc_bank_init(float pot1, float pot2, float pot3, float pot4)
+{
+	uint seed = 1;
+
+	// Random start phases, or they'd all add up at first. All of
+	// them, for the voices a pot change might add later.
+	_osc_bank_init(&osc_bank);
+	for (int i = 0; i < OSC_BANK_MAX; i++)
+		osc_bank.phase[i / VEC_WIDTH][i % VEC_WIDTH] = xorshift32(&seed);
+	osc_bank_update(pot1, pot2, pot3, pot4);
+	osc_bank_pos = OSC_BANK_BLOCK;
+}
+
+// Rendered a block at a time, which costs OSC_BANK_BLOCK samples
+// of latency but that doesn't matter for a generator
+static float osc_bank_step(float in)
+{
+	if (osc_bank_pos == OSC_BANK_BLOCK) {
+		memset(osc_bank_out, 0, sizeof(osc_bank_out));
+		_osc_bank_render(&osc_bank, osc_bank_out, OSC_BANK_BLOCK);
+		osc_bank_pos = 0;
+	}
+	return osc_bank_out[osc_bank_pos++];
+}
@@ -1,14 +1,17 @@
-struct {
+static struct {
 	struct lfo_state lfo;
 	struct biquad_coeff coeff;
 	float s0[2], s1[2], s2[2], s3[2];
 	float center_f, octaves, Q, feedback;
 } phaser;
 
+EFFECT_MEMORY(phaser, sizeof(phaser), 0, 0, 0);
+EFFECT_STATE(phaser, REGION(phaser));
+
 #define linear(pot, a, b) ((a)+pot*((b)-(a)))
 #define cubic(pot, a, b) linear((pot)*(pot)*(pot), a, b)
 
-void phaser_init(float pot1, float pot2, float pot3, float pot4)
+static void phaser_init(float pot1, float pot2, float pot3, float pot4)
 {
 	float ms = cubic(pot1, 25, 2000);		// 25ms .. 2s
 	set_lfo_ms(&phaser.lfo, ms);
@@ -26,7 +29,7 @@ void phaser_init(float pot1, float pot2, float pot3, float pot4)
 	fprintf(stderr, " Q=%g\n", phaser.Q);
 }
 
-float phaser_step(float in)
+static float phaser_step(float in)
 {
 	float lfo = lfo_step(&phaser.lfo, lfo_triangle);
 	float freq = fastpow(2, lfo*phaser.octaves) * phaser.center_f;
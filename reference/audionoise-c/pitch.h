@@ -0,0 +1,193 @@
+//
+// Streaming pitch detector (YIN)
+//
+// The input is low-passed and decimated by PITCH_DECIMATE down to
+// 12kHz, which is plenty for fundamentals up to ~1.5kHz. Every
+// PITCH_HOP decimated samples (5ms) we run YIN over the last
+// PITCH_WINDOW + PITCH_MAX_LAG samples.
+//
+// YIN's difference function
+//
+//	d(t) = sum (x[j] - x[j+t])**2
+//	     = e(0) + e(t) - 2*r(t)
+//
+// only needs the energies, which are running sums, and the cross
+// correlation r(t), which we get from one forward and one inverse
+// FFT instead of PITCH_WINDOW*PITCH_MAX_LAG multiplies.
+//
+// Then it's the usual cumulative mean normalization, first dip
+// under the threshold, and parabolic interpolation of the minimum.
+//
+// A detector is its own struct so that effects can embed one as
+// a tracking source. The FFT scratch space is shared.
+//
+#define PITCH_DECIMATE 4
+#define PITCH_RATE (SAMPLES_PER_SEC / PITCH_DECIMATE)
+#define PITCH_HOP 60			// 5ms at 12kHz
+#define PITCH_WINDOW 512
+#define PITCH_MIN_LAG 8			// 1.5kHz
+#define PITCH_MAX_LAG 320		// 37.5Hz
+#define PITCH_FFT 2048
+#define PITCH_RING 1024
+#define PITCH_RING_MASK (PITCH_RING-1)
+
+struct pitch_detector {
+	struct biquad lpf[2];
+	float ring[PITCH_RING];
+	uint idx;
+	int phase, hop;
+	float threshold;
+
+	// Latest estimate, 0 Hz when unvoiced
+	float freq, confidence;
+};
+
+static float pitch_re[PITCH_FFT], pitch_im[PITCH_FFT];
+static float pitch_xr[PITCH_FFT], pitch_xi[PITCH_FFT];
+static float pitch_d[PITCH_MAX_LAG+2];
+
+// Shared by every detector, and so by everything that tracks pitch
+#define PITCH_WORK (sizeof(pitch_re) + sizeof(pitch_im) + \
+		    sizeof(pitch_xr) + sizeof(pitch_xi) + sizeof(pitch_d))
+
+static void pitch_detector_init(struct pitch_detector *pd, float threshold)
+{
+	memset(pd, 0, sizeof(*pd));
+	fft_init();
+
+	// Anti-alias for the decimation, 4th order at 5kHz
+	biquad_lpf(&pd->lpf[0], 5000, 0.54f);
+	biquad_lpf(&pd->lpf[1], 5000, 1.31f);
+	pd->threshold = threshold;
+}
+
+static void pitch_analyze(struct pitch_detector *pd)
+{
+	const int len = PITCH_WINDOW + PITCH_MAX_LAG + 1;
+	uint start = pd->idx - len;
+
+	// Both the whole buffer and the first window are real, so
+	// do them in one transform as the real and imaginary parts
+	for (int i = 0; i < PITCH_FFT; i++) {
+		float x = i < len ? pd->ring[(start + i) & PITCH_RING_MASK] : 0;
+		pitch_re[i] = x;
+		pitch_im[i] = i < PITCH_WINDOW ? x : 0;
+	}
+	fft(pitch_re, pitch_im, PITCH_FFT);
+
+	// Split them apart again using the conjugate symmetry,
+	// and form conj(window) * buffer so that the inverse
+	// gives r(t) = sum x[j] * x[j+t]
+	for (int k = 0; k < PITCH_FFT; k++) {
+		int m = (PITCH_FFT - k) & (PITCH_FFT-1);
+		float a = pitch_re[k], b = pitch_im[k];
+		float c = pitch_re[m], d = pitch_im[m];
+
+		pitch_xr[k] = 0.25f * ((b+d)*(a+c) - (a-c)*(b-d));
+		pitch_xi[k] = 0.25f * ((b+d)*(b-d) + (a-c)*(a+c));
+	}
+	ifft(pitch_xr, pitch_xi, PITCH_FFT);
+
+	// Energies: e(0) is r(0), e(t) slides along the buffer
+	float *r = pitch_xr, *x = pitch_re;
+	float e0 = r[0], et = e0, sum = 0;
+	for (int i = 0; i < len; i++)
+		x[i] = pd->ring[(start + i) & PITCH_RING_MASK];
+
+	int best = 0;
+	for (int t = 1; t <= PITCH_MAX_LAG + 1; t++) {
+		et += x[t + PITCH_WINDOW - 1] * x[t + PITCH_WINDOW - 1] - x[t-1] * x[t-1];
+		float d = e0 + et - 2 * r[t];
+		sum += d;
+		pitch_d[t] = sum > 0 ? d * t / sum : 1;
+	}
+
+	// Silence?
+	if (e0 < PITCH_WINDOW * 1e-8f) {
+		pd->freq = pd->confidence = 0;
+		return;
+	}
+
+	for (int t = PITCH_MIN_LAG; t <= PITCH_MAX_LAG; t++) {
+		if (pitch_d[t] < pd->threshold) {
+			while (t < PITCH_MAX_LAG && pitch_d[t+1] < pitch_d[t])
+				t++;
+			best = t;
+			break;
+		}
+	}
+	if (!best) {
+		pd->freq = pd->confidence = 0;
+		return;
+	}
+
+	float a = pitch_d[best-1], b = pitch_d[best], c = pitch_d[best+1];
+	float denom = a - 2*b + c;
+	float lag = best + (denom > 0 ? 0.5f * (a - c) / denom : 0);
+
+	pd->freq = PITCH_RATE / lag;
+	pd->confidence = 1 - b;
+}
+
+// Returns 1 when there's a new estimate
+static int pitch_detector_step(struct pitch_detector *pd, float in)
+{
+	in = biquad_step(&pd->lpf[0], in);
+	in = biquad_step(&pd->lpf[1], in);
+	if (++pd->phase < PITCH_DECIMATE)
+		return 0;
+	pd->phase = 0;
+
+	pd->ring[pd->idx++ & PITCH_RING_MASK] = in;
+	if (++pd->hop < PITCH_HOP)
+		return 0;
+	pd->hop = 0;
+
+	pitch_analyze(pd);
+	return 1;
+}
+
+//
+// The "effect" version: passes the input through, and can mix in
+// a sine at the detected pitch so you can hear what it's tracking.
+//
+static struct {
+	struct pitch_detector pd;
+	struct lfo_state tone;
+	float tone_level, min_confidence;
+} pitch;
+
+EFFECT_MEMORY(pitch, sizeof(pitch) + PITCH_WORK, 0, 0, 0);
+EFFECT_STATE(pitch, REGION(pitch));
+
+// A pot change keeps the detector's window and the last pitch
+static void pitch_update(float pot1, float pot2, float pot3, float pot4)
+{
+	float threshold = 0.05f + 0.25f * pot2;		// 0.05 .. 0.3
+
+	pitch.pd.threshold = threshold;
+	pitch.tone_level = pot1;
+	pitch.min_confidence = pot3;
+
+	fprintf(stderr, "pitch:");
+	fprintf(stderr, " tone=%g", pot1);
+	fprintf(stderr, " threshold=%g", threshold);
+	fprintf(stderr, " confidence=%g\n", pot3);
+}
+
+static void pitch_init(float pot1, float pot2, float pot3, float pot4)
+{
+	pitch_detector_init(&pitch.pd, 0);
+	pitch_update(pot1, pot2, pot3, pot4);
+}
+
+static float pitch_step(float in)
+{
+	if (pitch_detector_step(&pitch.pd, in)) {
+		float f = pitch.pd.confidence >= pitch.min_confidence ? pitch.pd.freq : 0;
+		set_lfo_freq(&pitch.tone, f);
+	}
+	if (!pitch.tone.step)
+		return in;
+	return limit_value(in + pitch.tone_level * lfo_step(&pitch.tone, lfo_sinewave));
+}
@@ -0,0 +1,204 @@
+//
+// Check that turning a pot carries an effect on from where it was
+//
+//	potcheck [-s seconds] [effect...]
+//
+// Every effect (or just the ones named) gets 'seconds' of pink noise
+// (default 1), with a sidechain, and then silence.
+//
+// Halfway through the noise, the effect's update is given the pots
+// it already has, and that mustn't change any of its state: an
+// update that resets anything shows up there. Then the silence is
+// rendered straight through and with new pots a moment into it, and
+// whatever tail the straight render still has after that point has
+// to carry on with the new pots, within POTCHECK_DROP of it, rather
+// than drop out the way it would if the update started the effect
+// again.
+//
+// Like rtcheck.c, each render runs in its own forked child, so all
+// of them start from the same untouched state.
+//
+// Prints a line per effect and exits with 1 if any fails.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "gen.h"
+
+// The change comes 100ms into the silence, and the tail is
+// compared over the 50ms after it
+#define POTCHECK_AT (SAMPLES_PER_SEC / 10)
+#define POTCHECK_TAIL (SAMPLES_PER_SEC / 20)
+#define POTCHECK_TAIL_LEN (POTCHECK_AT + POTCHECK_TAIL)
+
+// -12dB, and below this there's no tail to speak of
+#define POTCHECK_DROP 0.25
+#define POTCHECK_SILENT 1e-4
+
+static const float before[4] = { 0.5, 0.5, 0.5, 0.5 };
+static const float after[4] = { 0.6, 0.6, 0.6, 0.6 };
+
+// Runs in the child: 'pots' is what the update gets at 'change', if
+// anything.
+// Returns 1 if the same pots changed the state.
+static int render(struct effect *eff, const float *pots, uint change,
+		  float *out, uint length, int devnull)
+{
+	const struct generator *g = gen_find("pink");
+	char *saved[eff->nr_state];
+	int changed = 0;
+
+	// The effects print their settings on init and update
+	dup2(devnull, 2);
+	gen_init(length);
+	effect_has_sidechain = 1;
+	eff->init(before[0], before[1], before[2], before[3]);
+
+	for (uint i = 0; i < length + POTCHECK_TAIL_LEN; i++) {
+		float in = 0;
+
+		if (i < length)
+			gen_block(g, &in, 1);
+		if (pots && i == change) {
+			for (int r = 0; r < eff->nr_state; r++) {
+				saved[r] = malloc(eff->state[r].size);
+				memcpy(saved[r], eff->state[r].p, eff->state[r].size);
+			}
+			eff->update(pots[0], pots[1], pots[2], pots[3]);
+			for (int r = 0; r < eff->nr_state && pots == before; r++)
+				changed |= !!memcmp(saved[r], eff->state[r].p, eff->state[r].size);
+		}
+		effect_sidechain = gen_white_sample() * GEN_LEVEL;
+		UPDATE(effect_delay);
+		out[i] = eff->step(in);
+	}
+	return changed;
+}
+
+// -1 if it didn't run, or what render() returned
+static int run(struct effect *eff, const float *pots, uint change,
+	       float *out, uint length, int devnull)
+{
+	int status;
+
+	fflush(stderr);
+	pid_t pid = fork();
+	if (!pid) {
+		_exit(render(eff, pots, change, out, length, devnull));
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) != pid)
+		return -1;
+	if (WIFSIGNALED(status)) {
+		fprintf(stderr, "potcheck: %s: killed by signal %d\n", eff->name, WTERMSIG(status));
+		return -1;
+	}
+	return WEXITSTATUS(status);
+}
+
+static double tail_rms(const float *out, uint length)
+{
+	double sum = 0;
+
+	for (uint i = length + POTCHECK_AT; i < length + POTCHECK_TAIL_LEN; i++)
+		sum += out[i] * out[i];
+	return sqrt(sum / POTCHECK_TAIL);
+}
+
+// Returns the reason it failed, or NULL
+static const char *check(struct effect *eff, float *out[2], uint length, int devnull)
+{
+	uint change = length + POTCHECK_AT;
+
+	switch (run(eff, before, length / 2, out[0], length, devnull)) {
+	case 0:
+		break;
+	case 1:
+		return "update with the same pots changed the state";
+	default:
+		return "didn't run";
+	}
+	if (run(eff, NULL, 0, out[0], length, devnull) ||
+	    run(eff, after, change, out[1], length, devnull))
+		return "didn't run";
+
+	double straight = tail_rms(out[0], length);
+	double changed = tail_rms(out[1], length);
+	fprintf(stderr, "tail %6.1f dB, after the change %6.1f dB: ",
+		20 * log10(straight + 1e-12), 20 * log10(changed + 1e-12));
+	if (straight > POTCHECK_SILENT && changed < straight * POTCHECK_DROP)
+		return "tail dropped out";
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	float seconds = 1;
+	int opt, failed = 0, nr = 0;
+
+	while ((opt = getopt(argc, argv, "+s:")) != -1) {
+		switch (opt) {
+		case 's':	// seconds of input
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	int devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return 1;
+
+	// Shared with the children, which write their renders into it
+	uint length = seconds * SAMPLES_PER_SEC;
+	size_t size = (length + POTCHECK_TAIL_LEN) * sizeof(float);
+	float *out[2];
+	for (int i = 0; i < 2; i++) {
+		out[i] = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (out[i] == MAP_FAILED)
+			return 1;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
+		struct effect *eff = effects + i;
+		int wanted = !argc;
+
+		for (int a = 0; a < argc; a++)
+			wanted |= !strcmp(argv[a], eff->name);
+		if (!wanted)
+			continue;
+
+		fprintf(stderr, "%-24s ", eff->name);
+		const char *bad = check(eff, out, length, devnull);
+		fprintf(stderr, "%s\n", bad ? bad : "ok");
+		failed += !!bad;
+		nr++;
+	}
+	if (!nr) {
+		fprintf(stderr, "No such effect\n");
+		return 1;
+	}
+	fprintf(stderr, "potcheck: %d of %d effects carry on through a pot change\n", nr - failed, nr);
+	return failed ? 1 : 0;
+}
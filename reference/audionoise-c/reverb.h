@@ -0,0 +1,163 @@
+//
+// Feedback delay network reverb
+//
+// Eight delay lines of mutually prime lengths, all fed back into
+// each other through an 8x8 Hadamard matrix. The matrix is
+// orthogonal, so the only thing that makes the tail decay is the
+// per-line gain, and that is picked from the line length so that
+// every line loses 60dB in the same time.
+//
+// The lines are kept as two vec4 groups of four, so the damping
+// lowpass biquads, the matrix (three butterfly stages) and the
+// input injection are all a handful of vector operations. The
+// only scalar work left is the eight interpolated delay reads and
+// the writes. Two slow LFOs wobble the line lengths a little (with
+// alternating signs) to break up metallic ringing. They only run
+// every REVERB_CONTROL samples.
+//
+//  pot1: decay time (RT60 0.3 .. 10s)
+//  pot2: size (line lengths 0.4 .. 2.5x)
+//  pot3: damping (lowpass 16kHz .. 1.5kHz)
+//  pot4: mix
+//
+#define REVERB_LINES 8
+#ifndef REVERB_SIZE
+#define REVERB_SIZE 8192	// the embedded profile can make it smaller
+#endif
+#define REVERB_MASK (REVERB_SIZE-1)
+#define REVERB_CONTROL 32
+
+// ~30 .. 58ms at size 1
+static const float reverb_lengths[REVERB_LINES] = {
+	1433, 1601, 1867, 2053, 2251, 2399, 2617, 2797
+};
+
+static struct {
+	float line[REVERB_LINES][REVERB_SIZE];
+	int index, count;
+	float mix;
+	struct lfo_state lfo[2];
+	vec4 mod, mod_step;
+
+	// Per-line values, lines 0-3 in [0] and 4-7 in [1]
+	vec4 length[2], depth[2];
+	vec4 b0[2], b1[2], b2[2], a1[2], a2[2];
+	vec4 w1[2], w2[2];
+} reverb;
+
+EFFECT_MEMORY(reverb, sizeof(reverb) - sizeof(reverb.line), sizeof(reverb.line), 0,
+	      sizeof(reverb_lengths));
+EFFECT_STATE(reverb, REGION(reverb));
+
+// Up to 2.5, or as far as the lines go with the modulation
+#define REVERB_DEPTH 12
+#define REVERB_MAX_SIZE fminf(2.5f, (REVERB_SIZE - 2) / (reverb_lengths[REVERB_LINES-1] + REVERB_DEPTH))
+_Static_assert(REVERB_SIZE >= 2048, "REVERB_SIZE can't fit the shortest size");
+
+// A pot change: the lines keep what's in them, so the tail rings on
+// at the new decay and size
+static void reverb_update(float pot1, float pot2, float pot3, float pot4)
+{
+	float rt60 = 0.3f * powf(10/0.3f, pot1);
+	float size = linear(pot2, 0.4, REVERB_MAX_SIZE);
+	float damp = 16000 * powf(1500/16000.0f, pot3);
+
+	reverb.mix = pot4;
+	// The LFOs are stepped once per control period
+	set_lfo_freq(&reverb.lfo[0], 0.53 * REVERB_CONTROL);
+	set_lfo_freq(&reverb.lfo[1], 0.79 * REVERB_CONTROL);
+
+	for (int i = 0; i < REVERB_LINES; i++) {
+		int v = i / 4, lane = i % 4;
+		float len = reverb_lengths[i] * size;
+		struct biquad_coeff c;
+
+		// -60dB in 'rt60' seconds, whatever the line length
+		float gain = powf(10, -3 * len / (rt60 * SAMPLES_PER_SEC));
+
+		_biquad_lpf(&c, damp, 0.5f);
+		reverb.length[v][lane] = len;
+		reverb.depth[v][lane] = REVERB_DEPTH * size;
+		reverb.b0[v][lane] = c.b0 * gain;
+		reverb.b1[v][lane] = c.b1 * gain;
+		reverb.b2[v][lane] = c.b2 * gain;
+		reverb.a1[v][lane] = c.a1;
+		reverb.a2[v][lane] = c.a2;
+	}
+
+	fprintf(stderr, "reverb:");
+	fprintf(stderr, " decay=%g s", rt60);
+	fprintf(stderr, " size=%g", size);
+	fprintf(stderr, " damping=%g Hz", damp);
+	fprintf(stderr, " mix=%g\n", pot4);
+}
+
+static void reverb_init(float pot1, float pot2, float pot3, float pot4)
+{
+	memset(&reverb, 0, sizeof(reverb));
+	reverb_update(pot1, pot2, pot3, pot4);
+}
+
+// The modulation only needs to be smooth, not exact, so the LFOs
+// run at control rate and the delays ramp linearly in between
+static void reverb_control(void)
+{
+	float m0 = lfo_step(&reverb.lfo[0], lfo_sinewave);
+	float m1 = lfo_step(&reverb.lfo[1], lfo_sinewave);
+	vec4 target = { m0, m1, -m0, -m1 };
+
+	reverb.mod_step = (target - reverb.mod) * (1.0f / REVERB_CONTROL);
+}
+
+static float reverb_step(float in)
+{
+	const vec4 sign = { 1, -1, 1, -1 };
+	vec4 mod = reverb.mod += reverb.mod_step;
+	vec4 y[2];
+
+	if (++reverb.count == REVERB_CONTROL) {
+		reverb.count = 0;
+		reverb_control();
+	}
+
+	for (int v = 0; v < 2; v++) {
+		vec4 d = reverb.length[v] + reverb.depth[v] * mod;
+		ivec4 i = __builtin_convertvector(d, ivec4);
+		vec4 frac = d - __builtin_convertvector(i, vec4);
+		ivec4 i0 = (reverb.index - i) & REVERB_MASK;
+		// The tap one further back, for a delay of i + frac
+		ivec4 i1 = (i0 - 1) & REVERB_MASK;
+		float (*line)[REVERB_SIZE] = reverb.line + 4*v;
+
+		// Build the taps as whole vectors: filling them lane
+		// by lane goes through memory and stalls
+		vec4 a = { line[0][i0[0]], line[1][i0[1]], line[2][i0[2]], line[3][i0[3]] };
+		vec4 b = { line[0][i1[0]], line[1][i1[1]], line[2][i1[2]], line[3][i1[3]] };
+		vec4 x = a + (b-a)*frac;
+
+		// Damping and decay gain, direct form 2
+		vec4 w0 = x - reverb.a1[v] * reverb.w1[v] - reverb.a2[v] * reverb.w2[v];
+		y[v] = reverb.b0[v] * w0 + reverb.b1[v] * reverb.w1[v] + reverb.b2[v] * reverb.w2[v];
+		reverb.w2[v] = reverb.w1[v];
+		reverb.w1[v] = w0;
+	}
+
+	float out = vec4_sum(sign * (y[0] - y[1])) * 0.25f;
+
+	// 8x8 Hadamard: one butterfly between the groups, then the
+	// 4-point transform within each, scaled to stay orthonormal
+	const vec4 scale = vec4_set1(0.35355339f);
+	vec4 lo = vec4_hadamard(y[0] + y[1]) * scale;
+	vec4 hi = vec4_hadamard(y[0] - y[1]) * scale;
+
+	lo += vec4_set1(in * 0.5f) * sign;
+	hi -= vec4_set1(in * 0.5f) * sign;
+
+	uint idx = REVERB_MASK & ++reverb.index;
+	for (int lane = 0; lane < 4; lane++) {
+		reverb.line[lane][idx] = lo[lane];
+		reverb.line[4+lane][idx] = hi[lane];
+	}
+
+	return in * (1 - reverb.mix) + out * reverb.mix;
+}
@@ -0,0 +1,165 @@
+//
+// Check that every effect's process callback is realtime-safe
+//
+//	rtcheck [-s seconds] [effect...]
+//
+// Every effect (or just the ones named) is run over the test
+// signals in gen.h, with a sidechain, at a few pot settings from
+// zero to full, a block at a time, with rtcheck.h watching the
+// steps for allocation, locks, stdio and blocking system calls.
+// Each setting gets 'seconds' of input (default 1); the pots change
+// between blocks like they would live, with the update outside the
+// check.
+//
+// Like search.c, each effect runs in its own forked child, so one
+// that crashes doesn't take the others with it and all of them start
+// from the same untouched state.
+//
+// Prints a backtrace for the first call of each kind, a line per
+// effect, and exits with 1 if any effect isn't clean.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "gen.h"
+
+// This is the checking build, whether or not it was asked for
+#ifndef RTCHECK
+#define RTCHECK
+#endif
+#include "rtcheck.h"
+
+#define BLOCK 256
+
+static const float settings[][4] = {
+	{ 0.5, 0.5, 0.5, 0.5 },
+	{ 0, 0, 0, 0 },
+	{ 1, 1, 1, 1 },
+	{ 0.25, 0.75, 0.1, 0.9 },
+	{ 0.9, 0.1, 0.75, 0.25 },
+};
+
+// Runs in the child: returns how many calls were caught
+static int check(struct effect *eff, float seconds, int devnull)
+{
+	uint length = seconds * SAMPLES_PER_SEC;
+	int err = dup(2);
+	float in[BLOCK];
+
+	gen_init(length * ARRAY_SIZE(settings));
+	effect_has_sidechain = 1;
+	rtcheck_start(eff->name);
+
+	for (int s = 0; s < ARRAY_SIZE(settings); s++) {
+		const struct generator *g = generators + s % ARRAY_SIZE(generators);
+		const float *p = settings[s];
+
+		// The effects print their settings on init and update
+		dup2(devnull, 2);
+		if (s)
+			eff->update(p[0], p[1], p[2], p[3]);
+		else
+			eff->init(p[0], p[1], p[2], p[3]);
+		dup2(err, 2);
+
+		for (uint done = 0; done < length; done += BLOCK) {
+			gen_block(g, in, BLOCK);
+
+			rtcheck_enter();
+			for (int i = 0; i < BLOCK; i++) {
+				effect_sidechain = gen_white_sample() * GEN_LEVEL;
+				UPDATE(effect_delay);
+				in[i] = eff->step(in[i]);
+			}
+			rtcheck_leave();
+		}
+	}
+	return rtcheck_report();
+}
+
+static int run(struct effect *eff, float seconds, int devnull)
+{
+	int status;
+
+	fflush(stderr);
+	pid_t pid = fork();
+	if (!pid)
+		_exit(check(eff, seconds, devnull) ? 1 : 0);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid)
+		return -1;
+	if (WIFSIGNALED(status)) {
+		fprintf(stderr, "rtcheck: %s: killed by signal %d\n", eff->name, WTERMSIG(status));
+		return -1;
+	}
+	return WEXITSTATUS(status) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	float seconds = 1;
+	int opt, failed = 0, nr = 0;
+
+	while ((opt = getopt(argc, argv, "+s:")) != -1) {
+		switch (opt) {
+		case 's':	// seconds per pot setting
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	int devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return 1;
+
+	for (int i = 0; i < ARRAY_SIZE(effects); i++) {
+		struct effect *eff = effects + i;
+		int wanted = !argc;
+
+		for (int a = 0; a < argc; a++)
+			wanted |= !strcmp(argv[a], eff->name);
+		if (!wanted)
+			continue;
+
+		int bad = run(eff, seconds, devnull);
+		fprintf(stderr, "%-24s %s\n", eff->name, bad ? "NOT realtime-safe" : "ok");
+		failed += !!bad;
+		nr++;
+	}
+	if (!nr) {
+		fprintf(stderr, "No such effect\n");
+		return 1;
+	}
+	fprintf(stderr, "rtcheck: %d of %d effects realtime-safe\n", nr - failed, nr);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,386 @@
+//
+// Realtime-safety checking for the process callback
+//
+// Including this replaces the allocator, the pthread locks, stdio
+// and the blocking system calls with versions that still do the
+// real thing, but complain when they're called from the thread that
+// is inside rtcheck_enter()/rtcheck_leave() while checking is on.
+// The first call of each kind gets a backtrace; after that they're
+// just counted.
+//
+// That's what the process callback must never do: the effect steps
+// run once per sample, on a thread that has a deadline, and a lock
+// or page fault there is a click. The inits are different, they
+// print their settings and may do anything, since a live host runs
+// them off the audio thread (see hotswap.h).
+//
+// Calls libc makes to itself (stdio's own write(), say) don't go
+// through these, which is why stdio is covered by its entry points.
+//
+// None of it is there unless the program is built with -DRTCHECK:
+// a host's normal build mustn't export its own malloc() and write().
+// Without it, the rtcheck_*() calls are all there but do nothing.
+//
+// Link with -rdynamic to get function names in the backtraces. The
+// effects are static functions, so those frames only have offsets:
+// 'addr2line -e <program> <offset>' resolves them.
+//
+// Needs <errno.h>, <dlfcn.h>, <execinfo.h>, <stdarg.h>, <pthread.h>,
+// <semaphore.h>, <poll.h>, <sys/mman.h> and <sys/select.h>.
+//
+#ifdef RTCHECK
+#define RTCHECK_KINDS 32
+#define RTCHECK_FRAMES 32
+
+static struct {
+	int enabled, total;
+	const char *where;
+	int nr;
+	struct {
+		const char *what;
+		int count;
+	} kind[RTCHECK_KINDS];
+} rtcheck;
+
+// Per thread: other threads may do what they like
+static __thread int rtcheck_depth, rtcheck_busy;
+
+static inline void rtcheck_enter(void)
+{
+	rtcheck_depth++;
+}
+
+static inline void rtcheck_leave(void)
+{
+	rtcheck_depth--;
+}
+
+// Not inlined, so the backtrace always starts two frames up
+static __attribute__((noinline)) void rtcheck_violation(const char *what)
+{
+	if (!rtcheck_depth || !rtcheck.enabled || rtcheck_busy)
+		return;
+	rtcheck_busy = 1;
+
+	int i;
+	for (i = 0; i < rtcheck.nr; i++) {
+		if (!strcmp(rtcheck.kind[i].what, what))
+			break;
+	}
+	if (i == rtcheck.nr && i < RTCHECK_KINDS) {
+		void *frame[RTCHECK_FRAMES];
+
+		rtcheck.kind[rtcheck.nr++].what = what;
+		fprintf(stderr, "rtcheck: %s() in the process callback of %s\n",
+			what, rtcheck.where ? rtcheck.where : "?");
+		// Skip ourselves and the interposer
+		int n = backtrace(frame, RTCHECK_FRAMES);
+		if (n > 2)
+			backtrace_symbols_fd(frame + 2, n - 2, 2);
+	}
+	if (i < RTCHECK_KINDS)
+		rtcheck.kind[i].count++;
+	rtcheck.total++;
+
+	rtcheck_busy = 0;
+}
+
+// Turns checking on for 'where'. The first backtrace() loads its
+// unwinder, which allocates, so that's done here.
+static void rtcheck_start(const char *where)
+{
+	void *frame[1];
+
+	backtrace(frame, 1);
+	rtcheck.where = where;
+	rtcheck.enabled = 1;
+}
+
+// What was caught since the last report, and how many in all
+static int rtcheck_report(void)
+{
+	int total = rtcheck.total;
+
+	if (total) {
+		fprintf(stderr, "rtcheck: %s: %d calls in the process callback:", rtcheck.where, total);
+		for (int i = 0; i < rtcheck.nr; i++)
+			fprintf(stderr, " %s x%d", rtcheck.kind[i].what, rtcheck.kind[i].count);
+		fprintf(stderr, "\n");
+	}
+	rtcheck.total = rtcheck.nr = 0;
+	return total;
+}
+
+//
+// The interposers. glibc exports its allocator under other names;
+// everything else is found with dlsym() the first time it's used.
+//
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+#define RTCHECK_REAL(name) \
+	static typeof(&name) real; \
+	if (!real) \
+		real = (typeof(&name)) dlsym(RTLD_NEXT, #name)
+
+void *malloc(size_t n)
+{
+	rtcheck_violation("malloc");
+	return __libc_malloc(n);
+}
+
+void *calloc(size_t nr, size_t n)
+{
+	rtcheck_violation("calloc");
+	return __libc_calloc(nr, n);
+}
+
+void *realloc(void *p, size_t n)
+{
+	rtcheck_violation("realloc");
+	return __libc_realloc(p, n);
+}
+
+void *aligned_alloc(size_t align, size_t n)
+{
+	rtcheck_violation("aligned_alloc");
+	return __libc_memalign(align, n);
+}
+
+int posix_memalign(void **p, size_t align, size_t n)
+{
+	rtcheck_violation("posix_memalign");
+	*p = __libc_memalign(align, n);
+	return *p ? 0 : ENOMEM;
+}
+
+void free(void *p)
+{
+	if (p)
+		rtcheck_violation("free");
+	__libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m)
+{
+	RTCHECK_REAL(pthread_mutex_lock);
+	rtcheck_violation("pthread_mutex_lock");
+	return real(m);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m)
+{
+	RTCHECK_REAL(pthread_mutex_trylock);
+	rtcheck_violation("pthread_mutex_trylock");
+	return real(m);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *l)
+{
+	RTCHECK_REAL(pthread_rwlock_rdlock);
+	rtcheck_violation("pthread_rwlock_rdlock");
+	return real(l);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *l)
+{
+	RTCHECK_REAL(pthread_rwlock_wrlock);
+	rtcheck_violation("pthread_rwlock_wrlock");
+	return real(l);
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+	RTCHECK_REAL(pthread_cond_wait);
+	rtcheck_violation("pthread_cond_wait");
+	return real(c, m);
+}
+
+int sem_wait(sem_t *s)
+{
+	RTCHECK_REAL(sem_wait);
+	rtcheck_violation("sem_wait");
+	return real(s);
+}
+
+ssize_t read(int fd, void *buf, size_t n)
+{
+	RTCHECK_REAL(read);
+	rtcheck_violation("read");
+	return real(fd, buf, n);
+}
+
+ssize_t write(int fd, const void *buf, size_t n)
+{
+	RTCHECK_REAL(write);
+	rtcheck_violation("write");
+	return real(fd, buf, n);
+}
+
+int open(const char *name, int flags, ...)
+{
+	RTCHECK_REAL(open);
+	va_list ap;
+
+	int mode = 0;
+
+	rtcheck_violation("open");
+
+	// There's only a mode when the file may be created
+	int create = !!(flags & O_CREAT);
+#ifdef O_TMPFILE
+	create |= (flags & O_TMPFILE) == O_TMPFILE;
+#endif
+	if (create) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return real(name, flags, mode);
+}
+
+int close(int fd)
+{
+	RTCHECK_REAL(close);
+	rtcheck_violation("close");
+	return real(fd);
+}
+
+void *mmap(void *p, size_t n, int prot, int flags, int fd, off_t off)
+{
+	RTCHECK_REAL(mmap);
+	rtcheck_violation("mmap");
+	return real(p, n, prot, flags, fd, off);
+}
+
+int munmap(void *p, size_t n)
+{
+	RTCHECK_REAL(munmap);
+	rtcheck_violation("munmap");
+	return real(p, n);
+}
+
+int nanosleep(const struct timespec *t, struct timespec *left)
+{
+	RTCHECK_REAL(nanosleep);
+	rtcheck_violation("nanosleep");
+	return real(t, left);
+}
+
+int usleep(useconds_t us)
+{
+	RTCHECK_REAL(usleep);
+	rtcheck_violation("usleep");
+	return real(us);
+}
+
+int sched_yield(void)
+{
+	RTCHECK_REAL(sched_yield);
+	rtcheck_violation("sched_yield");
+	return real();
+}
+
+int poll(struct pollfd *fds, nfds_t nr, int timeout)
+{
+	RTCHECK_REAL(poll);
+	rtcheck_violation("poll");
+	return real(fds, nr, timeout);
+}
+
+int select(int nr, fd_set *r, fd_set *w, fd_set *e, struct timeval *timeout)
+{
+	RTCHECK_REAL(select);
+	rtcheck_violation("select");
+	return real(nr, r, w, e, timeout);
+}
+
+int vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	RTCHECK_REAL(vfprintf);
+	rtcheck_violation("vfprintf");
+	return real(f, fmt, ap);
+}
+
+// These take the stream lock, so they count as themselves
+static int rtcheck_vfprintf(const char *what, FILE *f, const char *fmt, va_list ap)
+{
+	static typeof(&vfprintf) real;
+
+	if (!real)
+		real = (typeof(&vfprintf)) dlsym(RTLD_NEXT, "vfprintf");
+	rtcheck_violation(what);
+	return real(f, fmt, ap);
+}
+
+int fprintf(FILE *f, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int ret = rtcheck_vfprintf("fprintf", f, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int ret = rtcheck_vfprintf("printf", stdout, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int fputs(const char *s, FILE *f)
+{
+	RTCHECK_REAL(fputs);
+	rtcheck_violation("fputs");
+	return real(s, f);
+}
+
+int puts(const char *s)
+{
+	RTCHECK_REAL(puts);
+	rtcheck_violation("puts");
+	return real(s);
+}
+
+size_t fwrite(const void *p, size_t size, size_t n, FILE *f)
+{
+	RTCHECK_REAL(fwrite);
+	rtcheck_violation("fwrite");
+	return real(p, size, n, f);
+}
+
+int fflush(FILE *f)
+{
+	RTCHECK_REAL(fflush);
+	rtcheck_violation("fflush");
+	return real(f);
+}
+
+#else
+
+static inline void rtcheck_enter(void)
+{
+}
+
+static inline void rtcheck_leave(void)
+{
+}
+
+static inline void rtcheck_start(const char *where)
+{
+}
+
+static inline int rtcheck_report(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,398 @@
+//
+// Search for pot settings that make an effect chain hit a target
+//
+//	search [-j jobs] [-n candidates] [-k top] [-w warm] [-l length]
+//	       (-t target.txt | -r reference.raw) effect [effect...] < input.raw
+//
+// The input is raw 32-bit samples like 'convert'. Only the first
+// 'warm' + 'length' seconds are used (default 0.25 + 1): every
+// candidate renders that, and is scored on the part after the
+// warm-up, using the features in analysis.h.
+//
+// The target is either measured from a reference recording, or a
+// text file with one "feature value [tolerance]" per line, like
+//
+//	tilt -4.5
+//	loudness -18 2
+//
+// and features that aren't mentioned don't count. The score is the
+// sum of squared (difference / tolerance), so lower is better.
+//
+// Three quarters of the candidates are a quasi-random (R-sequence)
+// cover of the whole pot space, and the rest are random nudges
+// around the best ones of that first round.
+//
+// All the effect state is global, so every candidate runs in its
+// own forked child: it starts from an exact copy of the parent's
+// state, whatever the previous candidates did, and 'jobs' of them
+// run at once. Results come back through shared memory, and one
+// that doesn't finish cleanly scores infinity. The parent runs each
+// effect's init once first, so the one-off setup in there (the FFT
+// and sine tables, faulting the memory in) is done before the fork
+// and not again in every child. The warm-up on the signal depends
+// on the pots, and init starts it over, so each child does its own.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "lfo.h"
+#include "effect.h"
+#include "vec.h"
+#include "biquad.h"
+#include "fft.h"
+#include "effects.h"
+#include "analysis.h"
+
+#define MAX_CHAIN 4
+#define MAX_POTS (4*MAX_CHAIN)
+#define NR_FEATURES 4
+
+static const char *feature_names[NR_FEATURES] = { "tilt", "loudness", "even", "odd" };
+static float default_tolerance[NR_FEATURES] = { 1, 1, 3, 3 };
+
+struct candidate {
+	float pot[MAX_POTS];
+	float score;
+	struct features f;
+};
+
+static struct effect *chain[MAX_CHAIN];
+static int chain_len, nr_pots;
+static float target[NR_FEATURES], tolerance[NR_FEATURES];
+static int has_target[NR_FEATURES];
+
+static float *input, *output;
+static int warm, length;
+static float f0;
+static struct feature_work work;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float *read_raw(FILE *file, int max, int *len)
+{
+	float *buf = malloc(max * sizeof(float));
+	s32 sample;
+	int n = 0;
+
+	while (buf && n < max && fread(&sample, 4, 1, file) == 1)
+		buf[n++] = sample / (float)0x80000000;
+	*len = n;
+	return buf;
+}
+
+static float *feature_ptr(struct features *f, int i)
+{
+	float *p[NR_FEATURES] = { &f->tilt, &f->loudness, &f->even, &f->odd };
+	return p[i];
+}
+
+static int read_target(const char *name)
+{
+	FILE *file = fopen(name, "r");
+	char line[128], key[32];
+	float value, tol;
+
+	if (!file) {
+		perror(name);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		int n = sscanf(line, "%31s %f %f", key, &value, &tol);
+		if (n < 2 || key[0] == '#')
+			continue;
+		for (int i = 0; i < NR_FEATURES; i++) {
+			if (strcmp(key, feature_names[i]))
+				continue;
+			target[i] = value;
+			tolerance[i] = n == 3 && tol > 0 ? tol : default_tolerance[i];
+			has_target[i] = 1;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+static int measure_reference(const char *name)
+{
+	FILE *file = fopen(name, "r");
+	struct features f;
+	int n;
+
+	if (!file) {
+		perror(name);
+		return -1;
+	}
+	float *ref = read_raw(file, 60 * SAMPLES_PER_SEC, &n);
+	fclose(file);
+	if (!ref || n < FEATURE_FFT)
+		return -1;
+
+	float ref_f0 = features_f0(ref, n, &work);
+	features_measure(ref, n, ref_f0, &f, &work);
+	for (int i = 0; i < NR_FEATURES; i++) {
+		target[i] = *feature_ptr(&f, i);
+		tolerance[i] = default_tolerance[i];
+		has_target[i] = i < 2 || (ref_f0 > 0 && f0 > 0);
+	}
+	free(ref);
+	return 0;
+}
+
+static float score(struct features *f)
+{
+	float sum = 0;
+
+	for (int i = 0; i < NR_FEATURES; i++) {
+		if (has_target[i]) {
+			float d = (*feature_ptr(f, i) - target[i]) / tolerance[i];
+			sum += d * d;
+		}
+	}
+	return sum;
+}
+
+// Runs in the child
+static void evaluate(struct candidate *c)
+{
+	for (int e = 0; e < chain_len; e++) {
+		float *p = c->pot + 4*e;
+		chain[e]->init(p[0], p[1], p[2], p[3]);
+	}
+
+	for (int i = 0; i < warm + length; i++) {
+		float x = input[i];
+
+		UPDATE(effect_delay);
+		for (int e = 0; e < chain_len; e++)
+			x = chain[e]->step(x);
+		output[i] = x;
+	}
+
+	features_measure(output + warm, length, f0, &c->f, &work);
+	c->score = score(&c->f);
+}
+
+// Only a child that gets to the end sets the score, so a crashed
+// one can't sort as the best match. Returns how many failed.
+static int run(struct candidate *c, int nr, int jobs, int devnull)
+{
+	pid_t *pids = calloc(nr, sizeof(*pids));
+	int running = 0, failed = 0;
+
+	if (!pids)
+		return nr;
+	for (int i = 0; i < nr; i++)
+		c[i].score = INFINITY;
+
+	for (int i = 0; i < nr || running; ) {
+		if (i < nr && running < jobs) {
+			pid_t pid = fork();
+			if (!pid) {
+				// The effects print their settings on init
+				dup2(devnull, 2);
+				evaluate(c + i);
+				_exit(0);
+			}
+			if (pid < 0)
+				failed++;
+			else
+				running++;
+			pids[i++] = pid;
+			continue;
+		}
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0)
+			break;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			for (int j = 0; j < i; j++) {
+				if (pids[j] == pid)
+					c[j].score = INFINITY;
+			}
+			failed++;
+		}
+	}
+	free(pids);
+	return failed;
+}
+
+static int by_score(const void *a, const void *b)
+{
+	float x = ((const struct candidate *)a)->score;
+	float y = ((const struct candidate *)b)->score;
+	return (x > y) - (x < y);
+}
+
+// Generalized golden ratio for 'd' dimensions: x**(d+1) = x + 1
+static void quasi_random(struct candidate *c, int nr, int dims)
+{
+	double phi = 2, alpha[MAX_POTS];
+
+	for (int i = 0; i < 30; i++)
+		phi = pow(1 + phi, 1.0 / (dims + 1));
+	for (int d = 0; d < dims; d++)
+		alpha[d] = pow(1 / phi, d + 1);
+
+	for (int i = 0; i < nr; i++) {
+		for (int d = 0; d < dims; d++) {
+			double v = 0.5 + alpha[d] * (i + 1);
+			c[i].pot[d] = v - floor(v);
+		}
+	}
+}
+
+static void nudge(struct candidate *c, int nr, const struct candidate *best, int nr_best, int dims)
+{
+	uint seed = 12345;
+
+	for (int i = 0; i < nr; i++) {
+		const struct candidate *from = best + i % nr_best;
+
+		for (int d = 0; d < dims; d++) {
+			// Sum of two uniforms: a triangle, +-0.08
+			float r = (int)xorshift32(&seed) * (0.04f / 0x80000000) +
+				  (int)xorshift32(&seed) * (0.04f / 0x80000000);
+			float v = from->pot[d] + r;
+			c[i].pot[d] = v < 0 ? 0 : v > 1 ? 1 : v;
+		}
+	}
+}
+
+static void print_candidate(FILE *out, const struct candidate *c)
+{
+	fprintf(out, "%.4f\t", c->score);
+	for (int d = 0; d < nr_pots; d++)
+		fprintf(out, "%s%.3f", d ? " " : "", c->pot[d]);
+	fprintf(out, "\ttilt=%.2f loudness=%.2f even=%.2f odd=%.2f\n",
+		c->f.tilt, c->f.loudness, c->f.even, c->f.odd);
+}
+
+int main(int argc, char **argv)
+{
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN), nr = 2000, top = 10, opt, n;
+	float warm_s = 0.25f, length_s = 1;
+	const char *target_file = NULL, *reference = NULL;
+
+	while ((opt = getopt(argc, argv, "+j:n:k:w:l:t:r:")) != -1) {
+		switch (opt) {
+		case 'j': jobs = atoi(optarg); break;
+		case 'n': nr = atoi(optarg); break;
+		case 'k': top = atoi(optarg); break;
+		case 'w': warm_s = atof(optarg); break;
+		case 'l': length_s = atof(optarg); break;
+		case 't': target_file = optarg; break;
+		case 'r': reference = optarg; break;
+		default: return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1 || argc > MAX_CHAIN || !(target_file || reference) || nr < 4)
+		return 1;
+	if (jobs < 1)
+		jobs = 1;
+	for (int e = 0; e < argc; e++) {
+		chain[e] = find_effect(argv[e]);
+		if (!chain[e]) {
+			fprintf(stderr, "Unknown effect '%s'\n", argv[e]);
+			return 1;
+		}
+		for (int i = 0; i < e; i++) {
+			if (effects_clash(chain[i], chain[e])) {
+				fprintf(stderr, "%s and %s can't share a chain\n",
+					chain[i]->name, chain[e]->name);
+				return 1;
+			}
+		}
+	}
+	chain_len = argc;
+	nr_pots = 4 * argc;
+
+	warm = warm_s * SAMPLES_PER_SEC;
+	length = length_s * SAMPLES_PER_SEC;
+	input = read_raw(stdin, warm + length, &n);
+	if (!input || n < warm + FEATURE_FFT) {
+		fprintf(stderr, "Not enough input\n");
+		return 1;
+	}
+	length = n - warm;
+	output = malloc(n * sizeof(float));
+
+	features_init();
+	f0 = features_f0(input, n, &work);
+
+	if (target_file ? read_target(target_file) : measure_reference(reference))
+		return 1;
+
+	struct candidate in;
+	features_measure(input + warm, length, f0, &in.f, &work);
+	in.score = score(&in.f);
+	for (int d = 0; d < nr_pots; d++)
+		in.pot[d] = 0;
+	fprintf(stderr, "search: f0=%.1f Hz, input ", f0);
+	print_candidate(stderr, &in);
+	fprintf(stderr, "search: target");
+	for (int i = 0; i < NR_FEATURES; i++) {
+		if (has_target[i])
+			fprintf(stderr, " %s=%.2f+-%g", feature_names[i], target[i], tolerance[i]);
+	}
+	fprintf(stderr, "\n");
+
+	struct candidate *c = mmap(NULL, nr * sizeof(*c), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	int devnull = open("/dev/null", O_WRONLY);
+	int saved = dup(2);
+	if (c == MAP_FAILED || devnull < 0 || saved < 0)
+		return 1;
+	memset(c, 0, nr * sizeof(*c));
+
+	// The one-off setup, for the children to inherit
+	dup2(devnull, 2);
+	for (int e = 0; e < chain_len; e++)
+		chain[e]->init(0.5, 0.5, 0.5, 0.5);
+	dup2(saved, 2);
+	close(saved);
+
+	double start = now();
+	int first = nr * 3 / 4, nr_best = top < first ? top : first, failed;
+
+	quasi_random(c, first, nr_pots);
+	failed = run(c, first, jobs, devnull);
+	qsort(c, first, sizeof(*c), by_score);
+
+	nudge(c + first, nr - first, c, nr_best, nr_pots);
+	failed += run(c + first, nr - first, jobs, devnull);
+	qsort(c, nr, sizeof(*c), by_score);
+
+	if (failed)
+		fprintf(stderr, "search: %d candidates failed\n", failed);
+
+	double elapsed = now() - start;
+	fprintf(stderr, "search: %d candidates of %.2f s in %.2f s (%.0f/s, %d jobs)\n",
+		nr, (warm + length) / SAMPLES_PER_SEC, elapsed, nr / elapsed, jobs);
+
+	for (int i = 0; i < top && i < nr; i++)
+		print_candidate(stdout, c + i);
+	return 0;
+}
@@ -0,0 +1,271 @@
+//
+// Pot automation and incremental re-rendering for 'convert -a'
+// and 'convert -r dir'
+//
+// An automation file has one "seconds pot1 pot2 pot3 pot4" line per
+// point, in time order, and at each point the effect's update takes
+// the new pots, just as if they'd been turned: tails, envelopes and
+// tracking carry on through it.
+//
+// A render session directory remembers the last render: its output,
+// its automation, and a snapshot of the complete effect state every
+// 'period' samples. When the same input, effect and starting pots
+// are rendered again with different automation, nothing before the
+// first changed point can have changed, so the render restarts from
+// the last snapshot before that point and the output up to there
+// is copied from the old one.
+//
+// All the effect state is global (see search.c), and every effect
+// lists the globals it keeps it in with EFFECT_STATE(). A snapshot
+// is those, the shared effect.h state that's in every one of them,
+// and whatever the host registers with session_keep() (the
+// generator, say). Nothing else is touched by a restore, and none
+// of it holds addresses, so a snapshot is good in any run of the
+// same build. The session key has the build in it, and the header
+// has to match the regions, or the render just starts from the
+// beginning.
+//
+// A restore only puts the state back: run the effect's init first,
+// for the tables it builds.
+//
+#define MAX_AUTOMATION 4096
+#define SNAPSHOT_SECONDS 5
+#define SNAPSHOT_KEEP 4
+
+// effect.h's, which any effect may use
+static const struct effect_region snapshot_shared[] = {
+	REGION(sample_array), REGION(sample_array_index),
+	REGION(effect_feedback), REGION(effect_delay), REGION(target_effect_delay),
+	REGION(effect_depth), REGION(effect_lfo),
+	REGION(effect_events), REGION(effect_event_head), REGION(effect_event_tail),
+	REGION(effect_sidechain), REGION(effect_has_sidechain),
+};
+
+struct snapshot_header {
+	uint64_t size;
+	uint32_t regions, shared;
+};
+
+struct automation_point {
+	uint sample;
+	float pot[4];
+};
+
+struct automation {
+	int nr;
+	struct automation_point p[MAX_AUTOMATION];
+};
+
+struct session {
+	const char *dir;
+	uint64_t key;
+	uint period, samples;
+	struct automation automation;
+	const struct effect *effect;
+	int nr_keep;
+	struct effect_region keep[SNAPSHOT_KEEP];
+};
+
+static void session_keep(struct session *s, void *p, size_t size)
+{
+	if (s->nr_keep < SNAPSHOT_KEEP)
+		s->keep[s->nr_keep++] = (struct effect_region) { p, size };
+}
+
+// Shared, then the effect's, then the host's
+static const struct effect_region *snapshot_region(const struct session *s, int i)
+{
+	if (i < ARRAY_SIZE(snapshot_shared))
+		return snapshot_shared + i;
+	i -= ARRAY_SIZE(snapshot_shared);
+	if (i < s->effect->nr_state)
+		return s->effect->state + i;
+	i -= s->effect->nr_state;
+	return i < s->nr_keep ? s->keep + i : NULL;
+}
+
+static struct snapshot_header snapshot_layout(const struct session *s)
+{
+	struct snapshot_header h = { .shared = ARRAY_SIZE(snapshot_shared) };
+	const struct effect_region *r;
+
+	while ((r = snapshot_region(s, h.regions)) != NULL) {
+		h.size += r->size;
+		h.regions++;
+	}
+	return h;
+}
+
+static int read_automation(const char *name, struct automation *a)
+{
+	FILE *file = fopen(name, "r");
+	char line[256];
+	float t, p[4];
+
+	if (!file) {
+		perror(name);
+		return -1;
+	}
+	a->nr = 0;
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || sscanf(line, "%f %f %f %f %f", &t, p, p+1, p+2, p+3) != 5)
+			continue;
+		if (a->nr == MAX_AUTOMATION) {
+			fprintf(stderr, "%s: more than %d automation points\n", name, MAX_AUTOMATION);
+			fclose(file);
+			return -1;
+		}
+
+		struct automation_point *pt = a->p + a->nr;
+		pt->sample = t * SAMPLES_PER_SEC;
+		memcpy(pt->pot, p, sizeof(p));
+		if (a->nr && pt->sample < pt[-1].sample) {
+			fprintf(stderr, "%s: automation points out of order\n", name);
+			fclose(file);
+			return -1;
+		}
+		a->nr++;
+	}
+	fclose(file);
+	return 0;
+}
+
+// First sample where two automations can give different output
+static uint automation_diff(const struct automation *a, const struct automation *b)
+{
+	int i;
+
+	for (i = 0; i < a->nr && i < b->nr; i++) {
+		const struct automation_point *x = a->p + i, *y = b->p + i;
+
+		if (x->sample != y->sample || memcmp(x->pot, y->pot, sizeof(x->pot)))
+			return x->sample < y->sample ? x->sample : y->sample;
+	}
+	if (i < a->nr)
+		return a->p[i].sample;
+	if (i < b->nr)
+		return b->p[i].sample;
+	return UINT_MAX;
+}
+
+static void session_path(const struct session *s, char *path, int size, const char *name, int nr)
+{
+	if (nr >= 0)
+		snprintf(path, size, "%s/%s.%d", s->dir, name, nr);
+	else
+		snprintf(path, size, "%s/%s", s->dir, name);
+}
+
+static int snapshot_save(const struct session *s, int nr)
+{
+	struct snapshot_header header = snapshot_layout(s);
+	const struct effect_region *r;
+	char path[1024];
+
+	session_path(s, path, sizeof(path), "snap", nr);
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return -1;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (int i = 0; ok && (r = snapshot_region(s, i)) != NULL; i++)
+		ok = fwrite(r->p, r->size, 1, file) == 1;
+	return fclose(file) || !ok ? -1 : 0;
+}
+
+// Opens a snapshot if it has the state of this effect and host
+static FILE *snapshot_open(const struct session *s, int nr)
+{
+	struct snapshot_header header, layout = snapshot_layout(s);
+	char path[1024];
+
+	session_path(s, path, sizeof(path), "snap", nr);
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return NULL;
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(&header, &layout, sizeof(header))) {
+		fclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+// Read it all before touching the live state, so that a short
+// file can't leave it half restored
+static int snapshot_restore(const struct session *s, int nr)
+{
+	size_t size = snapshot_layout(s).size;
+	const struct effect_region *r;
+	char *copy = malloc(size);
+	FILE *file = snapshot_open(s, nr);
+
+	if (!file || !copy) {
+		if (file)
+			fclose(file);
+		free(copy);
+		return -1;
+	}
+	size_t n = fread(copy, 1, size + 1, file);
+	fclose(file);
+	if (n == size) {
+		char *p = copy;
+		for (int i = 0; (r = snapshot_region(s, i)) != NULL; i++) {
+			memcpy(r->p, p, r->size);
+			p += r->size;
+		}
+	}
+	free(copy);
+	return n == size ? 0 : -1;
+}
+
+// The session file describes the last complete render. The pots are
+// written as hex floats so they read back exactly.
+static int session_load(struct session *s)
+{
+	char path[1024];
+	unsigned long long key;
+	struct automation *a = &s->automation;
+
+	session_path(s, path, sizeof(path), "session", -1);
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return -1;
+	int ok = fscanf(file, "key %llx period %u samples %u points %d",
+			&key, &s->period, &s->samples, &a->nr) == 4 &&
+		 a->nr >= 0 && a->nr <= MAX_AUTOMATION;
+	for (int i = 0; ok && i < a->nr; i++) {
+		float *p = a->p[i].pot;
+		ok = fscanf(file, "%u %a %a %a %a", &a->p[i].sample, p, p+1, p+2, p+3) == 5;
+	}
+	fclose(file);
+	s->key = key;
+	return ok ? 0 : -1;
+}
+
+static int session_save(const struct session *s)
+{
+	char path[1024];
+	const struct automation *a = &s->automation;
+
+	session_path(s, path, sizeof(path), "session", -1);
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return -1;
+	fprintf(file, "key %016llx\nperiod %u\nsamples %u\npoints %d\n",
+		(unsigned long long) s->key, s->period, s->samples, a->nr);
+	for (int i = 0; i < a->nr; i++) {
+		const float *p = a->p[i].pot;
+		fprintf(file, "%u %a %a %a %a\n", a->p[i].sample, p[0], p[1], p[2], p[3]);
+	}
+	return fclose(file);
+}
+
+// Until the new render is complete, the directory doesn't describe
+// any render, and the next one starts from scratch
+static void session_invalidate(const struct session *s)
+{
+	char path[1024];
+
+	session_path(s, path, sizeof(path), "session", -1);
+	unlink(path);
+}
@@ -0,0 +1,249 @@
+//
+// Offline time stretch of a whole file
+//
+//	stretch [-q] [-j threads] speed < in.raw > out.raw
+//
+// Raw 32-bit samples like 'convert'. A speed of 0.75 gives a 75%
+// speed practice copy at the same pitch. -q uses the phase vocoder
+// instead of WSOLA.
+//
+// WSOLA finds where every frame goes first, in order, and then the
+// threads overlap-add them, in 2*threads runs of frames, the even
+// ones first and then the odd ones, so no two threads ever add into
+// the same part of the output. The phase vocoder goes a chunk of
+// frames at a time: the threads do the transforms both ways, and the
+// phases are carried from frame to frame and the frames added up in
+// order in between. The output is the same for any -j.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef int s32;
+typedef unsigned int u32;
+typedef unsigned int uint;
+
+#define SAMPLES_PER_SEC (48000.0)
+
+#include "util.h"
+#include "vec.h"
+#include "fft.h"
+#include "stretch.h"
+
+#define MAX_THREADS 64
+#define PVOC_CHUNK 64		// frames per thread
+
+static struct {
+	const float *in;
+	float *out;
+	uint len;
+	float speed;
+	const long *pos;		// WSOLA: where each frame comes from
+	struct pvoc_frame *frames;	// pvoc: the chunk's frames..
+	int chunk;			// .. from this one on
+} job;
+
+static struct worker {
+	pthread_t thread;
+	void (*fn)(struct worker *);
+	int k0, k1;
+	struct stretch_work work;
+} workers[MAX_THREADS];
+static int threads;
+
+// The in-order part's work area
+static struct stretch_work serial;
+
+static void wsola_worker(struct worker *w)
+{
+	wsola_frames(job.in, job.pos, job.out, w->k0, w->k1);
+}
+
+static void analyse_worker(struct worker *w)
+{
+	for (int k = w->k0; k < w->k1; k++)
+		pvoc_analyse(job.in, job.len, job.speed, k, job.frames + k - job.chunk, &w->work);
+}
+
+static void synth_worker(struct worker *w)
+{
+	for (int k = w->k0; k < w->k1; k++)
+		pvoc_synth(job.frames + k - job.chunk, &w->work);
+}
+
+static void *stretch_thread(void *arg)
+{
+	struct worker *w = arg;
+
+	w->fn(w);
+	return NULL;
+}
+
+// Frames [k0, k1) on the threads, even runs and then odd ones
+static void parallel(void (*fn)(struct worker *), int k0, int k1)
+{
+	int runs = 2 * threads;
+
+	// Runs need to be longer than a frame for the even/odd
+	// split to keep threads apart
+	while (runs > 1 && (k1 - k0) / runs < 4)
+		runs--;
+
+	for (int pass = 0; pass < 2; pass++) {
+		int n = 0;
+		for (int r = pass; r < runs; r += 2) {
+			struct worker *w = workers + n++;
+			w->fn = fn;
+			w->k0 = k0 + (long)(k1 - k0) * r / runs;
+			w->k1 = k0 + (long)(k1 - k0) * (r+1) / runs;
+			pthread_create(&w->thread, NULL, stretch_thread, w);
+		}
+		for (int i = 0; i < n; i++)
+			pthread_join(workers[i].thread, NULL);
+	}
+}
+
+static float *read_input(uint *len)
+{
+	uint size = 1 << 20, n = 0;
+	s32 *buf = malloc(size * sizeof(s32));
+	size_t got;
+
+	while (buf && (got = fread(buf + n, 4, size - n, stdin)) > 0) {
+		n += got;
+		if (n == size)
+			buf = realloc(buf, (size *= 2) * sizeof(s32));
+	}
+	if (!buf)
+		return NULL;
+
+	// Convert in place, s32 and float are the same size
+	float *in = (float *)buf;
+	for (uint i = 0; i < n; i++)
+		in[i] = buf[i] / (float)0x80000000;
+	*len = n;
+	return in;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	int quality = 0, opt;
+	uint len;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "+qj:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quality = 1;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (optind >= argc)
+		return 1;
+	float speed = atof(argv[optind]);
+	if (speed < 0.1f || speed > 10)
+		return 1;
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	float *in = read_input(&len);
+	if (!in)
+		return 1;
+
+	double start = now();
+	int frame = quality ? PVOC_FRAME : STRETCH_FRAME;
+	int hop = quality ? PVOC_HOP : STRETCH_HOP;
+	uint out_len = len / speed;
+	int frames = out_len / hop + 1;
+
+	// The frames are read whole: pad anything shorter with silence
+	uint padded = len < frame ? frame : len;
+	if (padded > len) {
+		in = realloc(in, padded * sizeof(float));
+		if (!in)
+			return 1;
+		memset(in + len, 0, (padded - len) * sizeof(float));
+	}
+
+	float *out = calloc((long)frames * hop + frame, sizeof(float));
+	if (!out)
+		return 1;
+
+	stretch_init();
+	job.in = in;
+	job.out = out;
+	job.len = padded;
+	job.speed = speed;
+
+	if (quality) {
+		int chunk = PVOC_CHUNK * threads;
+		long prev = -1;
+
+		job.frames = malloc(chunk * sizeof(struct pvoc_frame));
+		if (!job.frames)
+			return 1;
+		for (int c = 0; c < frames; c += chunk) {
+			int end = c + chunk < frames ? c + chunk : frames;
+
+			job.chunk = c;
+			parallel(analyse_worker, c, end);
+			for (int k = c; k < end; k++) {
+				pvoc_advance(job.frames + k - c, prev, &serial);
+				prev = job.frames[k - c].pos;
+			}
+			parallel(synth_worker, c, end);
+			for (int k = c; k < end; k++) {
+				float *o = out + (long)k * PVOC_HOP;
+
+				for (int i = 0; i < PVOC_FRAME; i++)
+					o[i] += job.frames[k - c].out[i];
+			}
+		}
+	} else {
+		float *coarse = malloc((padded / STRETCH_DECIMATE + 1) * sizeof(float));
+		long *pos = malloc(frames * sizeof(long));
+
+		if (!coarse || !pos)
+			return 1;
+		stretch_decimate(in, padded, coarse);
+		wsola_plan(in, coarse, padded, speed, pos, 0, frames, &serial);
+		free(coarse);
+		job.pos = pos;
+		parallel(wsola_worker, 0, frames);
+	}
+
+	double elapsed = now() - start;
+	fprintf(stderr, "stretch: %s speed=%g threads=%d %u -> %u samples in %.3f s (%.0fx realtime)\n",
+		quality ? "pvoc" : "wsola", speed, threads, len, out_len,
+		elapsed, len / SAMPLES_PER_SEC / elapsed);
+
+	s32 *buf = (s32 *)out;
+	for (uint i = 0; i < out_len; i++) {
+		float v = out[i];
+		if (v > 1) v = 1;
+		if (v < -1) v = -1;
+		buf[i] = (s32)(v * 0x7fffffff);
+	}
+	if (fwrite(buf, 4, out_len, stdout) != out_len)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,265 @@
+//
+// Offline time stretching (speed change without pitch change)
+//
+// Two algorithms:
+//
+//  - WSOLA: overlap-add 50% overlapping Hann frames, but let each
+//    input frame move by up to STRETCH_SEARCH samples to where it
+//    best lines up with the natural continuation of the previous
+//    one. Fast, and very clean on monophonic material.
+//
+//  - Phase vocoder: 75% overlapping frames, with the phase of every
+//    bin advanced by its measured instantaneous frequency, and the
+//    bins around each spectral peak locked to the peak ("identity
+//    phase locking") to keep the phasiness down. Slower, but better
+//    on dense polyphonic material.
+//
+// The WSOLA similarity search runs on a 4x decimated copy of the
+// input and uses the FFT for the cross-correlation, and only the
+// final +-4 samples are searched directly at the full rate.
+//
+// Both carry state from one frame to the next, where the last one
+// was found and the phases it was given, and a frame started without
+// it doesn't line up with the one before. So that part runs in order
+// (wsola_plan, pvoc_advance) and the rest works on ranges of frames
+// with a caller-owned work area, for the caller to hand disjoint
+// ranges to threads. The result doesn't depend on how it's split.
+// Nothing allocates, and the input has to be at least a frame long.
+//
+#define STRETCH_FRAME 1024
+#define STRETCH_HOP (STRETCH_FRAME/2)
+#define STRETCH_SEARCH 256
+#define STRETCH_DECIMATE 4
+#define STRETCH_FFT 256
+
+#define PVOC_FRAME 2048
+#define PVOC_HOP (PVOC_FRAME/4)
+#define PVOC_BINS (PVOC_FRAME/2+1)
+
+// A phase vocoder frame: where it is in the input, its spectrum,
+// with the synthesis phase once it's been advanced, and then what it
+// adds to the output
+struct pvoc_frame {
+	long pos;
+	float mag[PVOC_BINS], phase[PVOC_BINS];
+	float out[PVOC_FRAME];
+};
+
+struct stretch_work {
+	float re[PVOC_FRAME], im[PVOC_FRAME];
+	float mag[PVOC_BINS], phase[PVOC_BINS];
+	float prev_phase[PVOC_BINS], synth_phase[PVOC_BINS];
+	int peaks[PVOC_BINS];
+};
+
+static float stretch_window[STRETCH_FRAME];
+static float pvoc_window[PVOC_FRAME];
+
+static void stretch_init(void)
+{
+	fft_init();
+	for (int i = 0; i < STRETCH_FRAME; i++)
+		stretch_window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / STRETCH_FRAME);
+	for (int i = 0; i < PVOC_FRAME; i++)
+		pvoc_window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / PVOC_FRAME);
+}
+
+// The decimated copy used by the WSOLA coarse search
+static void stretch_decimate(const float *in, uint len, float *coarse)
+{
+	for (uint i = 0; i < len / STRETCH_DECIMATE; i++) {
+		const float *x = in + i * STRETCH_DECIMATE;
+		coarse[i] = x[0] + x[1] + x[2] + x[3];
+	}
+}
+
+static inline int stretch_clamp(long pos, uint len, int frame)
+{
+	if (pos > (long)len - frame)
+		pos = (long)len - frame;
+	return pos < 0 ? 0 : pos;
+}
+
+// Normalized correlation of 'a' against 'b', directly
+static float stretch_similarity(const float *a, const float *b, int n)
+{
+	float energy = vec_dot(b, b, n);
+	return vec_dot(a, b, n) / sqrtf(energy + 1e-9f);
+}
+
+// Best offset (-STRETCH_SEARCH .. STRETCH_SEARCH) of the input
+// frame at 'pos' to match the template starting at 'nat'
+static int wsola_search(const float *in, const float *coarse, uint len,
+	long nat, long pos, struct stretch_work *w)
+{
+	const int tlen = STRETCH_HOP / STRETCH_DECIMATE;
+	const int span = 2 * STRETCH_SEARCH / STRETCH_DECIMATE;
+	const int clen = len / STRETCH_DECIMATE;
+	long cnat = nat / STRETCH_DECIMATE, cpos = (pos - STRETCH_SEARCH) / STRETCH_DECIMATE;
+
+	if (cnat + tlen > clen || cpos < 0 || cpos + tlen + span >= clen)
+		return 0;
+
+	// Template and search region are both real, so they share
+	// one transform: region in the real part, template in the
+	// imaginary part, then conj(template) * region. The region
+	// exactly fills the transform, and the lags we look at
+	// (0 .. span) never wrap around it.
+	for (int i = 0; i < STRETCH_FFT; i++) {
+		w->re[i] = coarse[cpos + i];
+		w->im[i] = i < tlen ? coarse[cnat + i] : 0;
+	}
+	fft(w->re, w->im, STRETCH_FFT);
+	for (int k = 0; k < STRETCH_FFT; k++) {
+		int m = (STRETCH_FFT - k) & (STRETCH_FFT-1);
+		float a = w->re[k], b = w->im[k];
+		float c = w->re[m], d = w->im[m];
+
+		w->mag[k] = 0.25f * ((b+d)*(a+c) - (a-c)*(b-d));
+		w->phase[k] = 0.25f * ((b+d)*(b-d) + (a-c)*(a+c));
+	}
+	ifft(w->mag, w->phase, STRETCH_FFT);
+
+	// Normalize by the sliding energy of the region
+	const float *r = coarse + cpos;
+	float energy = 0, best = -1e30f;
+	int best_j = span / 2;
+	for (int i = 0; i < tlen; i++)
+		energy += r[i] * r[i];
+	for (int j = 0; j <= span; j++) {
+		float score = w->mag[j] / sqrtf(energy + 1e-9f);
+		if (score > best) {
+			best = score;
+			best_j = j;
+		}
+		energy += r[j + tlen] * r[j + tlen] - r[j] * r[j];
+	}
+
+	// Refine at the full rate
+	int coarse_off = best_j * STRETCH_DECIMATE - STRETCH_SEARCH;
+	int best_off = coarse_off;
+	best = -1e30f;
+	for (int off = coarse_off - STRETCH_DECIMATE; off <= coarse_off + STRETCH_DECIMATE; off++) {
+		long p = pos + off;
+		if (p < 0 || p + STRETCH_FRAME > len)
+			continue;
+		float score = stretch_similarity(in + nat, in + p, STRETCH_HOP);
+		if (score > best) {
+			best = score;
+			best_off = off;
+		}
+	}
+	return best_off;
+}
+
+// Where in the input output frames [k0, k1) come from. Each one is
+// lined up with the one before, pos[k0-1], so this runs in order;
+// it's most of the work.
+static void wsola_plan(const float *in, const float *coarse, uint len, float speed,
+	long *pos, int k0, int k1, struct stretch_work *w)
+{
+	for (int k = k0; k < k1; k++) {
+		long p = stretch_clamp(lrint((double)k * STRETCH_HOP * speed), len, STRETCH_FRAME);
+
+		if (k)
+			p = stretch_clamp(p + wsola_search(in, coarse, len, pos[k-1] + STRETCH_HOP, p, w),
+					  len, STRETCH_FRAME);
+		pos[k] = p;
+	}
+}
+
+// Output frames [k0, k1), from where wsola_plan put them. Frame k
+// lands at out + k*STRETCH_HOP.
+static void wsola_frames(const float *in, const long *pos, float *out, int k0, int k1)
+{
+	for (int k = k0; k < k1; k++) {
+		float *o = out + (long)k * STRETCH_HOP;
+
+		for (int i = 0; i < STRETCH_FRAME; i++)
+			o[i] += in[pos[k] + i] * stretch_window[i];
+	}
+}
+
+static inline float pvoc_wrap(float phase)
+{
+	return phase - 2 * M_PI * rintf(phase * (0.5f / M_PI));
+}
+
+// Where output frame k comes from, and its spectrum
+static void pvoc_analyse(const float *in, uint len, float speed, int k,
+	struct pvoc_frame *f, struct stretch_work *w)
+{
+	f->pos = stretch_clamp(lrint((double)k * PVOC_HOP * speed), len, PVOC_FRAME);
+
+	for (int i = 0; i < PVOC_FRAME; i++) {
+		w->re[i] = in[f->pos + i] * pvoc_window[i];
+		w->im[i] = 0;
+	}
+	fft(w->re, w->im, PVOC_FRAME);
+
+	for (int b = 0; b < PVOC_BINS; b++) {
+		f->mag[b] = sqrtf(w->re[b]*w->re[b] + w->im[b]*w->im[b]);
+		f->phase[b] = atan2f(w->im[b], w->re[b]);
+	}
+}
+
+// Turn an analysed frame's phases into synthesis phases, carrying on
+// from the frame before, which was at 'prev' (-1 for none). The
+// state is in 'w', so the frames have to come in order.
+static void pvoc_advance(struct pvoc_frame *f, long prev, struct stretch_work *w)
+{
+	float dpos = f->pos - prev;
+
+	if (prev < 0 || dpos <= 0) {
+		memcpy(w->synth_phase, f->phase, sizeof(f->phase));
+	} else {
+		// Advance the peaks by their measured frequency..
+		int n = 0;
+		for (int b = 0; b < PVOC_BINS; b++) {
+			if (b && f->mag[b] <= f->mag[b-1])
+				continue;
+			if (b < PVOC_BINS-1 && f->mag[b] < f->mag[b+1])
+				continue;
+
+			float omega = 2 * M_PI * b / PVOC_FRAME;
+			float dphi = pvoc_wrap(f->phase[b] - w->prev_phase[b] - omega * dpos);
+			float freq = omega + dphi / dpos;
+			w->synth_phase[b] = pvoc_wrap(w->synth_phase[b] + freq * PVOC_HOP);
+			w->peaks[n++] = b;
+		}
+
+		// .. and the bins around each peak (up to halfway to
+		// the next one) keep their phase relation to it
+		for (int i = 0, b = 0; i < n; i++) {
+			int p = w->peaks[i];
+			int end = i+1 < n ? (p + w->peaks[i+1]) / 2 : PVOC_BINS-1;
+
+			for (; b <= end; b++) {
+				if (b != p)
+					w->synth_phase[b] = w->synth_phase[p] + f->phase[b] - f->phase[p];
+			}
+		}
+	}
+	memcpy(w->prev_phase, f->phase, sizeof(f->phase));
+	memcpy(f->phase, w->synth_phase, sizeof(f->phase));
+}
+
+// What an advanced frame adds to the output. That's left to the
+// caller, in order, so the sums don't depend on how it was split.
+static void pvoc_synth(struct pvoc_frame *f, struct stretch_work *w)
+{
+	for (int b = 0; b < PVOC_BINS; b++) {
+		float m = f->mag[b];
+		w->re[b] = m * cosf(f->phase[b]);
+		w->im[b] = m * sinf(f->phase[b]);
+		if (b && b < PVOC_FRAME/2) {
+			w->re[PVOC_FRAME - b] = w->re[b];
+			w->im[PVOC_FRAME - b] = -w->im[b];
+		}
+	}
+	ifft(w->re, w->im, PVOC_FRAME);
+
+	// Hann**2 at 75% overlap adds up to 1.5
+	for (int i = 0; i < PVOC_FRAME; i++)
+		f->out[i] = w->re[i] * pvoc_window[i] * (2.0f/3);
+}
@@ -16,7 +16,7 @@
 // that maintains L/R correlation when applied identically to both channels.
 //
 
-struct {
+static struct {
 	// Path A - Fundamental
 	struct biquad fund_hpf;
 	float fund_level;
@@ -32,8 +32,16 @@ struct {
 
 	// Output
 	float output_level;
+
+	// Optional pitch tracking of the even/odd filters
+	struct harmonic_tracker track;
 } synth_harmonic;
 
+EFFECT_MEMORY(synth_harmonic, sizeof(synth_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_MEMORY(synth_harmonic_track, sizeof(synth_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_STATE(synth_harmonic, REGION(synth_harmonic));
+EFFECT_STATE(synth_harmonic_track, REGION(synth_harmonic));
+
 // Mild soft saturation for synth - gentler than vocal to preserve modulation
 static inline float synth_saturate(float x)
 {
@@ -45,7 +53,9 @@ static inline float synth_saturate(float x)
 	return x - 0.15f * x3;
 }
 
-void synth_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+// A pot change only sets the levels, which leaves a tracker
+// alone
+static void synth_harmonic_update(float pot1, float pot2, float pot3, float pot4)
 {
 	// pot1: Fundamental level
 	// pot2: Even harmonics
@@ -57,6 +67,15 @@ void synth_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	synth_harmonic.odd_level = pot3 * pot3;
 	synth_harmonic.output_level = 0.5f + pot4 * 0.5f;
 
+	fprintf(stderr, "synth_harmonic:");
+	fprintf(stderr, " fund=%.2f", synth_harmonic.fund_level);
+	fprintf(stderr, " even=%.2f", synth_harmonic.even_level);
+	fprintf(stderr, " odd=%.2f", synth_harmonic.odd_level);
+	fprintf(stderr, " out=%.2f\n", synth_harmonic.output_level);
+}
+
+static void synth_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+{
 	// Path A: HPF at 50 Hz (center of 40-60)
 	biquad_hpf(&synth_harmonic.fund_hpf, 50.0f, 0.707f);
 
@@ -69,17 +88,17 @@ void synth_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	// Path C: 2nd-order LPF at 3 kHz (center of 2-4 kHz)
 	biquad_lpf(&synth_harmonic.odd_lpf, 3000.0f, 0.707f);
 
-	fprintf(stderr, "synth_harmonic:");
-	fprintf(stderr, " fund=%.2f", synth_harmonic.fund_level);
-	fprintf(stderr, " even=%.2f", synth_harmonic.even_level);
-	fprintf(stderr, " odd=%.2f", synth_harmonic.odd_level);
-	fprintf(stderr, " out=%.2f\n", synth_harmonic.output_level);
+	synth_harmonic.track.enabled = 0;
+	synth_harmonic_update(pot1, pot2, pot3, pot4);
 }
 
-float synth_harmonic_step(float in)
+static float synth_harmonic_step(float in)
 {
 	float path_a, path_b, path_c;
 
+	if (synth_harmonic.track.enabled)
+		harmonic_track_step(&synth_harmonic.track, in);
+
 	// Path A: Fundamental - preserve modulation and stereo image
 	path_a = biquad_step(&synth_harmonic.fund_hpf, in);
 	path_a *= synth_harmonic.fund_level;
@@ -102,3 +121,20 @@ float synth_harmonic_step(float in)
 
 	return limit_value(out);
 }
+
+// Tracking mode: the even/odd filter corners follow the played
+// fundamental, keeping their ratio to the nominal 250 Hz
+static void synth_harmonic_track_init(float pot1, float pot2, float pot3, float pot4)
+{
+	struct harmonic_tracker *t = &synth_harmonic.track;
+
+	synth_harmonic_init(pot1, pot2, pot3, pot4);
+
+	harmonic_track_init(t, 250.0f, 30.0f, 2000.0f);
+	harmonic_track_filter(t, &synth_harmonic.even_lpf[0], 1000.0f, 0.54f);
+	harmonic_track_filter(t, &synth_harmonic.even_lpf[1], 1000.0f, 1.31f);
+	harmonic_track_filter(t, &synth_harmonic.odd_lpf, 3000.0f, 0.707f);
+
+	fprintf(stderr, "synth_harmonic: tracking 30-2000 Hz\n");
+}
+#define synth_harmonic_track_step synth_harmonic_step
@@ -32,7 +32,7 @@ static inline float fastpow(float a, float b)
 //
 // So you can add two values in the -1..1 range and
 // then limit the sum to that range too.
-static float limit_value(float x)
+static inline float limit_value(float x)
 {
 	float x2 = x*x;
 	float x4 = x2*x2;
@@ -49,8 +49,26 @@ static inline uint fraction_to_uint(float val)
 	return (uint) (val * TWO_POW_32);
 }
 
+// Cheap deterministic pseudo-random numbers (xorshift32).
+// The state must never be zero.
+static inline uint xorshift32(uint *state)
+{
+	uint x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// The embedded profile sizes it for the effects it builds
+#ifdef EMBEDDED
+#include "embedded.h"
+#endif
+
 // Max ~1.25s delays at ~52kHz
+#ifndef SAMPLE_ARRAY_SIZE
 #define SAMPLE_ARRAY_SIZE 65536
+#endif
 #define SAMPLE_ARRAY_MASK (SAMPLE_ARRAY_SIZE-1)
 extern float sample_array[SAMPLE_ARRAY_SIZE];
 extern int sample_array_index;
@@ -61,17 +79,24 @@ static inline void sample_array_write(float val)
 	sample_array[idx] = val;
 }
 
-static inline float sample_array_read(float delay)
+// Interpolated read from any power-of-two ring buffer, so that
+// things with their own delay memory can share the same logic
+static inline float _sample_array_read(const float *array, uint mask, int index, float delay)
 {
 	int i = (int) delay;
 	float frac = delay - i;
-	int idx = sample_array_index - i;
+	int idx = index - i;
 
-	float a = sample_array[SAMPLE_ARRAY_MASK & idx];
-	float b = sample_array[SAMPLE_ARRAY_MASK & ++idx];
+	float a = array[mask & idx];
+	float b = array[mask & ++idx];
 	return a + (b-a)*frac;
 }
 
+static inline float sample_array_read(float delay)
+{
+	return _sample_array_read(sample_array, SAMPLE_ARRAY_MASK, sample_array_index, delay);
+}
+
 // We can calculate sin/cos at the same time using
 // the table lookup. It's "GoodEnough(tm)" and with
 // 256 entries it's good to about 4.5 digits of
@@ -0,0 +1,136 @@
+//
+// Minimal portable SIMD using the gcc vector extensions
+//
+// On x86-64 and aarch64 these become SSE/NEON instructions. On
+// targets without float vectors (like the pedal) the compiler
+// just splits them into four scalar operations, so the same code
+// works everywhere and we don't need any intrinsics.
+//
+#define VEC_WIDTH 4
+
+typedef float vec4 __attribute__((vector_size(16)));
+typedef int ivec4 __attribute__((vector_size(16)));
+typedef unsigned int uvec4 __attribute__((vector_size(16)));
+
+// memcpy() so that unaligned pointers are fine. The
+// compiler turns these into plain vector loads and stores.
+static inline vec4 vec4_load(const float *p)
+{
+	vec4 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void vec4_store(float *p, vec4 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline vec4 vec4_set1(float x)
+{
+	return (vec4) { x, x, x, x };
+}
+
+static inline float vec4_sum(vec4 v)
+{
+	return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+// Dot product of two arrays, 'n' must be a multiple of VEC_WIDTH
+static inline float vec_dot(const float *a, const float *b, int n)
+{
+	vec4 acc = vec4_set1(0);
+
+	for (int i = 0; i < n; i += VEC_WIDTH)
+		acc += vec4_load(a+i) * vec4_load(b+i);
+	return vec4_sum(acc);
+}
+
+// Lane shuffle, gcc style ('a'..'d' pick input lanes)
+#define vec4_shuffle(v, a, b, c, d) __builtin_shuffle(v, (ivec4) { a, b, c, d })
+
+// Unnormalized 4-point Hadamard transform across the lanes:
+// two butterfly stages, each a shuffle and a multiply-add
+static inline vec4 vec4_hadamard(vec4 v)
+{
+	v = vec4_shuffle(v, 1, 0, 3, 2) + v * (vec4) { 1, -1, 1, -1 };
+	return vec4_shuffle(v, 2, 3, 0, 1) + v * (vec4) { 1, 1, -1, -1 };
+}
+
+static inline vec4 vec4_select(ivec4 mask, vec4 a, vec4 b)
+{
+	return (vec4) ((mask & (ivec4) a) | (~mask & (ivec4) b));
+}
+
+// Transpose four rows into four columns, in place
+static inline void vec4_transpose(vec4 v[4])
+{
+	vec4 t0 = __builtin_shuffle(v[0], v[1], (ivec4) { 0, 4, 1, 5 });
+	vec4 t1 = __builtin_shuffle(v[0], v[1], (ivec4) { 2, 6, 3, 7 });
+	vec4 t2 = __builtin_shuffle(v[2], v[3], (ivec4) { 0, 4, 1, 5 });
+	vec4 t3 = __builtin_shuffle(v[2], v[3], (ivec4) { 2, 6, 3, 7 });
+
+	v[0] = __builtin_shuffle(t0, t2, (ivec4) { 0, 1, 4, 5 });
+	v[1] = __builtin_shuffle(t0, t2, (ivec4) { 2, 3, 6, 7 });
+	v[2] = __builtin_shuffle(t1, t3, (ivec4) { 0, 1, 4, 5 });
+	v[3] = __builtin_shuffle(t1, t3, (ivec4) { 2, 3, 6, 7 });
+}
+
+static inline vec4 vec4_max(vec4 a, vec4 b)
+{
+	return vec4_select(a > b, a, b);
+}
+
+// log2() to about 2e-5: the exponent bits, plus the atanh series
+// for the log of the mantissa 'm' (1 .. 2), in s = (m-1)/(m+1)
+// which is at most 1/3. Positive normal inputs only.
+static inline vec4 vec4_log2(vec4 v)
+{
+	ivec4 i = (ivec4) v;
+	vec4 e = __builtin_convertvector(((i >> 23) & 0xff) - 127, vec4);
+	vec4 m = (vec4) ((i & 0x7fffff) | 0x3f800000);
+	vec4 s = (m - 1) / (m + 1), s2 = s * s;
+	vec4 ln = 2 * s * (1 + s2 * (1.0f/3 + s2 * (1.0f/5 + s2 * (1.0f/7))));
+
+	return e + ln * 1.44269504f;
+}
+
+// Round to nearest (even) for |x| < 2^22: adding 1.5*2^23 leaves
+// the integer in the low mantissa bits, as two's complement
+static inline ivec4 vec4_round(vec4 v)
+{
+	vec4 magic = vec4_set1(12582912.0f);
+
+	return (ivec4) (v + magic) - (ivec4) magic;
+}
+
+// 2^x to about 2e-7 relative: the integer part goes straight into
+// the exponent bits, the rest (at most a half) is the Taylor series
+// of e^(x ln 2). For |x| < 126.
+static inline vec4 vec4_exp2(vec4 v)
+{
+	ivec4 i = vec4_round(v);
+	vec4 y = (v - __builtin_convertvector(i, vec4)) * 0.69314718f;
+	vec4 e = 1 + y * (1 + y * (1.0f/2 + y * (1.0f/6 + y * (1.0f/24 +
+		 y * (1.0f/120 + y * (1.0f/720))))));
+
+	return (vec4) ((ivec4) e + (i << 23));
+}
+
+// Sine and cosine of a phase in turns (like fastsincos(), but four
+// at a time and any phase under 2^20 turns), to about 3e-7. The
+// nearest eighth of a turn picks the quadrant, and the short Taylor
+// series around it do the rest: the quadrant swaps the two and sets
+// their signs.
+static inline void vec4_sincos(vec4 phase, vec4 *sin, vec4 *cos)
+{
+	vec4 p = phase * 4;
+	ivec4 q = vec4_round(p);
+	vec4 x = (p - __builtin_convertvector(q, vec4)) * 1.57079633f, x2 = x * x;
+	vec4 s = x * (1 - x2 * (1.0f/6 - x2 * (1.0f/120 - x2 * (1.0f/5040))));
+	vec4 c = 1 - x2 * (1.0f/2 - x2 * (1.0f/24 - x2 * (1.0f/720 - x2 * (1.0f/40320))));
+	ivec4 swap = (q & 1) != 0;
+
+	*sin = (vec4) ((ivec4) vec4_select(swap, c, s) ^ ((q & 2) << 30));
+	*cos = (vec4) ((ivec4) vec4_select(swap, s, c) ^ (((q + 1) & 2) << 30));
+}
@@ -12,7 +12,7 @@
 //   Path C: Odd harmonics (soft-to-hard sat, LPF 3-5 kHz, de-emphasis) - clarity
 //
 
-struct {
+static struct {
 	// Path A - Fundamental
 	struct biquad fund_hpf;
 	struct biquad fund_lpf;     // Optional high-frequency limit
@@ -30,8 +30,16 @@ struct {
 
 	// Output
 	float output_trim;
+
+	// Optional pitch tracking of the even/odd filters
+	struct harmonic_tracker track;
 } vocal_harmonic;
 
+EFFECT_MEMORY(vocal_harmonic, sizeof(vocal_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_MEMORY(vocal_harmonic_track, sizeof(vocal_harmonic) + PITCH_WORK, 0, 0, 0);
+EFFECT_STATE(vocal_harmonic, REGION(vocal_harmonic));
+EFFECT_STATE(vocal_harmonic_track, REGION(vocal_harmonic));
+
 // Soft-to-hard saturation curve (no foldback)
 // Smooth transition from linear to clipped
 static inline float vocal_saturate(float x)
@@ -52,7 +60,9 @@ static inline float vocal_saturate(float x)
 	}
 }
 
-void vocal_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+// A pot change only sets the levels, which leaves a tracker
+// alone
+static void vocal_harmonic_update(float pot1, float pot2, float pot3, float pot4)
 {
 	// pot1: Fundamental level
 	// pot2: Even harmonics (body)
@@ -64,6 +74,15 @@ void vocal_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	vocal_harmonic.odd_level = pot3 * pot3;
 	vocal_harmonic.output_trim = 0.5f + pot4 * 0.5f;
 
+	fprintf(stderr, "vocal_harmonic:");
+	fprintf(stderr, " fund=%.2f", vocal_harmonic.fund_level);
+	fprintf(stderr, " even=%.2f", vocal_harmonic.even_level);
+	fprintf(stderr, " odd=%.2f", vocal_harmonic.odd_level);
+	fprintf(stderr, " trim=%.2f\n", vocal_harmonic.output_trim);
+}
+
+static void vocal_harmonic_init(float pot1, float pot2, float pot3, float pot4)
+{
 	// Path A: HPF at 100 Hz, LPF at 11 kHz (gentle top-end rolloff)
 	biquad_hpf(&vocal_harmonic.fund_hpf, 100.0f, 0.707f);
 	biquad_lpf(&vocal_harmonic.fund_lpf, 11000.0f, 0.707f);
@@ -79,17 +98,17 @@ void vocal_harmonic_init(float pot1, float pot2, float pot3, float pot4)
 	// De-emphasis: gentle LPF at 6 kHz to tame sibilance in harmonics
 	biquad_lpf(&vocal_harmonic.odd_deemph, 6000.0f, 0.5f);
 
-	fprintf(stderr, "vocal_harmonic:");
-	fprintf(stderr, " fund=%.2f", vocal_harmonic.fund_level);
-	fprintf(stderr, " even=%.2f", vocal_harmonic.even_level);
-	fprintf(stderr, " odd=%.2f", vocal_harmonic.odd_level);
-	fprintf(stderr, " trim=%.2f\n", vocal_harmonic.output_trim);
+	vocal_harmonic.track.enabled = 0;
+	vocal_harmonic_update(pot1, pot2, pot3, pot4);
 }
 
-float vocal_harmonic_step(float in)
+static float vocal_harmonic_step(float in)
 {
 	float path_a, path_b, path_c;
 
+	if (vocal_harmonic.track.enabled)
+		harmonic_track_step(&vocal_harmonic.track, in);
+
 	// Path A: Fundamental - maintain natural vocal tone
 	path_a = biquad_step(&vocal_harmonic.fund_hpf, in);
 	path_a = biquad_step(&vocal_harmonic.fund_lpf, path_a);
@@ -113,3 +132,20 @@ float vocal_harmonic_step(float in)
 
 	return limit_value(out);
 }
+
+// Tracking mode: the even/odd filter corners follow the played
+// fundamental, keeping their ratio to the nominal 200 Hz
+static void vocal_harmonic_track_init(float pot1, float pot2, float pot3, float pot4)
+{
+	struct harmonic_tracker *t = &vocal_harmonic.track;
+
+	vocal_harmonic_init(pot1, pot2, pot3, pot4);
+
+	harmonic_track_init(t, 200.0f, 70.0f, 1000.0f);
+	harmonic_track_filter(t, &vocal_harmonic.even_lpf[0], 1500.0f, 0.54f);
+	harmonic_track_filter(t, &vocal_harmonic.even_lpf[1], 1500.0f, 1.31f);
+	harmonic_track_filter(t, &vocal_harmonic.odd_lpf, 4000.0f, 0.707f);
+
+	fprintf(stderr, "vocal_harmonic: tracking 70-1000 Hz\n");
+}
+#define vocal_harmonic_track_step vocal_harmonic_step
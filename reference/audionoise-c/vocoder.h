@@ -0,0 +1,109 @@
+//
+// Channel vocoder
+//
+// The modulator (the input) and the carrier go through matching
+// sets of log-spaced bandpass filters. Each modulator band drives
+// an envelope follower, and that envelope sets the level of the
+// same carrier band. The carrier is the sidechain when the host
+// has one, and otherwise a built-in sawtooth plus some noise.
+//
+// Both filter sets are one biquad bank, analysis bands first and
+// then synthesis bands, and the followers run four bands at a time
+// too. So the per-sample cost is a fixed loop over groups of four
+// bands, with no per-band scalar code at all.
+//
+//  pot1: internal carrier pitch (55 .. 220 Hz)
+//  pot2: bands (16 .. 32)
+//  pot3: envelope release (5 .. 80 ms)
+//  pot4: noise in the internal carrier
+//
+#define VOCODER_MAX_BANDS 32
+#define VOCODER_VECS (VOCODER_MAX_BANDS/VEC_WIDTH)
+#define VOCODER_LOW 80
+#define VOCODER_HIGH 8000
+
+static struct {
+	struct biquad_bank bank;
+	vec4 env[VOCODER_VECS];
+	int vecs;
+	float attack, decay, gain, noise;
+	struct lfo_state carrier;
+	uint seed;
+} vocoder;
+
+EFFECT_MEMORY(vocoder, sizeof(vocoder), 0, 0, 0, .sidechain = 1);
+EFFECT_STATE(vocoder, REGION(vocoder));
+
+// A pot change keeps the filter and envelope state. A new band
+// count retunes the filters under it, which ring a little as they
+// settle, much like a sweep.
+static void vocoder_update(float pot1, float pot2, float pot3, float pot4)
+{
+	float pitch = 55 * powf(4, pot1);
+	int bands = 16 + (int)(pot2 * 16 + 0.5f) / VEC_WIDTH * VEC_WIDTH;
+	float release = linear(pot3, 5, 80);
+	float ratio = powf((float)VOCODER_HIGH / VOCODER_LOW, 1.0f / (bands - 1));
+	float Q = 1 / (sqrtf(ratio) - 1 / sqrtf(ratio));
+
+	vocoder.vecs = bands / VEC_WIDTH;
+	vocoder.bank.vecs = 2 * vocoder.vecs;
+	for (int i = 0; i < bands; i++) {
+		struct biquad_coeff c;
+
+		_biquad_bpf(&c, VOCODER_LOW * powf(ratio, i), Q);
+		biquad_bank_set(&vocoder.bank, i, &c);
+		biquad_bank_set(&vocoder.bank, bands + i, &c);
+	}
+
+	vocoder.attack = 1 / (2 * SAMPLES_PER_MSEC);
+	vocoder.decay = 1 / (release * SAMPLES_PER_MSEC);
+
+	// Narrower bands pass less of a broadband carrier
+	vocoder.gain = 1.3f * sqrtf(Q);
+	vocoder.noise = pot4;
+	set_lfo_freq(&vocoder.carrier, pitch);
+
+	fprintf(stderr, "vocoder:");
+	fprintf(stderr, " pitch=%g Hz", pitch);
+	fprintf(stderr, " bands=%d", bands);
+	fprintf(stderr, " Q=%g", Q);
+	fprintf(stderr, " release=%g ms", release);
+	fprintf(stderr, " noise=%g\n", pot4);
+}
+
+static void vocoder_init(float pot1, float pot2, float pot3, float pot4)
+{
+	memset(&vocoder, 0, sizeof(vocoder));
+	vocoder.seed = 1;
+	vocoder_update(pot1, pot2, pot3, pot4);
+}
+
+static inline float _vocoder_step(float modulator, float carrier)
+{
+	int n = vocoder.vecs;
+	vec4 x[2*VOCODER_VECS], sum = vec4_set1(0);
+
+	for (int v = 0; v < n; v++) {
+		x[v] = vec4_set1(modulator);
+		x[n+v] = vec4_set1(carrier);
+	}
+	biquad_bank_step(&vocoder.bank, x);
+
+	for (int v = 0; v < n; v++) {
+		vec4 env = _magnitude_step_vec(vocoder.env + v, x[v], vocoder.attack, vocoder.decay);
+		sum += env * x[n+v];
+	}
+	return vec4_sum(sum) * vocoder.gain;
+}
+
+static float vocoder_step(float in)
+{
+	float carrier = effect_sidechain;
+
+	if (!effect_has_sidechain) {
+		float saw = 2 * lfo_step_bl(&vocoder.carrier, lfo_sawtooth) - 1;
+		float noise = (int)xorshift32(&vocoder.seed) * (1.0f / 0x80000000);
+		carrier = saw + (noise - saw) * vocoder.noise;
+	}
+	return limit_value(_vocoder_step(in, carrier));
+}
@@ -0,0 +1,124 @@
+/**
+ * JACK Bridge Unit Tests
+ *
+ * Tests for parseNativeStatus(), which reads the status lines the
+ * native client (reference/audionoise-c/jackhost.c) writes to stdout
+ */
+
+import { describe, it, expect } from 'vitest';
+import { parseNativeStatus } from '../jack-bridge';
+
+// A line as jackhost writes it, for a vocoder with its sidechain port
+const STATUS_LINE = JSON.stringify({
+  sampleRate: 48000,
+  bufferSize: 256,
+  cpuLoad: 0.86,
+  dspLoad: 0.74,
+  xruns: 2,
+  ports: [
+    { name: 'audionoise:vocoder_in', direction: 'input', connections: ['system:capture_1'] },
+    { name: 'audionoise:vocoder_side', direction: 'input', connections: ['system:capture_2'] },
+    { name: 'audionoise:vocoder_out', direction: 'output', connections: ['system:playback_1'] },
+  ],
+});
+
+describe('parseNativeStatus', () => {
+  describe('valid status line', () => {
+    it('should take the server state from the line', () => {
+      const status = parseNativeStatus(STATUS_LINE);
+
+      expect(status).toMatchObject({
+        isConnected: true,
+        isRunning: true,
+        sampleRate: 48000,
+        bufferSize: 256,
+        cpuLoad: 0.86,
+        xruns: 2,
+      });
+    });
+
+    it('should split the port names into client and port', () => {
+      const status = parseNativeStatus(STATUS_LINE);
+
+      expect(status?.ports).toHaveLength(3);
+      expect(status?.ports?.[1]).toEqual({
+        name: 'audionoise:vocoder_side',
+        clientName: 'audionoise',
+        portName: 'vocoder_side',
+        type: 'audio',
+        direction: 'input',
+        isPhysical: false,
+        connections: ['system:capture_2'],
+      });
+      expect(status?.ports?.[2].direction).toBe('output');
+    });
+  });
+
+  describe('non-JSON line', () => {
+    it('should return null for text', () => {
+      expect(parseNativeStatus('vocoder: pitch=110 Hz bands=24')).toBeNull();
+    });
+
+    it('should return null for an empty or cut-off line', () => {
+      expect(parseNativeStatus('')).toBeNull();
+      expect(parseNativeStatus(STATUS_LINE.slice(0, 40))).toBeNull();
+    });
+
+    it('should return null for JSON that is not an object', () => {
+      expect(parseNativeStatus('null')).toBeNull();
+      expect(parseNativeStatus('48000')).toBeNull();
+    });
+  });
+
+  describe('missing sampleRate', () => {
+    it('should return null without a sampleRate', () => {
+      expect(parseNativeStatus(JSON.stringify({ bufferSize: 256, ports: [] }))).toBeNull();
+    });
+
+    it('should return null for a sampleRate that is not a number', () => {
+      expect(parseNativeStatus(JSON.stringify({ sampleRate: '48000', ports: [] }))).toBeNull();
+    });
+  });
+
+  describe('malformed ports', () => {
+    it('should give no ports when ports is not an array', () => {
+      const status = parseNativeStatus(JSON.stringify({ sampleRate: 48000, ports: 'none' }));
+
+      expect(status?.ports).toEqual([]);
+    });
+
+    it('should skip ports without a string name', () => {
+      const status = parseNativeStatus(
+        JSON.stringify({
+          sampleRate: 48000,
+          ports: [null, 7, { direction: 'input' }, { name: 42 }, { name: 'audionoise:echo_out' }],
+        })
+      );
+
+      expect(status?.ports).toHaveLength(1);
+      expect(status?.ports?.[0].name).toBe('audionoise:echo_out');
+    });
+
+    it('should default the direction, connections and names of a partial port', () => {
+      const status = parseNativeStatus(
+        JSON.stringify({
+          sampleRate: 48000,
+          ports: [{ name: 'orphan', direction: 'sideways', connections: 'system:capture_1' }],
+        })
+      );
+
+      expect(status?.ports?.[0]).toMatchObject({
+        clientName: 'orphan',
+        portName: '',
+        direction: 'output',
+        connections: [],
+      });
+    });
+
+    it('should zero the numbers that are missing or not numbers', () => {
+      const status = parseNativeStatus(JSON.stringify({ sampleRate: 48000, cpuLoad: 'high' }));
+
+      expect(status).toMatchObject({ bufferSize: 0, cpuLoad: 0, xruns: 0, ports: [] });
+    });
+  });
+});
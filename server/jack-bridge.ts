@@ -7,11 +7,14 @@
  * - JACK server status monitoring
  * - Port enumeration
  * - Port connection/disconnection
+ * - A native DSP client (reference/audionoise-c/jackhost) when
+ *   JACK_NATIVE_CLIENT is set, reporting DSP load and xruns
  */
 
 import { WebSocket, WebSocketServer } from 'ws';
 import { exec, spawn, ChildProcess } from 'child_process';
 import { promisify } from 'util';
+import { createInterface } from 'readline';
 
 const execAsync = promisify(exec);
 
@@ -46,6 +49,51 @@ interface JackBridgeCommand {
   args?: any;
 }
 
+/**
+ * Parse a status line from the native client (jackhost). It writes one
+ * JSON object per line with the server's sample rate, period, DSP load
+ * and xruns, and its own ports with their connections.
+ * Returns null for anything that isn't a status line.
+ */
+export function parseNativeStatus(line: string): Partial<JackServerState> | null {
+  let status: any;
+  try {
+    status = JSON.parse(line);
+  } catch {
+    return null;
+  }
+  if (!status || typeof status !== 'object' || typeof status.sampleRate !== 'number') {
+    return null;
+  }
+
+  const ports: JackPort[] = Array.isArray(status.ports)
+    ? status.ports
+        .filter((p: any) => p && typeof p.name === 'string')
+        .map((p: any) => {
+          const [clientName, portName] = p.name.split(':');
+          return {
+            name: p.name,
+            clientName: clientName || '',
+            portName: portName || '',
+            type: 'audio',
+            direction: p.direction === 'input' ? 'input' : 'output',
+            isPhysical: false,
+            connections: Array.isArray(p.connections) ? p.connections : [],
+          };
+        })
+    : [];
+
+  return {
+    isConnected: true,
+    isRunning: true,
+    sampleRate: status.sampleRate,
+    bufferSize: Number(status.bufferSize) || 0,
+    cpuLoad: Number(status.cpuLoad) || 0,
+    xruns: Number(status.xruns) || 0,
+    ports,
+  };
+}
+
 const DEFAULT_STATE: JackServerState = {
   isConnected: false,
   isRunning: false,
@@ -62,9 +110,13 @@ export class JackBridge {
   private state: JackServerState = { ...DEFAULT_STATE };
   private pollInterval: NodeJS.Timeout | null = null;
   private isEnabled: boolean;
+  private hasJackTools = false;
+  private nativeCommand: string | undefined;
+  private nativeClient: ChildProcess | null = null;
 
   constructor() {
     this.isEnabled = process.env.JACK_BRIDGE_ENABLED === 'true';
+    this.nativeCommand = process.env.JACK_NATIVE_CLIENT || undefined;
   }
 
   /**
@@ -76,9 +128,9 @@ export class JackBridge {
       return;
     }
 
-    // Check if JACK tools are available
-    const jackAvailable = await this.checkJackAvailable();
-    if (!jackAvailable) {
+    // Check if JACK tools are available; the native client doesn't need them
+    this.hasJackTools = await this.checkJackAvailable();
+    if (!this.hasJackTools && !this.nativeCommand) {
       console.log('JACK Bridge: JACK tools not found, bridge disabled');
       return;
     }
@@ -93,12 +145,71 @@ export class JackBridge {
       console.error('JACK Bridge WebSocket error:', error);
     });
 
+    if (this.nativeCommand) {
+      this.startNativeClient(this.nativeCommand);
+    }
+
     // Start polling JACK status
-    this.startPolling();
+    if (this.hasJackTools) {
+      this.startPolling();
+    }
 
     console.log(`JACK Bridge: WebSocket server listening on port ${port}`);
   }
 
+  /**
+   * Start the native DSP client and follow its status lines.
+   * JACK_NATIVE_CHAINS is its chain arguments, each effect with its own pots,
+   * e.g. "phaser=0.5,0.3,0.5,0.5+echo=0.3,0.4,0.3,0.5 vocoder".
+   */
+  private startNativeClient(command: string): void {
+    const chains = (process.env.JACK_NATIVE_CHAINS || 'phaser').split(/\s+/).filter(Boolean);
+    const child = spawn(command, ['-i', '1', ...chains], { stdio: ['ignore', 'pipe', 'pipe'] });
+    this.nativeClient = child;
+
+    createInterface({ input: child.stdout! }).on('line', (line) => {
+      const status = parseNativeStatus(line);
+      if (status) {
+        this.applyNativeStatus(status);
+      }
+    });
+
+    createInterface({ input: child.stderr! }).on('line', (line) => {
+      console.error(`JACK Bridge: native client: ${line}`);
+    });
+
+    child.on('error', (error) => {
+      console.error('JACK Bridge: Failed to start native client:', error);
+    });
+
+    child.on('exit', (code, signal) => {
+      if (this.nativeClient === child) {
+        this.nativeClient = null;
+      }
+      console.log(`JACK Bridge: native client exited (${signal ?? code})`);
+      if (!this.hasJackTools) {
+        this.state = { ...DEFAULT_STATE };
+        this.broadcast({ type: 'state', data: this.state });
+      }
+    });
+
+    console.log(`JACK Bridge: native client started: ${command} ${chains.join(' ')}`);
+  }
+
+  /**
+   * Take the native client's load and xruns. With the JACK tools, the
+   * ports come from jack_lsp, which lists every client's, not only ours.
+   */
+  private applyNativeStatus(status: Partial<JackServerState>): void {
+    const { ports, ...info } = status;
+
+    Object.assign(this.state, info);
+    if (!this.hasJackTools && ports) {
+      this.state.ports = ports;
+    }
+    this.broadcast({ type: 'state', data: this.state });
+  }
+
   /**
    * Check if JACK tools are available on the system
    */
@@ -220,6 +331,11 @@ export class JackBridge {
    * Refresh JACK server state
    */
   private async refreshState(): Promise<void> {
+    // Without the tools, the native client's status lines are the state
+    if (!this.hasJackTools) {
+      return;
+    }
+
     const previousState = { ...this.state };
 
     try {
@@ -233,12 +349,15 @@ export class JackBridge {
         const info = await this.getJackInfo();
         this.state.sampleRate = info.sampleRate;
         this.state.bufferSize = info.bufferSize;
-        this.state.cpuLoad = info.cpuLoad;
-        this.state.xruns = info.xruns;
+        // The native client reports the real ones
+        if (!this.nativeClient) {
+          this.state.cpuLoad = info.cpuLoad;
+          this.state.xruns = info.xruns;
+        }
 
         // Get ports
         this.state.ports = await this.listPorts();
-      } else {
+      } else if (!this.nativeClient) {
         this.state = { ...DEFAULT_STATE };
       }
 
@@ -407,6 +526,11 @@ export class JackBridge {
    * Shutdown the JACK bridge
    */
   shutdown(): void {
+    if (this.nativeClient) {
+      this.nativeClient.kill('SIGTERM');
+      this.nativeClient = null;
+    }
+
     if (this.pollInterval) {
       clearInterval(this.pollInterval);
       this.pollInterval = null;